@@ -0,0 +1,143 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "payload.h"
+
+// Collects readings for one publish. A batch is due once it holds
+// maxReadings, once the next reading would make the payload too large for
+// one publish, or once its oldest reading has waited maxLatencyMs, so
+// sampling faster adds readings per message instead of messages. A backlog
+// of old readings is therefore sent in full batches straight away. A batch
+// holds readings of one boot only.
+
+#define BATCH_CAPACITY 64          // Upper bound for maxReadings
+
+class ReadingBatch {
+private:
+  SensorReading readings[BATCH_CAPACITY];
+  uint8_t count = 0;
+  bool closed = false;           // A reading didn't fit
+  uint8_t maxReadings = 1;
+  unsigned long maxLatencyMs = 0;
+  bool binary = true;
+  size_t maxBytes = SIZE_MAX;    // Largest payload encode() may produce
+  size_t jsonBytes = 0;          // JSON objects of the readings so far
+
+  static void toJson(JsonObject target, const SensorReading& reading) {
+    target["temperature"] = reading.temperature;
+    target["humidity"] = reading.humidity;
+    target["timestamp"] = reading.timestamp;
+    target["boot"] = reading.boot;
+  }
+
+  static size_t jsonSize(const SensorReading& reading) {
+    JsonDocument doc;
+    toJson(doc.to<JsonObject>(), reading);
+    return measureJson(doc);
+  }
+
+  // Payload length of n readings whose JSON objects take objectBytes
+  size_t encodedSize(uint8_t n, size_t objectBytes) {
+    if (binary) {
+      return n == 1 ? PAYLOAD_READING_SIZE : PAYLOAD_BATCH_HEADER_SIZE + (size_t)n * PAYLOAD_BATCH_ENTRY_SIZE;
+    }
+    // {"readings":[...]} around the objects, commas between them
+    return n == 1 ? objectBytes : strlen("{\"readings\":[]}") + objectBytes + n - 1;
+  }
+
+  // Statistics
+  unsigned long readingsSent = 0;
+  unsigned long batchesSent = 0;
+
+public:
+  // maxReadings is capped at BATCH_CAPACITY. 1 reading or no latency
+  // publishes every reading on its own. Payloads are binary or JSON.
+  void configure(uint8_t readingsPerBatch, unsigned long latencyMs, bool binaryPayload) {
+    maxReadings = constrain(readingsPerBatch, 1, BATCH_CAPACITY);
+    maxLatencyMs = latencyMs;
+    binary = binaryPayload;
+  }
+
+  // Largest payload a publish can take, see MqttSession::maxPayload().
+  // Applies to readings added from now on.
+  void limitPayload(size_t bytes) {
+    maxBytes = bytes;
+  }
+
+  // Returns false if the reading doesn't fit, publish the batch first
+  bool add(const SensorReading& reading) {
+    if (count == maxReadings || closed) return false;
+    if (count > 0 && (reading.boot != readings[0].boot ||
+                      reading.timestamp - readings[count - 1].timestamp > PAYLOAD_BATCH_MAX_GAP)) {
+      closed = true;
+      return false;
+    }
+    size_t objectBytes = binary ? 0 : jsonSize(reading);
+    if (encodedSize(count + 1, jsonBytes + objectBytes) > maxBytes) {
+      // The readings so far go out on their own
+      closed = count > 0;
+      return false;
+    }
+    readings[count++] = reading;
+    jsonBytes += objectBytes;
+    return true;
+  }
+
+  bool due(unsigned long now) {
+    if (count == 0) return false;
+    return count == maxReadings || closed || now - readings[0].timestamp >= maxLatencyMs;
+  }
+
+  uint8_t capacity() { return maxReadings; }
+
+  uint8_t size() { return count; }
+
+  const SensorReading& reading(uint8_t index) { return readings[index]; }
+
+  // Encode the batch into out, binary or as JSON. A single reading uses
+  // the single reading layout. Returns the payload length, 0 if it doesn't
+  // fit.
+  size_t encode(uint8_t* out, size_t size) {
+    if (count == 0) return 0;
+    if (binary) {
+      return count == 1 ? encodeReading(readings[0], out, size) : encodeBatch(readings, count, out, size);
+    }
+
+    JsonDocument doc;
+    JsonObject target = doc.to<JsonObject>();
+    JsonArray list;
+    if (count > 1) list = doc["readings"].to<JsonArray>();
+    for (uint8_t i = 0; i < count; i++) {
+      if (count > 1) target = list.add<JsonObject>();
+      toJson(target, readings[i]);
+    }
+    if (measureJson(doc) >= size) return 0;
+    return serializeJson(doc, (char*)out, size);
+  }
+
+  void clear() {
+    count = 0;
+    closed = false;
+    jsonBytes = 0;
+  }
+
+  // Count the batch as sent. Its readings stay readable until clear().
+  void published() {
+    readingsSent += count;
+    batchesSent++;
+  }
+
+  void printStats(Print& out) {
+    out.print("Batches: ");
+    out.print(readingsSent);
+    out.print(" readings in ");
+    out.print(batchesSent);
+    out.print(" publishes, ");
+    out.print(batchesSent ? (float)readingsSent / batchesSent : 0.0f);
+    out.println(" per publish");
+  }
+};
+
+#endif // BATCH_H
@@ -0,0 +1,168 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <Arduino.h>
+#include <WiFiNINA.h>
+#include "mqtt_session.h"
+
+// Keeps WiFi and the MQTT session up without holding loop(). poll() does
+// at most one step per call: start a WiFi join, check on it, or try one
+// MQTT connect. Failed attempts are retried with exponential backoff and
+// some jitter, so a broker that is down isn't hammered.
+//
+// WiFi.begin() is started with a zero timeout and returns at once, the
+// join is then followed with WiFi.status(). The session's connect() still
+// blocks for the TCP connect and the CONNACK, the latter bounded by
+// MQTT_SESSION_CONNECT_TIMEOUT_MS. Sampling runs in its own thread and
+// isn't held up by either.
+
+#define WIFI_JOIN_TIMEOUT_MS 15000
+#define BACKOFF_INITIAL_MS 1000
+#define BACKOFF_MAX_MS 60000
+
+enum ConnectionState {
+  CONNECTION_WIFI_DOWN = 0,  // Waiting to start a join
+  CONNECTION_WIFI_JOINING,   // Join started, waiting for WL_CONNECTED
+  CONNECTION_MQTT_DOWN,      // WiFi up, waiting to connect to the broker
+  CONNECTION_UP
+};
+
+const char* const CONNECTION_STATE_NAMES[] = { "wifi down", "wifi joining", "mqtt down", "up" };
+
+class ConnectionManager {
+private:
+  MqttSession& mqtt;
+  const char* ssid;
+  const char* pass;
+  const char* clientId;
+  const char* username;
+  const char* password;
+
+  ConnectionState state = CONNECTION_WIFI_DOWN;
+  unsigned long stateSince = 0;
+  unsigned long nextAttempt = 0;
+  unsigned long backoffMs = BACKOFF_INITIAL_MS;
+
+  // Statistics
+  unsigned long wifiJoins = 0;
+  unsigned long mqttConnects = 0;
+  unsigned long failedAttempts = 0;
+
+  void enter(ConnectionState next) {
+    if (next == state) return;
+    Serial.print("Connection: ");
+    Serial.println(CONNECTION_STATE_NAMES[next]);
+    state = next;
+    stateSince = millis();
+  }
+
+  // Wait before the next attempt, twice as long as the last time
+  void retryLater() {
+    failedAttempts++;
+    nextAttempt = millis() + backoffMs + random(backoffMs / 4 + 1);
+    backoffMs = min(backoffMs * 2, (unsigned long)BACKOFF_MAX_MS);
+  }
+
+  void printAddress() {
+    Serial.print("IP: ");
+    Serial.println(WiFi.localIP());
+
+    byte mac[6];
+    WiFi.macAddress(mac);
+    Serial.print("MAC Address: ");
+    for (int i = 0; i < 6; i++) {
+      if (mac[i] < 0x10) Serial.print("0");
+      Serial.print(mac[i], HEX);
+      if (i < 5) Serial.print(":");
+    }
+    Serial.println();
+  }
+
+public:
+  ConnectionManager(MqttSession& session, const char* wifiSsid, const char* wifiPass,
+                    const char* mqttClientId, const char* mqttUsername, const char* mqttPassword)
+    : mqtt(session), ssid(wifiSsid), pass(wifiPass), clientId(mqttClientId),
+      username(mqttUsername), password(mqttPassword) {
+  }
+
+  void begin() {
+    WiFi.setTimeout(0);
+    randomSeed(micros());
+  }
+
+  // One step towards being connected, or keep the session alive if it is
+  void poll() {
+    bool wifiUp = WiFi.status() == WL_CONNECTED;
+    if (!wifiUp && state != CONNECTION_WIFI_DOWN && state != CONNECTION_WIFI_JOINING) {
+      enter(CONNECTION_WIFI_DOWN);
+    }
+
+    switch (state) {
+      case CONNECTION_WIFI_DOWN:
+        if ((long)(millis() - nextAttempt) >= 0) {
+          Serial.print("Connecting to WiFi: ");
+          Serial.println(ssid);
+          WiFi.begin(ssid, pass);
+          enter(CONNECTION_WIFI_JOINING);
+        }
+        break;
+
+      case CONNECTION_WIFI_JOINING:
+        if (wifiUp) {
+          wifiJoins++;
+          backoffMs = BACKOFF_INITIAL_MS;
+          nextAttempt = millis();
+          printAddress();
+          enter(CONNECTION_MQTT_DOWN);
+        } else if (millis() - stateSince > WIFI_JOIN_TIMEOUT_MS) {
+          Serial.println("WiFi join timed out");
+          WiFi.disconnect();
+          retryLater();
+          enter(CONNECTION_WIFI_DOWN);
+        }
+        break;
+
+      case CONNECTION_MQTT_DOWN:
+        if ((long)(millis() - nextAttempt) >= 0) {
+          Serial.print("Attempting MQTT connection...");
+          if (mqtt.connect(clientId, username, password)) {
+            Serial.println("connected");
+            mqttConnects++;
+            backoffMs = BACKOFF_INITIAL_MS;
+            enter(CONNECTION_UP);
+          } else {
+            Serial.print("failed, rc=");
+            Serial.println(mqtt.state());
+            retryLater();
+          }
+        }
+        break;
+
+      case CONNECTION_UP:
+        if (!mqtt.loop()) {
+          Serial.print("MQTT connection lost, rc=");
+          Serial.println(mqtt.state());
+          nextAttempt = millis();
+          enter(CONNECTION_MQTT_DOWN);
+        }
+        break;
+    }
+  }
+
+  bool connected() { return state == CONNECTION_UP; }
+  ConnectionState currentState() { return state; }
+
+  void printStats(Print& out) {
+    out.print("Connection: ");
+    out.print(CONNECTION_STATE_NAMES[state]);
+    out.print(", ");
+    out.print(wifiJoins);
+    out.print(" WiFi joins, ");
+    out.print(mqttConnects);
+    out.print(" MQTT connects, ");
+    out.print(failedAttempts);
+    out.println(" failed attempts");
+  }
+};
+
+#endif // CONNECTION_H
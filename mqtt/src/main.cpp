@@ -1,19 +1,54 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <WiFiNINA.h>
-#include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include "secrets.h" // Include the secrets header file with all credentials
+#include "payload.h"
+#include "batch.h"
+#include "offline_spool.h"
+#include "mqtt_session.h"
+#include "publisher.h"
+#include "connection.h"
+
+// Publish readings in the binary format from payload.h instead of JSON
+#define PAYLOAD_BINARY true
+
+// Sampling and batching. A publish goes out when BATCH_MAX_READINGS are
+// collected or the oldest one has waited BATCH_MAX_LATENCY_MS, whichever
+// comes first. 1 reading per batch publishes every reading on its own.
+#define SAMPLE_INTERVAL_MS 100
+#define BATCH_MAX_READINGS 32
+#define BATCH_MAX_LATENCY_MS 5000
+// QoS 1 publishes are kept until the broker acknowledges them, up to
+// MQTT_INFLIGHT_WINDOW at a time. QoS 0 publishes are fire and forget.
+#define MQTT_QOS 1
+#define MQTT_INFLIGHT_WINDOW 8
+// MQTT 5 sends the topic once per connection and a 2 byte alias after
+// that. Brokers without MQTT 5 get 3.1.1 from the second attempt on.
+#define MQTT_PROTOCOL MQTT_PROTOCOL_V5
+// Readings older than this are dropped, here or by the broker (MQTT 5)
+#define MQTT_MESSAGE_EXPIRY_S 3600
+// Most publishes per loop() while working off a backlog
+#define DRAIN_PUBLISHES_PER_LOOP 8
+#define STATS_INTERVAL_MS 60000
 
 // Initialize WiFi client
 WiFiClient wifiClient;
-// Initialize MQTT client
-PubSubClient mqttClient(wifiClient);
+// Initialize MQTT session
+MqttSession mqttSession(wifiClient);
+ConnectionManager connection(mqttSession, ssid, pass, mqtt_client_id, mqtt_username, mqtt_password);
+// Readings queue here until they are published, on flash during outages
+ReadingSpool spool;
+// The readings of the next publish
+ReadingBatch batch;
+ReadingPublisher publisher(mqttSession, spool, batch, mqtt_topic, MQTT_QOS);
+// Samples on schedule, whatever the network is doing
+rtos::Thread samplerThread;
 
 // Function prototypes
-void connectToWiFi();
-void connectToMQTT();
-void publishSensorData();
+void samplerLoop();
+SensorReading takeReading();
+void publishDone(uint32_t tag, bool acknowledged);
 
 void setup() {
   // Initialize serial communication
@@ -25,107 +60,72 @@ void setup() {
   Serial.println("\n=== MQTT Client Starting ===");
   
   // Set MQTT server and port
-  mqttClient.setServer(mqtt_server, mqtt_port);
-  
-  // Connect to WiFi
-  connectToWiFi();
-  
-  // Connect to MQTT broker
-  connectToMQTT();
+  mqttSession.setServer(mqtt_server, mqtt_port);
+  mqttSession.setProtocol(MQTT_PROTOCOL);
+  mqttSession.setWindow(MQTT_INFLIGHT_WINDOW);
+  mqttSession.setMessageExpiry(MQTT_MESSAGE_EXPIRY_S);
+  mqttSession.onDone(publishDone);
+  batch.configure(BATCH_MAX_READINGS, BATCH_MAX_LATENCY_MS, PAYLOAD_BINARY);
+  
+  // Pick up readings left on flash before the reset, and count this boot
+  spool.begin();
+  samplerThread.start(samplerLoop);
+  
+  // Connecting happens in loop()
+  connection.begin();
+  Serial.print("MQTT broker at ");
+  Serial.print(mqtt_server);
+  Serial.print(":");
+  Serial.println(mqtt_port);
 }
 
 void loop() {
-  // Check WiFi connection
-  if (WiFi.status() != WL_CONNECTED) {
-    connectToWiFi();
-  }
-  
-  // Check MQTT connection
-  if (!mqttClient.connected()) {
-    connectToMQTT();
-  }
-  
-  // Keep MQTT connection alive
-  mqttClient.loop();
+  // One step of connecting, or keeping the connection alive
+  connection.poll();
   
-  // Publish sensor data
-  publishSensorData();
-  
-  // Wait before sending next message
-  delay(5000);
-}
-
-void connectToWiFi() {
-  Serial.print("Connecting to WiFi: ");
-  Serial.println(ssid);
+  // Move readings to flash while the ring fills up
+  spool.service();
   
-  WiFi.begin(ssid, pass);
-  
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.print(".");
+  // Publish due batches, several in a row while there is a backlog
+  for (int i = 0; i < DRAIN_PUBLISHES_PER_LOOP && connection.connected(); i++) {
+    if (!publisher.publish()) break;
   }
   
-  Serial.println("Connected!");
-  Serial.print("IP: ");
-  Serial.println(WiFi.localIP());
-  
-  // Print MAC address
-  byte mac[6];
-  WiFi.macAddress(mac);
-  Serial.print("MAC Address: ");
-  for (int i = 0; i < 6; i++) {
-    if (mac[i] < 0x10) Serial.print("0");
-    Serial.print(mac[i], HEX);
-    if (i < 5) Serial.print(":");
+  static unsigned long lastStats = 0;
+  if (millis() - lastStats >= STATS_INTERVAL_MS) {
+    lastStats = millis();
+    connection.printStats(Serial);
+    mqttSession.printStats(Serial);
+    spool.printStats(Serial);
+    batch.printStats(Serial);
   }
-  Serial.println();
 }
 
-void connectToMQTT() {
-  Serial.print("Connecting to MQTT broker at ");
-  Serial.print(mqtt_server);
-  Serial.print(":");
-  Serial.println(mqtt_port);
-  
-  // Loop until we're connected
-  while (!mqttClient.connected()) {
-    Serial.print("Attempting MQTT connection...");
-    
-    // Attempt to connect with username and password
-    if (mqttClient.connect(mqtt_client_id, mqtt_username, mqtt_password)) {
-      Serial.println("connected");
+void samplerLoop() {
+  unsigned long next = millis();
+  while (true) {
+    spool.push(takeReading());
+    next += SAMPLE_INTERVAL_MS;
+    long wait = (long)(next - millis());
+    if (wait > 0) {
+      rtos::ThisThread::sleep_for(std::chrono::milliseconds(wait));
     } else {
-      Serial.print("failed, rc=");
-      Serial.print(mqttClient.state());
-      Serial.println(" retrying in 5 seconds");
-      delay(5000);
+      // Fell behind, don't try to catch up with a burst
+      next = millis();
     }
   }
 }
 
-void publishSensorData() {
+SensorReading takeReading() {
   // Collect sensor data (replace with your actual sensor code)
-  float temperature = 25.5;
-  float humidity = 60.2;
-  
-  // Create JSON document
-  JsonDocument doc;
-  doc["temperature"] = temperature;
-  doc["humidity"] = humidity;
-  doc["timestamp"] = millis();
-  
-  // Serialize JSON to string
-  char msgBuffer[256];
-  serializeJson(doc, msgBuffer);
-  
-  // Publish message
-  Serial.print("Publishing message: ");
-  Serial.println(msgBuffer);
-  
-  if (mqttClient.publish(mqtt_topic, msgBuffer)) {
-    Serial.println("Publish successful");
-  } else {
-    Serial.println("Publish failed");
-  }
+  SensorReading reading;
+  reading.temperature = 25.5;
+  reading.humidity = 60.2;
+  reading.timestamp = millis();
+  reading.boot = spool.boot();
+  return reading;
+}
+
+void publishDone(uint32_t tag, bool acknowledged) {
+  publisher.done(tag, acknowledged);
 }
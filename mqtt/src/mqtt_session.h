@@ -0,0 +1,676 @@
+#ifndef MQTT_SESSION_H
+#define MQTT_SESSION_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// MQTT client session for publishing, QoS 0 and QoS 1, over MQTT 5 or
+// 3.1.1. PubSubClient only publishes at QoS 0, so this takes its place.
+//
+// QoS 1 publishes are pipelined: up to `window` of them may wait for their
+// PUBACK at once, so throughput isn't capped at one message per round trip.
+// Each one is kept until its PUBACK arrives. The session is opened with
+// Clean Session (Clean Start in MQTT 5) off, and after a reconnect every
+// unacknowledged publish is sent again, oldest first, with DUP set if the
+// broker still had the session. Delivery is at least once across
+// reconnects. What is in flight lives in RAM and is lost on a reset, so
+// the caller keeps its own copy until the done callback reports the
+// publish finished, by its tag.
+//
+// With MQTT 5 a topic goes out in full once per connection, later
+// publishes to it carry a 2 byte topic alias instead, as many as the
+// broker allows in its CONNACK. The broker's Receive Maximum caps the
+// window. Publishes can carry a message expiry, counted from when their
+// data was taken, so a broker doesn't hand out readings that went stale
+// while queued, here or there. A broker that refuses MQTT 5 gets 3.1.1
+// from the next attempt on.
+//
+// loop() reads whatever arrived without waiting. Keepalive pings are sent
+// when nothing else went out for the keepalive interval.
+
+#define MQTT_SESSION_MAX_WINDOW 16
+#define MQTT_SESSION_MAX_PACKET 512          // Largest PUBLISH, header and topic included
+#define MQTT_SESSION_MAX_ALIASES 4           // Topic aliases used at most
+#define MQTT_SESSION_KEEPALIVE_S 60
+#define MQTT_SESSION_EXPIRY_S 3600           // How long an MQTT 5 broker keeps the session
+#define MQTT_SESSION_CONNECT_TIMEOUT_MS 3000
+
+// state() values, the same as PubSubClient's. Refusals are the return or
+// reason code from the CONNACK.
+#define MQTT_SESSION_TIMEOUT -4
+#define MQTT_SESSION_LOST -3
+#define MQTT_SESSION_CONNECT_FAILED -2
+#define MQTT_SESSION_DISCONNECTED -1
+#define MQTT_SESSION_CONNECTED 0
+
+#define MQTT_PROTOCOL_V311 4
+#define MQTT_PROTOCOL_V5 5
+
+// Control packet types, shifted into the first byte
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+#define MQTT_PUBLISH_DUP 0x08
+#define MQTT_PUBLISH_QOS1 0x02
+
+// MQTT 5 properties used here
+#define MQTT_PROP_MESSAGE_EXPIRY 0x02
+#define MQTT_PROP_SESSION_EXPIRY 0x11
+#define MQTT_PROP_RECEIVE_MAXIMUM 0x21
+#define MQTT_PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT_PROP_TOPIC_ALIAS 0x23
+#define MQTT_PROP_MAXIMUM_PACKET_SIZE 0x27
+
+// CONNACK codes for a protocol version the broker doesn't speak
+#define MQTT_REFUSED_PROTOCOL_V311 0x01
+#define MQTT_REFUSED_PROTOCOL_V5 0x84
+
+// Called once a QoS 1 publish is finished: acknowledged is true for a
+// PUBACK that accepted it, false if the broker refused it or it expired
+// before it could be sent again
+typedef void (*PublishDoneCallback)(uint32_t tag, bool acknowledged);
+
+struct InFlightPublish {
+  bool used;
+  uint16_t packetId;
+  uint32_t tag;          // The caller's, handed back to the done callback
+  const char* topic;
+  uint16_t length;
+  unsigned long createdMs;   // When the oldest data in the payload was taken
+  unsigned long sentMs;
+  uint8_t payload[MQTT_SESSION_MAX_PACKET];
+};
+
+class MqttSession {
+private:
+  Client& client;
+  const char* host = NULL;
+  uint16_t port = 1883;
+  int sessionState = MQTT_SESSION_DISCONNECTED;
+  uint8_t protocol = MQTT_PROTOCOL_V5;
+  uint32_t messageExpiryS = 0;
+  PublishDoneCallback doneCallback = NULL;
+
+  uint8_t window = 8;
+  InFlightPublish inFlight[MQTT_SESSION_MAX_WINDOW];
+  uint8_t inFlightCount = 0;
+  uint16_t nextPacketId = 1;
+  uint8_t txBuffer[MQTT_SESSION_MAX_PACKET];
+
+  // What the broker allows on this connection, from its CONNACK
+  bool sessionPresent = false;
+  uint16_t receiveMaximum = 0xFFFF;
+  uint16_t topicAliasMaximum = 0;
+  uint32_t maximumPacketSize = MQTT_SESSION_MAX_PACKET;
+
+  // Topics that have an alias on this connection, alias i + 1
+  const char* aliasTopics[MQTT_SESSION_MAX_ALIASES];
+  uint8_t aliasCount = 0;
+
+  unsigned long lastSent = 0;
+  unsigned long lastReceived = 0;
+  bool pingOutstanding = false;
+
+  // Incoming packet being read
+  uint8_t rxHeader = 0;
+  uint8_t rxLengthBytes = 0;     // Remaining length bytes seen, 0 before the header
+  bool rxLengthDone = false;
+  uint32_t rxLength = 0;         // Remaining length from the fixed header
+  uint32_t rxRead = 0;           // Bytes of the body read so far
+  uint8_t rxBody[64];            // Only the start of a body is kept
+
+  // Statistics
+  unsigned long published = 0;
+  unsigned long acknowledged = 0;
+  unsigned long retransmitted = 0;
+  unsigned long windowFull = 0;
+  unsigned long aliased = 0;
+  unsigned long expired = 0;
+  unsigned long rejected = 0;
+  unsigned long maxAckMs = 0;
+
+  static size_t putLength(uint8_t* out, uint32_t length) {
+    size_t n = 0;
+    do {
+      uint8_t byte = length % 128;
+      length /= 128;
+      out[n++] = byte | (length > 0 ? 0x80 : 0);
+    } while (length > 0);
+    return n;
+  }
+
+  // Read a variable byte integer. Returns the bytes it took, 0 if it runs
+  // past size.
+  static size_t getLength(const uint8_t* in, size_t size, uint32_t& length) {
+    length = 0;
+    for (size_t n = 0; n < size && n < 4; n++) {
+      length |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+      if (!(in[n] & 0x80)) return n + 1;
+    }
+    return 0;
+  }
+
+  static size_t putString(uint8_t* out, const char* text) {
+    size_t length = strlen(text);
+    out[0] = length >> 8;
+    out[1] = length & 0xFF;
+    memcpy(out + 2, text, length);
+    return length + 2;
+  }
+
+  static size_t putUint32(uint8_t* out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+    return 4;
+  }
+
+  // Size of a fixed size property value, 0 for the variable length ones
+  static uint8_t propertySize(uint8_t id) {
+    switch (id) {
+      case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+        return 1;
+      case 0x13: case 0x21: case 0x22: case 0x23:
+        return 2;
+      case 0x02: case 0x11: case 0x18: case 0x27:
+        return 4;
+      default:
+        return 0;
+    }
+  }
+
+  bool send(const uint8_t* packet, size_t length) {
+    if (client.write(packet, length) != length) {
+      lost();
+      return false;
+    }
+    lastSent = millis();
+    return true;
+  }
+
+  void lost() {
+    client.stop();
+    sessionState = MQTT_SESSION_LOST;
+  }
+
+  uint16_t takePacketId() {
+    uint16_t id = nextPacketId++;
+    if (nextPacketId == 0) nextPacketId = 1;
+    return id;
+  }
+
+  // How many packet ids were handed out since this one
+  uint16_t age(const InFlightPublish& entry) {
+    return nextPacketId - entry.packetId;
+  }
+
+  uint16_t effectiveWindow() {
+    return min((uint16_t)window, receiveMaximum);
+  }
+
+  // Largest packet a publish to topic can become, with every property
+  size_t publishSize(const char* topic, size_t length, uint8_t qos) {
+    size_t remaining = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + length;
+    if (protocol == MQTT_PROTOCOL_V5) remaining += 1 + 5 + 3;
+    return 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : 3) + remaining;
+  }
+
+  // The alias for topic on this connection, 0 for none. Sets known if the
+  // broker has already seen the topic with it.
+  uint16_t topicAlias(const char* topic, bool& known) {
+    known = false;
+    if (protocol != MQTT_PROTOCOL_V5) return 0;
+    for (uint8_t i = 0; i < aliasCount; i++) {
+      if (strcmp(aliasTopics[i], topic) == 0) {
+        known = true;
+        return i + 1;
+      }
+    }
+    if (aliasCount >= min((uint16_t)MQTT_SESSION_MAX_ALIASES, topicAliasMaximum)) return 0;
+    aliasTopics[aliasCount++] = topic;
+    return aliasCount;
+  }
+
+  // Encode a publish into txBuffer and send it. The caller has checked
+  // publishSize() against the buffer.
+  bool sendPublish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos,
+                   uint16_t packetId, bool dup, uint32_t expiryS) {
+    bool known;
+    uint16_t alias = topicAlias(topic, known);
+    const char* topicName = known ? "" : topic;
+
+    uint8_t properties[1 + 5 + 3];
+    size_t propertiesLength = 0;
+    if (protocol == MQTT_PROTOCOL_V5) {
+      if (expiryS > 0) {
+        properties[propertiesLength++] = MQTT_PROP_MESSAGE_EXPIRY;
+        propertiesLength += putUint32(properties + propertiesLength, expiryS);
+      }
+      if (alias > 0) {
+        properties[propertiesLength++] = MQTT_PROP_TOPIC_ALIAS;
+        properties[propertiesLength++] = alias >> 8;
+        properties[propertiesLength++] = alias & 0xFF;
+      }
+    }
+
+    size_t remaining = 2 + strlen(topicName) + (qos > 0 ? 2 : 0) + length;
+    if (protocol == MQTT_PROTOCOL_V5) remaining += 1 + propertiesLength;
+
+    size_t at = 0;
+    txBuffer[at++] = MQTT_PUBLISH | (qos > 0 ? MQTT_PUBLISH_QOS1 : 0) | (dup ? MQTT_PUBLISH_DUP : 0);
+    at += putLength(txBuffer + at, remaining);
+    at += putString(txBuffer + at, topicName);
+    if (qos > 0) {
+      txBuffer[at++] = packetId >> 8;
+      txBuffer[at++] = packetId & 0xFF;
+    }
+    if (protocol == MQTT_PROTOCOL_V5) {
+      txBuffer[at++] = propertiesLength;
+      memcpy(txBuffer + at, properties, propertiesLength);
+      at += propertiesLength;
+    }
+    memcpy(txBuffer + at, payload, length);
+    at += length;
+
+    if (known) aliased++;
+    return send(txBuffer, at);
+  }
+
+  // Seconds of the message expiry left for a publish, 0 once it expired
+  uint32_t expiryLeft(const InFlightPublish& entry) {
+    uint32_t waitedS = (millis() - entry.createdMs) / 1000;
+    return waitedS < messageExpiryS ? messageExpiryS - waitedS : 0;
+  }
+
+  void acknowledge(uint16_t packetId, uint8_t reason) {
+    for (uint8_t i = 0; i < MQTT_SESSION_MAX_WINDOW; i++) {
+      if (inFlight[i].used && inFlight[i].packetId == packetId) {
+        unsigned long took = millis() - inFlight[i].sentMs;
+        if (took > maxAckMs) maxAckMs = took;
+        inFlight[i].used = false;
+        inFlightCount--;
+        // A refusal is final, sending it again would get the same answer
+        if (reason >= 0x80) rejected++;
+        else acknowledged++;
+        if (doneCallback) doneCallback(inFlight[i].tag, reason < 0x80);
+        return;
+      }
+    }
+  }
+
+  // Take what this session needs from the CONNACK properties
+  void readConnackProperties() {
+    size_t end = min(rxRead, (uint32_t)sizeof(rxBody));
+    size_t at = 2;
+    uint32_t length;
+    size_t n = getLength(rxBody + at, end - at, length);
+    if (n == 0) return;
+    at += n;
+    end = min(end, at + length);
+
+    while (at < end) {
+      uint8_t id = rxBody[at++];
+      uint8_t size = propertySize(id);
+      uint32_t value = 0;
+      if (size > 0) {
+        if (at + size > end) return;
+        for (uint8_t i = 0; i < size; i++) value = (value << 8) | rxBody[at + i];
+        at += size;
+      } else if (id == 0x0B) {
+        n = getLength(rxBody + at, end - at, value);
+        if (n == 0) return;
+        at += n;
+      } else {
+        // Strings and binary data, a user property is a pair of strings
+        for (uint8_t i = 0; i < (id == 0x26 ? 2 : 1); i++) {
+          if (at + 2 > end) return;
+          at += 2 + ((rxBody[at] << 8) | rxBody[at + 1]);
+        }
+      }
+
+      switch (id) {
+        case MQTT_PROP_RECEIVE_MAXIMUM: receiveMaximum = value; break;
+        case MQTT_PROP_TOPIC_ALIAS_MAXIMUM: topicAliasMaximum = value; break;
+        case MQTT_PROP_MAXIMUM_PACKET_SIZE: maximumPacketSize = value; break;
+      }
+    }
+  }
+
+  // A whole packet has been read
+  void handlePacket() {
+    lastReceived = millis();
+    switch (rxHeader & 0xF0) {
+      case MQTT_CONNACK:
+        if (rxLength < 2) break;
+        sessionPresent = rxBody[0] & 0x01;
+        if (rxBody[1] != 0) {
+          sessionState = rxBody[1];
+          break;
+        }
+        if (protocol == MQTT_PROTOCOL_V5) readConnackProperties();
+        sessionState = MQTT_SESSION_CONNECTED;
+        break;
+      case MQTT_PUBACK:
+        // MQTT 5 may add a reason code, left out when it is 0
+        if (rxLength >= 2) acknowledge((rxBody[0] << 8) | rxBody[1], rxLength >= 3 ? rxBody[2] : 0);
+        break;
+      case MQTT_PINGRESP:
+        pingOutstanding = false;
+        break;
+      case MQTT_DISCONNECT:
+        // Only MQTT 5 brokers send one, they close the connection after it
+        lost();
+        break;
+      default:
+        // Nothing is subscribed, anything else is ignored
+        break;
+    }
+  }
+
+  void resetReceive() {
+    rxHeader = 0;
+    rxLengthBytes = 0;
+    rxLengthDone = false;
+    rxLength = 0;
+    rxRead = 0;
+  }
+
+  // Read what has arrived, packet by packet, without waiting
+  void receive() {
+    while (client.available() > 0) {
+      int byte = client.read();
+      if (byte < 0) break;
+
+      if (rxLengthBytes == 0) {
+        rxHeader = byte;
+        rxLengthBytes = 1;
+        continue;
+      }
+      if (!rxLengthDone) {
+        rxLength |= (uint32_t)(byte & 0x7F) << (7 * (rxLengthBytes - 1));
+        rxLengthDone = !(byte & 0x80);
+        if (!rxLengthDone && ++rxLengthBytes > 4) {
+          lost();
+          return;
+        }
+      } else {
+        if (rxRead < sizeof(rxBody)) rxBody[rxRead] = byte;
+        rxRead++;
+      }
+
+      if (rxLengthDone && rxRead == rxLength) {
+        handlePacket();
+        resetReceive();
+      }
+    }
+  }
+
+  // Send all unacknowledged publishes again, oldest first. DUP is only
+  // set if the broker kept the session, otherwise they are new publishes
+  // to it. Publishes that expired on the way are dropped.
+  bool resendInFlight() {
+    uint8_t order[MQTT_SESSION_MAX_WINDOW];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < MQTT_SESSION_MAX_WINDOW; i++) {
+      if (!inFlight[i].used) continue;
+      // Insertion sort by age, packet ids are handed out in order
+      uint8_t at = count++;
+      while (at > 0 && age(inFlight[order[at - 1]]) < age(inFlight[i])) {
+        order[at] = order[at - 1];
+        at--;
+      }
+      order[at] = i;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+      InFlightPublish& entry = inFlight[order[i]];
+      uint32_t expiryS = 0;
+      if (messageExpiryS > 0) {
+        expiryS = expiryLeft(entry);
+        if (expiryS == 0) {
+          entry.used = false;
+          inFlightCount--;
+          expired++;
+          if (doneCallback) doneCallback(entry.tag, false);
+          continue;
+        }
+      }
+      if (!sendPublish(entry.topic, entry.payload, entry.length, 1, entry.packetId,
+                       sessionPresent, expiryS)) {
+        return false;
+      }
+      entry.sentMs = millis();
+      retransmitted++;
+    }
+    return true;
+  }
+
+public:
+  MqttSession(Client& networkClient) : client(networkClient) {
+    memset(inFlight, 0, sizeof(inFlight));
+  }
+
+  void setServer(const char* brokerHost, uint16_t brokerPort) {
+    host = brokerHost;
+    port = brokerPort;
+  }
+
+  // MQTT_PROTOCOL_V5 or MQTT_PROTOCOL_V311, used from the next connect()
+  void setProtocol(uint8_t level) {
+    protocol = level == MQTT_PROTOCOL_V311 ? MQTT_PROTOCOL_V311 : MQTT_PROTOCOL_V5;
+  }
+
+  // Number of QoS 1 publishes that may wait for their PUBACK at once
+  void setWindow(uint8_t size) {
+    window = constrain(size, 1, MQTT_SESSION_MAX_WINDOW);
+  }
+
+  // Called for every QoS 1 publish once it is finished, from loop() or
+  // connect()
+  void onDone(PublishDoneCallback callback) {
+    doneCallback = callback;
+  }
+
+  // MQTT 5 only: brokers drop publishes not delivered within this many
+  // seconds. 0 keeps them until delivered.
+  void setMessageExpiry(uint32_t seconds) {
+    messageExpiryS = seconds;
+  }
+
+  // Open the TCP connection and the session, then resend whatever was
+  // left unacknowledged. Waits up to MQTT_SESSION_CONNECT_TIMEOUT_MS for
+  // the CONNACK.
+  bool connect(const char* clientId, const char* username = NULL, const char* password = NULL) {
+    if (!client.connect(host, port)) {
+      sessionState = MQTT_SESSION_CONNECT_FAILED;
+      return false;
+    }
+
+    // Properties: Session Expiry Interval
+    size_t length = 10 + (protocol == MQTT_PROTOCOL_V5 ? 1 + 5 : 0) + 2 + strlen(clientId);
+    if (username) length += 2 + strlen(username);
+    if (password) length += 2 + strlen(password);
+    if (length + 5 > sizeof(txBuffer)) {
+      client.stop();
+      sessionState = MQTT_SESSION_CONNECT_FAILED;
+      return false;
+    }
+
+    size_t at = 0;
+    txBuffer[at++] = MQTT_CONNECT;
+    at += putLength(txBuffer + at, length);
+    at += putString(txBuffer + at, "MQTT");
+    txBuffer[at++] = protocol;
+    txBuffer[at++] = (username ? 0x80 : 0) | (password ? 0x40 : 0);   // Clean Session off
+    txBuffer[at++] = MQTT_SESSION_KEEPALIVE_S >> 8;
+    txBuffer[at++] = MQTT_SESSION_KEEPALIVE_S & 0xFF;
+    if (protocol == MQTT_PROTOCOL_V5) {
+      txBuffer[at++] = 5;
+      txBuffer[at++] = MQTT_PROP_SESSION_EXPIRY;
+      at += putUint32(txBuffer + at, MQTT_SESSION_EXPIRY_S);
+    }
+    at += putString(txBuffer + at, clientId);
+    if (username) at += putString(txBuffer + at, username);
+    if (password) at += putString(txBuffer + at, password);
+
+    // Aliases and limits only hold for one connection
+    aliasCount = 0;
+    receiveMaximum = 0xFFFF;
+    topicAliasMaximum = 0;
+    maximumPacketSize = MQTT_SESSION_MAX_PACKET;
+    resetReceive();
+    pingOutstanding = false;
+    sessionState = MQTT_SESSION_DISCONNECTED;
+    if (!send(txBuffer, at)) return false;
+
+    unsigned long started = millis();
+    while (sessionState == MQTT_SESSION_DISCONNECTED) {
+      if (millis() - started > MQTT_SESSION_CONNECT_TIMEOUT_MS) {
+        client.stop();
+        sessionState = MQTT_SESSION_TIMEOUT;
+        return false;
+      }
+      receive();
+      delay(1);
+    }
+    if (sessionState != MQTT_SESSION_CONNECTED) {
+      client.stop();
+      if (protocol == MQTT_PROTOCOL_V5 &&
+          (sessionState == MQTT_REFUSED_PROTOCOL_V311 || sessionState == MQTT_REFUSED_PROTOCOL_V5)) {
+        Serial.println("MQTT: broker refused MQTT 5, using 3.1.1");
+        protocol = MQTT_PROTOCOL_V311;
+      }
+      return false;
+    }
+    lastReceived = millis();
+    return resendInFlight();
+  }
+
+  void disconnect() {
+    uint8_t packet[2] = { MQTT_DISCONNECT, 0 };
+    if (connected()) send(packet, sizeof(packet));
+    client.stop();
+    sessionState = MQTT_SESSION_DISCONNECTED;
+  }
+
+  // True if data ageMs old is past the message expiry already
+  bool pastExpiry(uint32_t ageMs) {
+    return messageExpiryS > 0 && ageMs / 1000 >= messageExpiryS;
+  }
+
+  // Largest payload a publish to topic can carry, within our buffer and
+  // the broker's maximum packet size
+  size_t maxPayload(const char* topic, uint8_t qos) {
+    size_t limit = min((size_t)MQTT_SESSION_MAX_PACKET, (size_t)maximumPacketSize);
+    size_t overhead = publishSize(topic, 0, qos);
+    if (overhead >= limit) return 0;
+    size_t length = limit - overhead;
+    while (length > 0 && publishSize(topic, length, qos) > limit) length--;
+    return length;
+  }
+
+  // Publish at QoS 0 or 1. A QoS 1 publish returns false without sending
+  // if the window is full, call loop() to take in PUBACKs and try again.
+  // The topic must stay valid until the publish is acknowledged. tag comes
+  // back with the done callback of a QoS 1 publish. ageMs is how long ago
+  // the oldest data in the payload was taken, the message expiry counts
+  // from then. Data past the expiry is refused, check pastExpiry() first.
+  bool publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos = 1,
+               uint32_t tag = 0, uint32_t ageMs = 0) {
+    if (!connected()) return false;
+    if (pastExpiry(ageMs)) return false;
+    if (qos > 0 && !windowOpen()) {
+      windowFull++;
+      return false;
+    }
+    size_t size = publishSize(topic, length, qos);
+    if (size > MQTT_SESSION_MAX_PACKET || size > maximumPacketSize) return false;
+
+    published++;
+    uint32_t expiryS = messageExpiryS > 0 ? messageExpiryS - ageMs / 1000 : 0;
+    if (qos == 0) {
+      return sendPublish(topic, payload, length, 0, 0, false, expiryS);
+    }
+
+    // QoS 1 publishes are kept until their PUBACK
+    InFlightPublish* entry = NULL;
+    for (uint8_t i = 0; i < MQTT_SESSION_MAX_WINDOW && !entry; i++) {
+      if (!inFlight[i].used) entry = &inFlight[i];
+    }
+    entry->used = true;
+    entry->packetId = takePacketId();
+    entry->tag = tag;
+    entry->topic = topic;
+    entry->length = length;
+    memcpy(entry->payload, payload, length);
+    entry->sentMs = millis();
+    entry->createdMs = entry->sentMs - ageMs;
+    inFlightCount++;
+
+    // A failed send leaves the publish in flight for the reconnect
+    sendPublish(topic, payload, length, 1, entry->packetId, false, expiryS);
+    return true;
+  }
+
+  // Take in what the broker sent and keep the connection alive. Returns
+  // false once the connection is gone.
+  bool loop() {
+    if (!connected()) return false;
+    if (!client.connected()) {
+      lost();
+      return false;
+    }
+    receive();
+    if (!connected()) return false;
+
+    unsigned long now = millis();
+    if (now - lastSent >= MQTT_SESSION_KEEPALIVE_S * 1000UL) {
+      if (pingOutstanding) {
+        // No answer to the last ping for a whole interval
+        lost();
+        return false;
+      }
+      uint8_t packet[2] = { MQTT_PINGREQ, 0 };
+      if (!send(packet, sizeof(packet))) return false;
+      pingOutstanding = true;
+    }
+    return true;
+  }
+
+  bool connected() { return sessionState == MQTT_SESSION_CONNECTED; }
+  int state() { return sessionState; }
+  uint8_t protocolLevel() { return protocol; }
+  uint8_t pending() { return inFlightCount; }
+  bool windowOpen() { return inFlightCount < effectiveWindow(); }
+
+  void printStats(Print& out) {
+    out.print("MQTT ");
+    out.print(protocol == MQTT_PROTOCOL_V5 ? "5" : "3.1.1");
+    out.print(": ");
+    out.print(published);
+    out.print(" published, ");
+    out.print(acknowledged);
+    out.print(" acknowledged, ");
+    out.print(rejected);
+    out.print(" rejected, ");
+    out.print(inFlightCount);
+    out.print(" in flight, ");
+    out.print(retransmitted);
+    out.print(" sent again, ");
+    out.print(expired);
+    out.print(" expired, ");
+    out.print(aliased);
+    out.print(" by topic alias, window full ");
+    out.print(windowFull);
+    out.print(" times, slowest PUBACK ");
+    out.print(maxAckMs);
+    out.println(" ms");
+  }
+};
+
+#endif // MQTT_SESSION_H
@@ -0,0 +1,477 @@
+#ifndef OFFLINE_SPOOL_H
+#define OFFLINE_SPOOL_H
+
+#define LFS_MBED_RP2040_VERSION_MIN_TARGET      "LittleFS_Mbed_RP2040 v1.1.0"
+#define LFS_MBED_RP2040_VERSION_MIN             1001000
+
+#define _LFS_LOGLEVEL_          1
+#define RP2040_FS_SIZE_KB       256
+
+#include <LittleFS_Mbed_RP2040.h>
+#include <Arduino.h>
+#include <mbed.h>
+#include <stdio.h>
+#include "payload.h"
+
+// Readings waiting to be published, oldest first. New readings go into a
+// RAM ring, which may be filled from another thread. When the ring runs
+// full, service() moves its oldest readings to a file on flash, so an outage
+// of hours loses nothing and the backlog survives a reset. Readings leave in
+// order: the file first, then the ring.
+//
+// peek() copies the oldest readings that aren't being published yet.
+// sent() marks them as published and delivered() drops them once the
+// broker has them, so a reset before the PUBACK publishes them again. Each
+// reading carries a sequence number for this, readings dropped while in
+// flight don't upset the count. Deliveries may come in any order, readings
+// only leave the front. How far the file was consumed is kept in a small
+// position file, and the spool file is removed once it is empty.
+//
+// Every spool file starts with a header carrying a generation number that
+// changes whenever the file is started or compacted, and the position names
+// the generation it belongs to. The position is replaced by a rename, so a
+// reset leaves either the old or the new one. A position that is missing or
+// belongs to another generation only means the file is published again from
+// its first reading. At QoS 1 the broker may see duplicates anyway, losing
+// the backlog would be worse.
+//
+// Readings keep millis() of the boot they were taken in, so the spool also
+// counts boots on flash. boot() is stamped into every reading.
+
+#define SPOOL_RAM_READINGS 256
+#define SPOOL_SPILL_AT 192                   // service() spills above this many in RAM
+#define SPOOL_SPILL_READINGS 64              // Readings written to flash at a time
+#define SPOOL_MAX_FILE_BYTES (128 * 1024)    // Oldest readings are dropped beyond this
+#define SPOOL_PEEK_READINGS 64               // Most readings one peek() returns
+#define SPOOL_MAX_SENT 16                    // Batches sent and not delivered, at least the MQTT window
+
+#define SPOOL_MAGIC 0x53504C32               // 'SPL2'
+
+struct SpooledReading {
+  SensorReading reading;
+  uint32_t sequence;         // Counts up across resets, from the newest on flash
+};
+
+// A batch handed to the broker, by the sequence of its newest reading
+struct SentBatch {
+  uint32_t last;
+  bool delivered;
+};
+
+struct SpoolFileHeader {
+  uint32_t magic;
+  uint32_t recordSize;       // sizeof(SpooledReading) when the file was written
+  uint32_t generation;
+};
+
+struct SpoolPosition {
+  uint32_t magic;
+  uint32_t generation;       // Spool file the offset is for
+  uint32_t readOffset;       // Bytes of the file already published, header included
+};
+
+class ReadingSpool {
+private:
+  LittleFS_MBED* myFS;
+  bool flashReady = false;
+  const char* spoolPath = MBED_LITTLEFS_FILE_PREFIX "/spool.bin";
+  const char* compactPath = MBED_LITTLEFS_FILE_PREFIX "/spool.tmp";
+  const char* positionPath = MBED_LITTLEFS_FILE_PREFIX "/spool.pos";
+  const char* newPositionPath = MBED_LITTLEFS_FILE_PREFIX "/spool.pnew";
+  const char* bootPath = MBED_LITTLEFS_FILE_PREFIX "/boot.cnt";
+  const char* newBootPath = MBED_LITTLEFS_FILE_PREFIX "/boot.new";
+  uint16_t bootNumber = 0;   // 0 without flash
+
+  // RAM ring, shared with the sampling thread
+  SpooledReading ring[SPOOL_RAM_READINGS];
+  uint16_t ringHead = 0;     // Next slot to fill
+  uint16_t ringTail = 0;     // Oldest reading
+  volatile uint16_t ringCount = 0;
+  uint32_t nextSequence = 0;
+
+  // Batches being published, oldest first. Readings up to sentThrough are
+  // skipped by peek() while any are outstanding.
+  SentBatch sentBatches[SPOOL_MAX_SENT];
+  uint8_t sentHead = 0;
+  uint8_t sentCount = 0;
+  uint32_t sentThrough = 0;
+  SpooledReading peeked[SPOOL_PEEK_READINGS];   // What the last peek() returned
+  uint16_t peekedCount = 0;
+
+  // Spool file, only touched from the main thread
+  uint32_t fileSize = 0;     // 0 while there is no file
+  uint32_t readOffset = 0;
+  uint32_t generation = 0;   // Of the current file, or the last one
+
+  // Statistics
+  volatile unsigned long readingsDropped = 0;
+  unsigned long readingsSpilled = 0;
+  unsigned long readingsConsumed = 0;
+
+  uint32_t fileReadings() {
+    return fileSize > readOffset ? (fileSize - readOffset) / sizeof(SpooledReading) : 0;
+  }
+
+  // Sequence numbers wrap, compare them by distance
+  static bool after(uint32_t sequence, uint32_t than) {
+    return (int32_t)(sequence - than) > 0;
+  }
+
+  // How many of the oldest readings have a sequence up to through. Readings
+  // are in sequence order, so this is a binary search.
+  uint32_t countThrough(uint32_t through) {
+    uint32_t onFlash = fileReadings();
+    FILE* file = onFlash > 0 ? fopen(spoolPath, "r") : NULL;
+    uint32_t low = 0;
+    uint32_t high = pending();
+    while (low < high) {
+      uint32_t middle = low + (high - low) / 2;
+      SpooledReading entry;
+      bool found;
+      if (middle < onFlash) {
+        found = file && fseek(file, readOffset + middle * sizeof(SpooledReading), SEEK_SET) == 0 &&
+                fread(&entry, sizeof(entry), 1, file) == 1;
+      } else {
+        found = peekRam(&entry, middle - onFlash, 1) == 1;
+      }
+      if (found && !after(entry.sequence, through)) low = middle + 1;
+      else high = middle;
+    }
+    if (file) fclose(file);
+    return low;
+  }
+
+  // Written aside and renamed over the old file, which LittleFS does
+  // atomically
+  bool replaceFile(const char* path, const char* newPath, const void* data, size_t size) {
+    FILE* file = fopen(newPath, "w");
+    if (!file) return false;
+    bool ok = fwrite(data, size, 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(newPath, path) == 0;
+  }
+
+  bool savePosition() {
+    SpoolPosition position = { SPOOL_MAGIC, generation, readOffset };
+    return replaceFile(positionPath, newPositionPath, &position, sizeof(position));
+  }
+
+  // Count this boot. Numbers start at 1 and skip 0 when they wrap.
+  void countBoot() {
+    uint16_t last = 0;
+    FILE* file = fopen(bootPath, "r");
+    if (file) {
+      fread(&last, sizeof(last), 1, file);
+      fclose(file);
+    }
+    bootNumber = last + 1;
+    if (bootNumber == 0) bootNumber = 1;
+    if (!replaceFile(bootPath, newBootPath, &bootNumber, sizeof(bootNumber))) {
+      Serial.println("Spool: could not save the boot number");
+    }
+  }
+
+  bool writeFileHeader(FILE* file, uint32_t fileGeneration) {
+    SpoolFileHeader header = { SPOOL_MAGIC, sizeof(SpooledReading), fileGeneration };
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+  }
+
+  // The spool file goes first, a position left behind matches no file
+  void removeFile() {
+    remove(spoolPath);
+    remove(positionPath);
+    fileSize = readOffset = 0;
+  }
+
+  // Rewrite the file without the readings already consumed
+  bool compact() {
+    FILE* from = fopen(spoolPath, "r");
+    FILE* to = fopen(compactPath, "w");
+    bool ok = from && to && writeFileHeader(to, generation + 1) &&
+              fseek(from, readOffset, SEEK_SET) == 0;
+    uint8_t chunk[256];
+    size_t read;
+    while (ok && (read = fread(chunk, 1, sizeof(chunk), from)) > 0) {
+      ok = fwrite(chunk, 1, read, to) == read;
+    }
+    if (from) fclose(from);
+    if (to && fclose(to) != 0) ok = false;
+
+    if (ok) {
+      // Until the new position is saved the old one names the old
+      // generation, so a reset in between replays the new file in full
+      uint32_t newSize = sizeof(SpoolFileHeader) + fileSize - readOffset;
+      ok = rename(compactPath, spoolPath) == 0;
+      if (ok) {
+        generation++;
+        fileSize = newSize;
+        readOffset = sizeof(SpoolFileHeader);
+        savePosition();
+      }
+    }
+    if (!ok) {
+      Serial.println("Spool: compaction failed");
+      remove(compactPath);
+    }
+    return ok;
+  }
+
+  // Append the oldest count readings of the ring to the file
+  bool spill(uint16_t count) {
+    SpooledReading chunk[SPOOL_SPILL_READINGS];
+    count = min(count, (uint16_t)SPOOL_SPILL_READINGS);
+    count = peekRam(chunk, 0, count);
+    if (count == 0) return true;
+
+    // Make room by dropping the oldest readings on flash
+    uint32_t bytes = count * sizeof(SpooledReading);
+    if (fileSize + bytes > SPOOL_MAX_FILE_BYTES) {
+      uint32_t drop = min(fileReadings(), (uint32_t)SPOOL_SPILL_READINGS);
+      readOffset += drop * sizeof(SpooledReading);
+      readingsDropped += drop;
+      if (!compact()) return false;
+    }
+
+    bool starting = fileSize == 0;
+    FILE* file = fopen(spoolPath, starting ? "w" : "a");
+    if (!file) return false;
+    bool ok = (!starting || writeFileHeader(file, generation + 1)) &&
+              fwrite(chunk, sizeof(SpooledReading), count, file) == count;
+    if (fclose(file) != 0 || !ok) {
+      // Don't trust a partial write, cut the file back on the next mount
+      Serial.println("Spool: write to flash failed");
+      return false;
+    }
+    if (starting) {
+      generation++;
+      fileSize = readOffset = sizeof(SpoolFileHeader);
+      savePosition();
+    }
+    fileSize += bytes;
+    dropRamThrough(chunk[count - 1].sequence);
+    readingsSpilled += count;
+    return true;
+  }
+
+  uint16_t peekRam(SpooledReading* out, uint32_t skip, uint16_t max) {
+    mbed::CriticalSectionLock lock;
+    uint16_t count = 0;
+    while (count < max && skip + count < ringCount) {
+      out[count] = ring[(ringTail + skip + count) % SPOOL_RAM_READINGS];
+      count++;
+    }
+    return count;
+  }
+
+  // Drop the readings in RAM up to sequence through. push() may have
+  // dropped some of them already since they were looked at, going by
+  // sequence instead of a count keeps the ones after them.
+  uint16_t dropRamThrough(uint32_t through) {
+    mbed::CriticalSectionLock lock;
+    uint16_t dropped = 0;
+    while (ringCount > 0 && !after(ring[ringTail].sequence, through)) {
+      ringTail = (ringTail + 1) % SPOOL_RAM_READINGS;
+      ringCount--;
+      dropped++;
+    }
+    return dropped;
+  }
+
+  // Drop the oldest readings up to sequence through
+  void consume(uint32_t through) {
+    uint32_t onFlash = min(countThrough(through), fileReadings());
+    if (onFlash > 0) {
+      readOffset += onFlash * sizeof(SpooledReading);
+      if (fileReadings() == 0) removeFile();
+      else savePosition();
+    }
+    readingsConsumed += onFlash + dropRamThrough(through);
+  }
+
+public:
+  ReadingSpool() {
+    myFS = new LittleFS_MBED();
+  }
+
+  ~ReadingSpool() {
+    delete myFS;
+  }
+
+  // Mount the filesystem and pick up a backlog left from before a reset.
+  // Without flash the spool still works from RAM.
+  bool begin() {
+    if (!myFS->init()) {
+      Serial.println("Spool: LittleFS mount failed, RAM only");
+      return false;
+    }
+    flashReady = true;
+    // Left over from a reset during a compaction or a file update
+    remove(compactPath);
+    remove(newPositionPath);
+    remove(newBootPath);
+    countBoot();
+
+    SpoolFileHeader header = {};
+    FILE* file = fopen(spoolPath, "r");
+    if (!file) {
+      remove(positionPath);
+      return true;
+    }
+    bool haveHeader = fread(&header, sizeof(header), 1, file) == 1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    if (!haveHeader || header.magic != SPOOL_MAGIC || header.recordSize != sizeof(SpooledReading)) {
+      Serial.println("Spool: spool file from another version, discarding it");
+      removeFile();
+      return true;
+    }
+
+    // A reading torn by a reset during a spill is left out
+    generation = header.generation;
+    fileSize = size - (size - sizeof(header)) % sizeof(SpooledReading);
+    readOffset = sizeof(header);
+
+    SpoolPosition position = {};
+    file = fopen(positionPath, "r");
+    if (file) {
+      fread(&position, sizeof(position), 1, file);
+      fclose(file);
+    }
+    if (position.magic == SPOOL_MAGIC && position.generation == generation &&
+        position.readOffset >= sizeof(header) && position.readOffset <= fileSize &&
+        (position.readOffset - sizeof(header)) % sizeof(SpooledReading) == 0) {
+      readOffset = position.readOffset;
+    } else {
+      Serial.println("Spool: no position for the spool file, publishing it from the start");
+    }
+
+    if (fileReadings() == 0) {
+      removeFile();
+    } else {
+      // New readings go on from the newest one on flash
+      SpooledReading newest;
+      file = fopen(spoolPath, "r");
+      if (file && fseek(file, fileSize - sizeof(newest), SEEK_SET) == 0 &&
+          fread(&newest, sizeof(newest), 1, file) == 1) {
+        nextSequence = newest.sequence + 1;
+      }
+      if (file) fclose(file);
+      Serial.print("Spool: ");
+      Serial.print(fileReadings());
+      Serial.println(" readings waiting on flash");
+    }
+    return true;
+  }
+
+  // Add a reading. Safe to call from another thread than the rest. With
+  // the ring full the oldest reading in RAM is dropped.
+  void push(const SensorReading& reading) {
+    mbed::CriticalSectionLock lock;
+    if (ringCount == SPOOL_RAM_READINGS) {
+      ringTail = (ringTail + 1) % SPOOL_RAM_READINGS;
+      ringCount--;
+      readingsDropped++;
+    }
+    ring[ringHead].reading = reading;
+    ring[ringHead].sequence = nextSequence++;
+    ringHead = (ringHead + 1) % SPOOL_RAM_READINGS;
+    ringCount++;
+  }
+
+  // Spill to flash while the ring is filling up. Call from loop().
+  void service() {
+    while (flashReady && ringCount > SPOOL_SPILL_AT) {
+      if (!spill(ringCount - SPOOL_SPILL_AT + SPOOL_SPILL_READINGS / 2)) break;
+    }
+  }
+
+  // Boot number for the readings of this boot, 0 if there is no flash
+  uint16_t boot() {
+    return bootNumber;
+  }
+
+  uint32_t pending() {
+    return fileReadings() + ringCount;
+  }
+
+  // Copy up to max of the oldest readings not sent yet into out, at most
+  // SPOOL_PEEK_READINGS. They stay queued.
+  uint16_t peek(SensorReading* out, uint16_t max) {
+    max = min(max, (uint16_t)SPOOL_PEEK_READINGS);
+    uint32_t skip = sentCount > 0 ? countThrough(sentThrough) : 0;
+    uint32_t onFlash = fileReadings();
+    peekedCount = 0;
+    if (skip < onFlash) {
+      FILE* file = fopen(spoolPath, "r");
+      if (file && fseek(file, readOffset + skip * sizeof(SpooledReading), SEEK_SET) == 0) {
+        peekedCount = fread(peeked, sizeof(SpooledReading), min((uint32_t)max, onFlash - skip), file);
+      }
+      if (file) fclose(file);
+      // Flash readings come first, don't mix in RAM ones until they are gone
+    } else {
+      peekedCount = peekRam(peeked, skip - onFlash, max);
+    }
+    for (uint16_t i = 0; i < peekedCount; i++) out[i] = peeked[i].reading;
+    return peekedCount;
+  }
+
+  // Tag for the first count readings of the last peek(), for sent() and
+  // delivered()
+  uint32_t batchTag(uint16_t count) {
+    return count > 0 && count <= peekedCount ? peeked[count - 1].sequence : sentThrough;
+  }
+
+  // The readings up to tag were handed to the broker. Returns false if
+  // SPOOL_MAX_SENT batches are outstanding already.
+  bool sent(uint32_t tag) {
+    if (sentCount == SPOOL_MAX_SENT) return false;
+    SentBatch& batch = sentBatches[(sentHead + sentCount) % SPOOL_MAX_SENT];
+    batch.last = tag;
+    batch.delivered = false;
+    sentCount++;
+    sentThrough = tag;
+    return true;
+  }
+
+  // The broker has the batch sent with tag, or it was given up. Readings
+  // leave once every batch before them is done too.
+  void delivered(uint32_t tag) {
+    for (uint8_t i = 0; i < sentCount; i++) {
+      SentBatch& batch = sentBatches[(sentHead + i) % SPOOL_MAX_SENT];
+      if (batch.last == tag) batch.delivered = true;
+    }
+    bool any = false;
+    uint32_t through = 0;
+    while (sentCount > 0 && sentBatches[sentHead].delivered) {
+      through = sentBatches[sentHead].last;
+      any = true;
+      sentHead = (sentHead + 1) % SPOOL_MAX_SENT;
+      sentCount--;
+    }
+    if (any) consume(through);
+  }
+
+  // Readings sent and waiting for delivery
+  uint32_t inFlight() {
+    return sentCount > 0 ? countThrough(sentThrough) : 0;
+  }
+
+  void printStats(Print& out) {
+    out.print("Spool: ");
+    out.print(ringCount);
+    out.print(" in RAM, ");
+    out.print(fileReadings());
+    out.print(" on flash, ");
+    out.print(inFlight());
+    out.print(" of them in flight, ");
+    out.print(readingsSpilled);
+    out.print(" spilled, ");
+    out.print(readingsConsumed);
+    out.print(" published, ");
+    out.print(readingsDropped);
+    out.println(" dropped");
+  }
+};
+
+#endif // OFFLINE_SPOOL_H
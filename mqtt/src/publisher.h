@@ -0,0 +1,103 @@
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <Arduino.h>
+#include "payload.h"
+#include "batch.h"
+#include "offline_spool.h"
+#include "mqtt_session.h"
+
+// Works the spool off through the session, one batch per publish. The
+// session sends a batch again after a reconnect, the spool keeps its
+// readings until the PUBACK in case of a reset. Readings past the message
+// expiry are dropped instead of published.
+//
+// src/main.cpp and tools/session_host publish through this.
+
+class ReadingPublisher {
+private:
+  MqttSession& session;
+  ReadingSpool& spool;
+  ReadingBatch& batch;
+  const char* topic;
+  uint8_t qos;
+  uint32_t publishedTag = 0;
+
+public:
+  // The topic must stay valid while publishes to it are in flight
+  ReadingPublisher(MqttSession& s, ReadingSpool& sp, ReadingBatch& b, const char* t, uint8_t q)
+    : session(s), spool(sp), batch(b), topic(t), qos(q) {}
+
+  // How long ago a reading was taken, in ms. For a reading from before the
+  // last reset only the time since this boot is known, which is less.
+  uint32_t readingAge(const SensorReading& reading) {
+    if (reading.boot != spool.boot()) return millis();
+    return millis() - reading.timestamp;
+  }
+
+  // Publish the oldest queued readings if they make a due batch, as many
+  // as fit one publish. Returns true if something was published or
+  // dropped.
+  bool publish() {
+    if (!session.windowOpen()) {
+      return false;
+    }
+
+    SensorReading queued[BATCH_CAPACITY];
+    uint16_t count = spool.peek(queued, batch.capacity());
+    uint16_t stale = 0;
+    while (stale < count && session.pastExpiry(readingAge(queued[stale]))) {
+      stale++;
+    }
+    if (stale > 0) {
+      // The broker would drop them anyway
+      uint32_t tag = spool.batchTag(stale);
+      spool.sent(tag);
+      spool.delivered(tag);
+      Serial.print("Dropped ");
+      Serial.print(stale);
+      Serial.println(" readings past the message expiry");
+      return true;
+    }
+    batch.clear();
+    batch.limitPayload(session.maxPayload(topic, qos));
+    for (uint16_t i = 0; i < count && batch.add(queued[i]); i++) {
+    }
+    if (!batch.due(millis())) {
+      return false;
+    }
+
+    uint8_t msgBuffer[MQTT_SESSION_MAX_PACKET];
+    uint8_t readings = batch.size();
+    size_t msgLength = batch.encode(msgBuffer, sizeof(msgBuffer));
+    uint32_t tag = spool.batchTag(readings);
+
+    if (msgLength == 0 || !session.publish(topic, msgBuffer, msgLength, qos, tag,
+                                           readingAge(queued[0]))) {
+      // The readings stay queued for the next attempt
+      Serial.print("Publish of ");
+      Serial.print(readings);
+      Serial.println(" readings failed");
+      return false;
+    }
+    spool.sent(tag);
+    if (qos == 0) {
+      // Nothing comes back for QoS 0
+      spool.delivered(tag);
+    }
+    batch.published();
+    publishedTag = tag;
+    return true;
+  }
+
+  // The broker has a batch, or it was refused or expired. Either way it is
+  // done with and leaves the spool. Call from the session's done callback.
+  void done(uint32_t tag, bool acknowledged) {
+    spool.delivered(tag);
+  }
+
+  // Tag of the last batch published, its readings are still in the batch
+  uint32_t lastTag() { return publishedTag; }
+};
+
+#endif // PUBLISHER_H
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Decoder for the sensor payloads published by the mqtt firmware.
+
+Payloads are either JSON or one of the binary layouts in src/payload.h,
+a single reading or a batch. The first byte tells them apart: JSON starts
+with '{', binary payloads with their version. Every reading is printed as
+one JSON object per line. Its timestamp counts from the boot given by
+'boot'.
+
+Reads hex encoded payloads, one per line, as mosquitto_sub prints them:
+
+    mosquitto_sub -h <broker> -t <topic> -F %x | python3 tools/decode_payload.py
+
+or takes them as arguments:
+
+    python3 tools/decode_payload.py 01050010270000f6098417
+"""
+import argparse
+import json
+import struct
+import sys
+
+PAYLOAD_VERSION = 1
+PAYLOAD_BATCH_VERSION = 2
+
+# version, boot, timestamp, temperature (0.01 degC), humidity (0.01 %RH)
+READING = struct.Struct('<BHIhH')
+# version, count, boot, timestamp of the first reading
+BATCH_HEADER = struct.Struct('<BBHI')
+# ms since the reading before, temperature, humidity
+BATCH_ENTRY = struct.Struct('<HhH')
+
+
+def reading(timestamp, temperature, humidity, boot):
+    return {
+        'temperature': temperature / 100,
+        'humidity': humidity / 100,
+        'timestamp': timestamp,
+        'boot': boot,
+    }
+
+
+def decode_payload(data):
+    """Return the readings in a payload as a list of dicts, or raise ValueError."""
+    if not data:
+        raise ValueError('empty payload')
+    if data[:1] == b'{':
+        doc = json.loads(data)
+        return doc['readings'] if 'readings' in doc else [doc]
+
+    if data[0] == PAYLOAD_VERSION:
+        if len(data) != READING.size:
+            raise ValueError(f'{len(data)} bytes, expected {READING.size}')
+        _, boot, timestamp, temperature, humidity = READING.unpack(data)
+        return [reading(timestamp, temperature, humidity, boot)]
+
+    if data[0] == PAYLOAD_BATCH_VERSION:
+        if len(data) < BATCH_HEADER.size:
+            raise ValueError('short batch header')
+        _, count, boot, timestamp = BATCH_HEADER.unpack_from(data)
+        if len(data) != BATCH_HEADER.size + count * BATCH_ENTRY.size:
+            raise ValueError(f'{len(data)} bytes for a batch of {count}')
+        readings = []
+        for gap, temperature, humidity in BATCH_ENTRY.iter_unpack(data[BATCH_HEADER.size:]):
+            timestamp = (timestamp + gap) & 0xFFFFFFFF
+            readings.append(reading(timestamp, temperature, humidity, boot))
+        return readings
+
+    raise ValueError(f'unknown payload version {data[0]}')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('payloads', nargs='*', help='hex encoded payloads, stdin if none')
+    args = parser.parse_args()
+
+    lines = args.payloads or sys.stdin
+    failed = False
+    for line in lines:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            for item in decode_payload(bytes.fromhex(line)):
+                print(json.dumps(item), flush=True)
+        except ValueError as e:
+            print(f'Warning: {line[:32]}: {e}', file=sys.stderr)
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,48 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// The parts of the Arduino core the mqtt code uses, for building the
+// session and the spool on the host. Time is the host's clock, Serial is
+// stdout.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using std::min;
+using std::max;
+
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
+
+inline unsigned long millis() {
+  using namespace std::chrono;
+  static const steady_clock::time_point started = steady_clock::now();
+  return (unsigned long)duration_cast<milliseconds>(steady_clock::now() - started).count();
+}
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+class Print {
+public:
+  size_t print(const char* text) { return fputs(text, stdout) < 0 ? 0 : strlen(text); }
+  size_t print(char c) { return putchar(c) == EOF ? 0 : 1; }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned int value) { return printf("%u", value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t print(double value) { return printf("%.2f", value); }
+
+  template <typename T>
+  size_t println(T value) { return print(value) + print('\n'); }
+  size_t println() { return print('\n'); }
+};
+
+inline Print Serial;
+
+#endif // ARDUINO_H
@@ -0,0 +1,68 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+// Arduino's Client over a POSIX socket, as much of it as MqttSession uses.
+// Hosts are IPv4 addresses.
+
+#include <cstdint>
+#include <cstddef>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class Client {
+private:
+  int fd = -1;
+
+public:
+  int connect(const char* host, uint16_t port) {
+    stop();
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &address.sin_addr) != 1) return 0;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+    if (::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+      stop();
+      return 0;
+    }
+    // The board's WiFi module doesn't hold back small writes either
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) {
+    if (fd < 0) return 0;
+    ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+    return sent < 0 ? 0 : sent;
+  }
+
+  int available() {
+    if (fd < 0) return 0;
+    pollfd wait = { fd, POLLIN, 0 };
+    return poll(&wait, 1, 0) > 0 && (wait.revents & POLLIN) ? 1 : 0;
+  }
+
+  int read() {
+    uint8_t byte;
+    return fd >= 0 && recv(fd, &byte, 1, 0) == 1 ? byte : -1;
+  }
+
+  uint8_t connected() {
+    if (fd < 0) return 0;
+    char byte;
+    return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0 ? 0 : 1;
+  }
+
+  void stop() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+};
+
+#endif // CLIENT_H
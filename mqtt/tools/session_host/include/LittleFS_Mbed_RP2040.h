@@ -0,0 +1,21 @@
+#ifndef LITTLEFS_MBED_RP2040_H
+#define LITTLEFS_MBED_RP2040_H
+
+// The spool's files go to a directory on the host instead of flash
+
+#include <sys/stat.h>
+
+#ifndef MBED_LITTLEFS_FILE_PREFIX
+#define MBED_LITTLEFS_FILE_PREFIX "session_host.fs"
+#endif
+
+class LittleFS_MBED {
+public:
+  bool init() {
+    mkdir(MBED_LITTLEFS_FILE_PREFIX, 0755);
+    struct stat info;
+    return stat(MBED_LITTLEFS_FILE_PREFIX, &info) == 0 && S_ISDIR(info.st_mode);
+  }
+};
+
+#endif // LITTLEFS_MBED_RP2040_H
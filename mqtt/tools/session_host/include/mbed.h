@@ -0,0 +1,17 @@
+#ifndef MBED_H
+#define MBED_H
+
+// The host harness pushes readings from its only thread, nothing to lock
+
+namespace mbed {
+
+class CriticalSectionLock {
+public:
+  // User-provided, so a lock held only for its scope isn't an unused variable
+  CriticalSectionLock() {}
+  ~CriticalSectionLock() {}
+};
+
+}
+
+#endif // MBED_H
@@ -0,0 +1,172 @@
+// Publish path on the host, against tools/stand_in_broker.py
+//
+// Queues readings in the spool the way an outage does, then works the
+// backlog off through the session with the batch and publisher of
+// src/main.cpp, and reports throughput and reconnects. Run the broker with
+// --ack-delay to stand in for a slow link and --drop-after to cut
+// connections.
+//
+// With resets, the session and the spool are thrown away that many times
+// while publishes are in flight and picked up again from flash, as after a
+// reset of the board. Every reading that reached flash must still get its
+// PUBACK in the end, only readings that were in RAM may be lost.
+//
+// Usage: session_host [readings] [window] [resets] [port] [protocol] [json]
+//
+// json publishes JSON payloads instead of binary ones. Built by the
+// session_host environment in platformio.ini, or directly with
+//   g++ -std=gnu++17 -O2 -Itools/session_host/include -I<ArduinoJson>/src tools/session_host/main.cpp -o session_host
+// from mqtt, e.g.
+//   python3 tools/stand_in_broker.py --port 18830 --ack-delay 50 --drop-after 40 &
+//   ./session_host 5000 8 2 18830
+
+#include <Arduino.h>
+#include <Client.h>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include "../../src/payload.h"
+#include "../../src/batch.h"
+#include "../../src/offline_spool.h"
+#include "../../src/mqtt_session.h"
+#include "../../src/publisher.h"
+
+#define HOST_BATCH_READINGS 32
+#define HOST_BATCH_LATENCY_MS 1000
+#define HOST_TIMEOUT_MS 120000
+#define HOST_TOPIC "sensors/session_host/readings"
+
+// Readings are numbered by their timestamp, a batch by the sequence of its
+// last reading
+struct HostBatch {
+  uint32_t first;
+  uint8_t count;
+};
+
+ReadingSpool* spool;
+ReadingPublisher* publisher;
+std::map<uint32_t, HostBatch> batches;
+std::vector<bool> acknowledged;
+unsigned long acknowledgedCount = 0;
+
+void publishDone(uint32_t tag, bool accepted) {
+  std::map<uint32_t, HostBatch>::iterator found = batches.find(tag);
+  if (accepted && found != batches.end()) {
+    for (uint32_t i = found->second.first; i < found->second.first + found->second.count; i++) {
+      if (!acknowledged[i]) acknowledgedCount++;
+      acknowledged[i] = true;
+    }
+  }
+  publisher->done(tag, accepted);
+}
+
+int main(int argc, char** argv) {
+  uint32_t total = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+  uint8_t window = argc > 2 ? atoi(argv[2]) : 8;
+  int resets = argc > 3 ? atoi(argv[3]) : 0;
+  uint16_t port = argc > 4 ? atoi(argv[4]) : 1883;
+  uint8_t protocol = argc > 5 ? atoi(argv[5]) : MQTT_PROTOCOL_V5;
+  bool binary = !(argc > 6 && strcmp(argv[6], "json") == 0);
+
+  std::filesystem::remove_all(MBED_LITTLEFS_FILE_PREFIX);
+  acknowledged.assign(total, false);
+
+  // The outage: every reading is queued before the first publish. Reading
+  // i counts as taken at i ms, publishing starts once all of them are in
+  // the past.
+  spool = new ReadingSpool();
+  spool->begin();
+  for (uint32_t i = 0; i < total; i++) {
+    SensorReading reading = { 20.0f + (i % 1000) * 0.01f, 50.0f, i, spool->boot() };
+    spool->push(reading);
+    spool->service();
+  }
+  spool->printStats(Serial);
+  while (millis() < total) delay(1);
+
+  ReadingBatch batch;
+  batch.configure(HOST_BATCH_READINGS, HOST_BATCH_LATENCY_MS, binary);
+
+  Client client;
+  MqttSession* session = NULL;
+  unsigned long resetEvery = total / HOST_BATCH_READINGS / (resets + 1) + 1;
+  unsigned long publishes = 0;
+  unsigned long connects = 0;
+  int resetsDone = 0;
+  unsigned long started = millis();
+
+  while (spool->pending() > 0 && millis() - started < HOST_TIMEOUT_MS) {
+    if (!session) {
+      session = new MqttSession(client);
+      session->setServer("127.0.0.1", port);
+      session->setWindow(window);
+      session->setProtocol(protocol);
+      session->setMessageExpiry(3600);
+      session->onDone(publishDone);
+      publisher = new ReadingPublisher(*session, *spool, batch, HOST_TOPIC, 1);
+    }
+    if (!session->loop()) {
+      if (session->connect("session_host")) {
+        connects++;
+      } else {
+        Serial.print("Connect failed, state ");
+        Serial.println(session->state());
+        delay(100);
+      }
+      continue;
+    }
+
+    uint32_t lastTag = publisher->lastTag();
+    if (!publisher->publish()) {
+      delay(1);
+      continue;
+    }
+    if (publisher->lastTag() == lastTag) continue;  // Dropped past the expiry
+    batches[publisher->lastTag()] = { batch.reading(0).timestamp, batch.size() };
+    publishes++;
+
+    if (resetsDone < resets && publishes % resetEvery == 0 && session->pending() > 0) {
+      // Whatever is in flight and in RAM goes, the spool file stays
+      Serial.print("Reset with ");
+      Serial.print((unsigned int)session->pending());
+      Serial.println(" publishes in flight");
+      client.stop();
+      delete session;
+      session = NULL;
+      delete publisher;
+      publisher = NULL;
+      delete spool;
+      spool = new ReadingSpool();
+      spool->begin();
+      resetsDone++;
+    }
+  }
+  unsigned long elapsed = millis() - started;
+  if (session) {
+    // Collect the last PUBACKs
+    while (session->pending() > 0 && session->loop() && millis() - started < HOST_TIMEOUT_MS) delay(1);
+    session->disconnect();
+    session->printStats(Serial);
+  }
+  spool->printStats(Serial);
+
+  // Readings not acknowledged must be the newest ones, lost from RAM
+  uint32_t missing = total - acknowledgedCount;
+  uint32_t firstMissing = total;
+  for (uint32_t i = 0; i < total; i++) {
+    if (!acknowledged[i]) {
+      firstMissing = i;
+      break;
+    }
+  }
+  bool passed = spool->pending() == 0 && session && session->pending() == 0 &&
+                (resets > 0 ? missing <= SPOOL_RAM_READINGS && firstMissing + missing == total : missing == 0);
+
+  printf("{\"readings\":%lu,\"window\":%u,\"ms\":%lu,\"readings_per_s\":%.0f,"
+         "\"publishes\":%lu,\"connects\":%lu,\"resets\":%d,\"acknowledged\":%lu,"
+         "\"lost_from_ram\":%lu,\"passed\":%s}\n",
+         (unsigned long)total, window, elapsed, elapsed ? total * 1000.0 / elapsed : 0.0,
+         publishes, connects, resetsDone, acknowledgedCount, (unsigned long)missing,
+         passed ? "true" : "false");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,343 @@
+#!/usr/bin/env python3
+"""Stand-in MQTT broker for testing the publisher against.
+
+Speaks just enough MQTT 3.1.1 and 5 for src/mqtt_session.h: CONNECT,
+PUBLISH at QoS 0 and 1, PINGREQ and DISCONNECT. Nothing is forwarded
+anywhere, every payload is decoded with decode_payload.py and printed
+instead.
+
+MQTT 5 clients are offered topic aliases and, if given, a Receive Maximum
+in the CONNACK. The bytes spent on topic names are counted against what
+the full topics would have taken. --max-protocol 4 refuses MQTT 5 the way
+a 3.1.1 broker does.
+
+PUBACKs can be held back to stand in for a slow link, which shows what the
+in-flight window buys, and connections can be cut after some publishes to
+exercise the resend after a reconnect. Publishes sent again with DUP set
+that were already received are counted as duplicates and not printed twice.
+
+    python3 tools/stand_in_broker.py --port 1883 --ack-delay 200 --drop-after 50
+    python3 tools/stand_in_broker.py --topic-alias-max 4 --receive-max 4
+
+tools/session_host runs the spool and the session on the host against it.
+"""
+import argparse
+import json
+import queue
+import socketserver
+import struct
+import threading
+import time
+
+from decode_payload import decode_payload
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+PUBLISH_DUP = 0x08
+
+PROTOCOL_V311 = 4
+PROTOCOL_V5 = 5
+REFUSED_PROTOCOL = 0x01
+TOPIC_ALIAS_INVALID = 0x94
+
+MESSAGE_EXPIRY = 0x02
+RECEIVE_MAXIMUM = 0x21
+TOPIC_ALIAS_MAXIMUM = 0x22
+TOPIC_ALIAS = 0x23
+# Fixed size MQTT 5 properties by identifier, the rest are strings,
+# binary data, a variable byte integer or a string pair
+PROPERTY_SIZES = {
+    0x01: 1, 0x17: 1, 0x19: 1, 0x24: 1, 0x25: 1, 0x28: 1, 0x29: 1, 0x2A: 1,
+    0x13: 2, 0x21: 2, 0x22: 2, 0x23: 2,
+    0x02: 4, 0x11: 4, 0x18: 4, 0x27: 4,
+}
+SUBSCRIPTION_ID = 0x0B
+USER_PROPERTY = 0x26
+
+lock = threading.Lock()
+sessions = {}  # client id -> {packet id: payload} of QoS 1 publishes received
+
+
+def read_exactly(sock, size):
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError('closed')
+        data += chunk
+    return data
+
+
+def read_varint(read_byte):
+    value = 0
+    for shift in range(0, 28, 7):
+        byte = read_byte()
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value
+    raise ValueError('bad variable byte integer')
+
+
+def read_packet(sock):
+    """Return (first byte, body) of the next packet."""
+    header = read_exactly(sock, 1)[0]
+    length = read_varint(lambda: read_exactly(sock, 1)[0])
+    return header, read_exactly(sock, length)
+
+
+def varint(value):
+    data = bytearray()
+    while True:
+        byte, value = value % 128, value // 128
+        data.append(byte | (0x80 if value else 0))
+        if not value:
+            return bytes(data)
+
+
+def packet(first, body=b''):
+    return bytes([first]) + varint(len(body)) + body
+
+
+def read_properties(data, offset):
+    """Return ({identifier: value}, offset after them). Only fixed size
+    values are decoded, the others are skipped."""
+    position = [offset]
+
+    def read_byte():
+        if position[0] >= len(data):
+            raise ValueError('truncated properties')
+        position[0] += 1
+        return data[position[0] - 1]
+
+    length = read_varint(read_byte)
+    offset = position[0]
+    end = offset + length
+    values = {}
+    while offset < end:
+        identifier = data[offset]
+        offset += 1
+        size = PROPERTY_SIZES.get(identifier)
+        if size:
+            values[identifier] = int.from_bytes(data[offset:offset + size], 'big')
+            offset += size
+        elif identifier == SUBSCRIPTION_ID:
+            position[0] = offset
+            read_varint(read_byte)
+            offset = position[0]
+        else:
+            for _ in range(2 if identifier == USER_PROPERTY else 1):
+                length, = struct.unpack_from('>H', data, offset)
+                offset += 2 + length
+    if offset != end:
+        raise ValueError('malformed properties')
+    return values, end
+
+
+def properties(values):
+    """Encode {identifier: value} of fixed size properties."""
+    body = b''.join(bytes([identifier]) + value.to_bytes(PROPERTY_SIZES[identifier], 'big')
+                    for identifier, value in values.items())
+    return varint(len(body)) + body
+
+
+def read_string(data, offset):
+    length, = struct.unpack_from('>H', data, offset)
+    return data[offset + 2:offset + 2 + length].decode(), offset + 2 + length
+
+
+class ProtocolError(Exception):
+    def __init__(self, reason, message):
+        super().__init__(message)
+        self.reason = reason
+
+
+class BrokerHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        self.acks = queue.Queue()
+        self.closed = threading.Event()
+        threading.Thread(target=self.send_acks, daemon=True).start()
+        self.client_id = None
+        self.level = PROTOCOL_V311
+        self.aliases = {}  # topic alias -> topic, for this connection only
+        self.unacked = 0
+        self.received = 0
+        self.duplicates = 0
+        self.readings = 0
+        self.topic_bytes = 0
+        self.full_topic_bytes = 0
+        self.expiry = None
+        self.started = time.monotonic()
+        try:
+            while True:
+                header, body = read_packet(self.request)
+                kind = header >> 4
+                if kind == CONNECT:
+                    if not self.connect(body):
+                        break
+                elif kind == PUBLISH:
+                    self.publish(header, body)
+                    if self.server.drop_after and self.received % self.server.drop_after == 0:
+                        print(f'{self.client_id}: dropping the connection')
+                        break
+                elif kind == PINGREQ:
+                    self.request.sendall(packet(PINGRESP << 4))
+                elif kind == DISCONNECT:
+                    break
+        except ProtocolError as e:
+            print(f'Warning: {self.client_id}: {e}')
+            if self.level == PROTOCOL_V5:
+                self.request.sendall(packet(DISCONNECT << 4, bytes([e.reason, 0])))
+        except (ConnectionError, ValueError, OSError) as e:
+            if not isinstance(e, ConnectionError):
+                print(f'Warning: {self.client_id}: {e}')
+        finally:
+            # PUBACKs still held back are lost with the connection
+            self.closed.set()
+            self.report()
+
+    def connect(self, body):
+        protocol, offset = read_string(body, 0)
+        level, flags, keepalive = struct.unpack_from('>BBH', body, offset)
+        offset += 4
+        if level > self.server.max_protocol:
+            print(f'Refusing {protocol} level {level}')
+            self.request.sendall(packet(CONNACK << 4, bytes([0, REFUSED_PROTOCOL])))
+            return False
+        self.level = level
+        if level == PROTOCOL_V5:
+            _, offset = read_properties(body, offset)
+        self.client_id, _ = read_string(body, offset)
+        clean = bool(flags & 0x02)
+        with lock:
+            present = self.client_id in sessions and not clean
+            if not present:
+                sessions[self.client_id] = {}
+        print(f'{self.client_id}: connected, {protocol} level {level}, keepalive {keepalive} s, '
+              f'session {"resumed" if present else "new"}')
+
+        connack = bytes([1 if present else 0, 0])
+        if level == PROTOCOL_V5:
+            offered = {TOPIC_ALIAS_MAXIMUM: self.server.topic_alias_max}
+            if self.server.receive_max:
+                offered[RECEIVE_MAXIMUM] = self.server.receive_max
+            connack += properties(offered)
+        self.request.sendall(packet(CONNACK << 4, connack))
+        return True
+
+    def publish(self, header, body):
+        qos = (header >> 1) & 0x03
+        topic, offset = read_string(body, 0)
+        packet_id = None
+        if qos > 0:
+            packet_id, = struct.unpack_from('>H', body, offset)
+            offset += 2
+        self.topic_bytes += 2 + len(topic.encode())
+
+        if self.level == PROTOCOL_V5:
+            values, offset = read_properties(body, offset)
+            alias = values.get(TOPIC_ALIAS)
+            if alias is not None:
+                if not 0 < alias <= self.server.topic_alias_max:
+                    raise ProtocolError(TOPIC_ALIAS_INVALID, f'topic alias {alias} out of range')
+                if topic:
+                    self.aliases[alias] = topic
+                elif alias in self.aliases:
+                    topic = self.aliases[alias]
+                else:
+                    raise ProtocolError(TOPIC_ALIAS_INVALID, f'unknown topic alias {alias}')
+            if MESSAGE_EXPIRY in values:
+                self.expiry = values[MESSAGE_EXPIRY]
+        self.full_topic_bytes += 2 + len(topic.encode())
+        payload = body[offset:]
+        self.received += 1
+
+        duplicate = False
+        if packet_id is not None:
+            with lock:
+                seen = sessions[self.client_id]
+                duplicate = bool(header & PUBLISH_DUP) and seen.get(packet_id) == payload
+                seen[packet_id] = payload
+            with lock:
+                self.unacked += 1
+                if self.server.receive_max and self.unacked > self.server.receive_max:
+                    print(f'Warning: {self.client_id}: {self.unacked} publishes unacknowledged, '
+                          f'Receive Maximum is {self.server.receive_max}')
+            self.acks.put((time.monotonic() + self.server.ack_delay, packet_id))
+
+        if duplicate:
+            self.duplicates += 1
+            return
+        try:
+            readings = decode_payload(payload)
+        except ValueError as e:
+            print(f'Warning: {topic}: {e}')
+            return
+        self.readings += len(readings)
+        if self.server.verbose:
+            for item in readings:
+                print(json.dumps(item))
+
+    def send_acks(self):
+        while not self.closed.is_set():
+            try:
+                due, packet_id = self.acks.get(timeout=0.1)
+            except queue.Empty:
+                continue
+            wait = due - time.monotonic()
+            if wait > 0 and self.closed.wait(wait):
+                return
+            with lock:
+                self.unacked -= 1
+            try:
+                self.request.sendall(packet(PUBACK << 4, struct.pack('>H', packet_id)))
+            except OSError:
+                return
+
+    def report(self):
+        if self.client_id is None:
+            return
+        took = max(time.monotonic() - self.started, 1e-3)
+        print(f'{self.client_id}: {self.received} publishes ({self.received / took:.1f}/s), '
+              f'{self.readings} readings, {self.duplicates} duplicate')
+        if self.received:
+            expiry = f', message expiry {self.expiry} s' if self.expiry is not None else ''
+            print(f'{self.client_id}: {self.topic_bytes} bytes of topic names for '
+                  f'{self.full_topic_bytes} in full{expiry}')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stand-in MQTT broker for the publisher')
+    parser.add_argument('--port', type=int, default=1883)
+    parser.add_argument('--ack-delay', type=int, default=0, help='ms to hold back each PUBACK')
+    parser.add_argument('--drop-after', type=int, default=0,
+                        help='cut the connection after this many publishes')
+    parser.add_argument('--max-protocol', type=int, choices=[PROTOCOL_V311, PROTOCOL_V5],
+                        default=PROTOCOL_V5, help='highest protocol level accepted')
+    parser.add_argument('--topic-alias-max', type=int, default=10,
+                        help='topic aliases offered to MQTT 5 clients, 0 for none')
+    parser.add_argument('--receive-max', type=int, default=0,
+                        help='Receive Maximum for MQTT 5 clients, 0 to leave it out')
+    parser.add_argument('--verbose', action='store_true', help='print every reading')
+    args = parser.parse_args()
+
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    server = socketserver.ThreadingTCPServer(('', args.port), BrokerHandler)
+    server.daemon_threads = True
+    server.ack_delay = args.ack_delay / 1000
+    server.drop_after = args.drop_after
+    server.max_protocol = args.max_protocol
+    server.topic_alias_max = args.topic_alias_max
+    server.receive_max = args.receive_max
+    server.verbose = args.verbose
+    print(f'Stand-in broker on port {args.port}, PUBACKs held {args.ack_delay} ms')
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,216 @@
+#ifndef FLASH_EMU_H
+#define FLASH_EMU_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Host emulation of the RP2040 QSPI flash, for running the storage code on
+// Linux. The whole flash is an array that the XIP window points at, and
+// flash_range_erase() / flash_range_program() work on it the way the boot
+// ROM does on the chip:
+//
+//   - erase and program must be sector and page aligned, as the SDK asserts
+//   - program can only clear bits. A byte that is not 0xFF and has a 1
+//     where the flash holds a 0 needs an erase first. That is counted and,
+//     while strict is set, stops the program. 0xFF bytes are taken as
+//     padding and leave the flash as it is, like on the chip
+//   - every operation charges a latency drawn from the timing model to a
+//     virtual clock, which micros() and millis() return
+//   - a power loss can be set to hit after a number of operations. That
+//     operation is left half done, with random bits in the range, and
+//     EmuPowerLoss is thrown for the test to catch and "reboot"
+//
+// Reads through the XIP window are plain memory reads and cost no virtual
+// time, and neither does code running on the host. The clock only moves for
+// flash operations and delay().
+
+#define FLASH_EMU_SIZE (16u * 1024 * 1024)   // Flash of the Nano RP2040 Connect
+#define FLASH_EMU_SECTOR_SIZE 4096u
+#define FLASH_EMU_PAGE_SIZE 256u
+#define FLASH_EMU_BLOCK_SIZE 65536u
+
+// Latencies in microseconds, typical and maximum. Defaults are the usual
+// datasheet figures for 128 Mbit QSPI NOR parts.
+struct FlashTiming {
+  uint32_t sectorEraseUs = 45000;
+  uint32_t sectorEraseMaxUs = 400000;
+  uint32_t blockEraseUs = 150000;    // 64 KB, used for aligned ranges as the SDK does
+  uint32_t blockEraseMaxUs = 2000000;
+  uint32_t pageProgramUs = 700;
+  uint32_t pageProgramMaxUs = 3000;
+  uint32_t slowPerMillion = 1000;    // Operations that take up to the maximum
+};
+
+struct FlashEmuStats {
+  unsigned long long sectorErases;
+  unsigned long long blockErases;
+  unsigned long long pagePrograms;
+  unsigned long long busyUs;         // Virtual time spent in flash operations
+  unsigned long missingErases;       // Programs that needed a 0 turned back to 1
+  uint32_t firstMissingErase;        // Offset of the first one
+  unsigned long powerLosses;
+};
+
+struct EmuPowerLoss {
+  uint32_t offset;                   // Operation that was cut short
+  bool erase;
+};
+
+inline uint8_t emuFlashMemory[FLASH_EMU_SIZE];
+inline unsigned long long emuClockUs = 0;
+
+class FlashEmu {
+private:
+  uint32_t sectorErases[FLASH_EMU_SIZE / FLASH_EMU_SECTOR_SIZE];
+  long long lossCountdown = -1;      // Operations until the power loss, -1 for none
+  uint32_t seed = 1;
+
+  uint32_t nextRandom() {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+  }
+
+  // Mostly close to typical, now and then anywhere up to the maximum
+  uint32_t latency(uint32_t typical, uint32_t maximum) {
+    if (nextRandom() % 1000000 < timing.slowPerMillion) {
+      return typical + nextRandom() % (maximum - typical + 1);
+    }
+    return typical + nextRandom() % ((maximum - typical) / 16 + 1);
+  }
+
+  void charge(uint32_t us) {
+    emuClockUs += us;
+    stats.busyUs += us;
+  }
+
+  void check(bool ok, const char* what, uint32_t offset, size_t size) {
+    if (ok) return;
+    fprintf(stderr, "FLASH EMU: %s at 0x%X, %zu bytes\n", what, offset, size);
+    abort();
+  }
+
+  // True if this operation is the one the power loss hits
+  bool losingPower() {
+    if (lossCountdown < 0) return false;
+    if (lossCountdown-- > 0) return false;
+    stats.powerLosses++;
+    return true;
+  }
+
+public:
+  FlashTiming timing;
+  FlashEmuStats stats = {};
+  bool strict = true;                // Stop on a program that needs an erase
+
+  FlashEmu() {
+    reset();
+  }
+
+  // Erased flash, no wear, clock and statistics at zero
+  void reset(uint32_t randomSeed = 1) {
+    memset(emuFlashMemory, 0xFF, sizeof(emuFlashMemory));
+    memset(sectorErases, 0, sizeof(sectorErases));
+    stats = {};
+    emuClockUs = 0;
+    lossCountdown = -1;
+    seed = randomSeed;
+  }
+
+  // Lose power in the middle of the operation that follows the next
+  // operations ones. Multi-sector erases and programs count per sector or
+  // page.
+  void powerLossAfter(long long operations) {
+    lossCountdown = operations;
+  }
+
+  void cancelPowerLoss() {
+    lossCountdown = -1;
+  }
+
+  uint32_t eraseCount(uint32_t offset) {
+    return sectorErases[offset / FLASH_EMU_SECTOR_SIZE];
+  }
+
+  void erase(uint32_t offset, size_t size) {
+    check(offset % FLASH_EMU_SECTOR_SIZE == 0 && size % FLASH_EMU_SECTOR_SIZE == 0,
+          "erase not sector aligned", offset, size);
+    check(offset + size <= FLASH_EMU_SIZE, "erase past the end", offset, size);
+
+    // Aligned 64 KB blocks take the block erase command, the rest sectors
+    for (uint32_t at = offset; at < offset + size;) {
+      bool block = at % FLASH_EMU_BLOCK_SIZE == 0 && offset + size - at >= FLASH_EMU_BLOCK_SIZE;
+      uint32_t length = block ? FLASH_EMU_BLOCK_SIZE : FLASH_EMU_SECTOR_SIZE;
+
+      if (losingPower()) {
+        // Some bits made it back to 1, others didn't
+        for (uint32_t i = 0; i < length; i++) emuFlashMemory[at + i] |= nextRandom();
+        charge(nextRandom() % (block ? timing.blockEraseUs : timing.sectorEraseUs));
+        throw EmuPowerLoss{at, true};
+      }
+
+      memset(emuFlashMemory + at, 0xFF, length);
+      for (uint32_t sector = at; sector < at + length; sector += FLASH_EMU_SECTOR_SIZE) {
+        sectorErases[sector / FLASH_EMU_SECTOR_SIZE]++;
+      }
+      if (block) {
+        stats.blockErases++;
+        charge(latency(timing.blockEraseUs, timing.blockEraseMaxUs));
+      } else {
+        stats.sectorErases++;
+        charge(latency(timing.sectorEraseUs, timing.sectorEraseMaxUs));
+      }
+      at += length;
+    }
+  }
+
+  void program(uint32_t offset, const uint8_t* data, size_t size) {
+    check(offset % FLASH_EMU_PAGE_SIZE == 0 && size % FLASH_EMU_PAGE_SIZE == 0,
+          "program not page aligned", offset, size);
+    check(offset + size <= FLASH_EMU_SIZE, "program past the end", offset, size);
+
+    for (uint32_t page = 0; page < size; page += FLASH_EMU_PAGE_SIZE) {
+      uint8_t* flash = emuFlashMemory + offset + page;
+      const uint8_t* bytes = data + page;
+
+      for (uint32_t i = 0; i < FLASH_EMU_PAGE_SIZE; i++) {
+        if (bytes[i] != 0xFF && (bytes[i] & ~flash[i])) {
+          if (stats.missingErases++ == 0) stats.firstMissingErase = offset + page + i;
+          check(!strict, "program over bits that need an erase", offset + page + i, 1);
+          break;
+        }
+      }
+
+      if (losingPower()) {
+        // Only some of the bits were cleared
+        for (uint32_t i = 0; i < FLASH_EMU_PAGE_SIZE; i++) flash[i] &= bytes[i] | nextRandom();
+        charge(nextRandom() % timing.pageProgramUs);
+        throw EmuPowerLoss{offset + page, false};
+      }
+
+      for (uint32_t i = 0; i < FLASH_EMU_PAGE_SIZE; i++) flash[i] &= bytes[i];
+      stats.pagePrograms++;
+      charge(latency(timing.pageProgramUs, timing.pageProgramMaxUs));
+    }
+  }
+
+  // Erase counts over the sectors of a range
+  void wear(uint32_t offset, uint32_t sectors, uint32_t* minErases, uint32_t* maxErases,
+            double* meanErases) {
+    unsigned long long total = 0;
+    *minErases = UINT32_MAX;
+    *maxErases = 0;
+    for (uint32_t i = 0; i < sectors; i++) {
+      uint32_t count = eraseCount(offset + i * FLASH_EMU_SECTOR_SIZE);
+      total += count;
+      if (count < *minErases) *minErases = count;
+      if (count > *maxErases) *maxErases = count;
+    }
+    *meanErases = sectors ? (double)total / sectors : 0;
+  }
+};
+
+inline FlashEmu flashEmu;
+
+#endif // FLASH_EMU_H
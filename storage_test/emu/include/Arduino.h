@@ -0,0 +1,84 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// The parts of the arduino-pico core the storage code uses, for building it
+// on the host against the flash emulator. Time is the emulator's virtual
+// clock, Serial is stdout.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include "flash_emu.h"
+
+using std::min;
+using std::max;
+
+#define XIP_BASE ((uintptr_t)emuFlashMemory)
+#define XIP_NOCACHE_NOALLOC_BASE XIP_BASE
+
+#define LED_BUILTIN 25
+#define OUTPUT 1
+#define HIGH 1
+#define LOW 0
+
+inline void pinMode(int, int) {
+}
+
+inline void digitalWrite(int, int) {
+}
+
+inline int digitalRead(int) {
+  return LOW;
+}
+
+inline unsigned long micros() {
+  return (unsigned long)emuClockUs;
+}
+
+inline unsigned long millis() {
+  return (unsigned long)(emuClockUs / 1000);
+}
+
+inline void delay(unsigned long ms) {
+  emuClockUs += (unsigned long long)ms * 1000;
+}
+
+class Print {
+public:
+  size_t printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vprintf(format, args);
+    va_end(args);
+    return length;
+  }
+
+  size_t print(const char* text) { return fputs(text, stdout) < 0 ? 0 : strlen(text); }
+  size_t print(char c) { return putchar(c) == EOF ? 0 : 1; }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t println(const char* text = "") { return print(text) + print('\n'); }
+};
+
+class HostSerial : public Print {
+public:
+  void begin(unsigned long) {}
+  int available() { return 0; }
+  int read() { return -1; }
+  operator bool() { return true; }
+};
+
+inline HostSerial Serial;
+
+// One core only, there is nothing to park
+class RP2040 {
+public:
+  void idleOtherCore() {}
+  void resumeOtherCore() {}
+};
+
+inline RP2040 rp2040;
+
+#endif // ARDUINO_H
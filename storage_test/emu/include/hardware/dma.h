@@ -0,0 +1,65 @@
+#ifndef HARDWARE_DMA_H
+#define HARDWARE_DMA_H
+
+#include <cstdint>
+#include <cstddef>
+
+// No DMA on the host. No channel can be claimed, so crc32Begin() falls back
+// to the tables and the functions below are never reached.
+
+#define DMA_SIZE_8 0
+#define DMA_SNIFF_CTRL_CALC_VALUE_CRC32R 1
+
+struct dma_channel_config {
+  uint32_t ctrl;
+};
+
+inline int dma_claim_unused_channel(bool) {
+  return -1;
+}
+
+inline void dma_channel_unclaim(int) {
+}
+
+inline dma_channel_config dma_channel_get_default_config(int) {
+  return {0};
+}
+
+inline void channel_config_set_transfer_data_size(dma_channel_config*, int) {
+}
+
+inline void channel_config_set_read_increment(dma_channel_config*, bool) {
+}
+
+inline void channel_config_set_write_increment(dma_channel_config*, bool) {
+}
+
+inline void channel_config_set_sniff_enable(dma_channel_config*, bool) {
+}
+
+inline void dma_sniffer_enable(int, int, bool) {
+}
+
+inline void dma_sniffer_disable() {
+}
+
+inline void dma_sniffer_set_output_reverse_enabled(bool) {
+}
+
+inline void dma_sniffer_set_output_invert_enabled(bool) {
+}
+
+inline void dma_sniffer_set_data_accumulator(uint32_t) {
+}
+
+inline uint32_t dma_sniffer_get_data_accumulator() {
+  return 0;
+}
+
+inline void dma_channel_configure(int, const dma_channel_config*, void*, const void*, size_t, bool) {
+}
+
+inline void dma_channel_wait_for_finish_blocking(int) {
+}
+
+#endif // HARDWARE_DMA_H
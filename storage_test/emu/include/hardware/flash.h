@@ -0,0 +1,20 @@
+#ifndef HARDWARE_FLASH_H
+#define HARDWARE_FLASH_H
+
+// pico-sdk flash API on top of the emulated flash
+
+#include "flash_emu.h"
+
+#define FLASH_PAGE_SIZE FLASH_EMU_PAGE_SIZE
+#define FLASH_SECTOR_SIZE FLASH_EMU_SECTOR_SIZE
+#define FLASH_BLOCK_SIZE FLASH_EMU_BLOCK_SIZE
+
+inline void flash_range_erase(uint32_t offset, size_t size) {
+  flashEmu.erase(offset, size);
+}
+
+inline void flash_range_program(uint32_t offset, const uint8_t* data, size_t size) {
+  flashEmu.program(offset, data, size);
+}
+
+#endif // HARDWARE_FLASH_H
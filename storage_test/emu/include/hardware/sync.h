@@ -0,0 +1,15 @@
+#ifndef HARDWARE_SYNC_H
+#define HARDWARE_SYNC_H
+
+#include <cstdint>
+
+// There is only one core and no interrupts on the host
+
+inline uint32_t save_and_disable_interrupts() {
+  return 0;
+}
+
+inline void restore_interrupts(uint32_t) {
+}
+
+#endif // HARDWARE_SYNC_H
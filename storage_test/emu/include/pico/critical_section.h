@@ -0,0 +1,19 @@
+#ifndef PICO_CRITICAL_SECTION_H
+#define PICO_CRITICAL_SECTION_H
+
+// Single threaded on the host, nothing to lock
+
+struct critical_section_t {
+  int unused;
+};
+
+inline void critical_section_init(critical_section_t*) {
+}
+
+inline void critical_section_enter_blocking(critical_section_t*) {
+}
+
+inline void critical_section_exit(critical_section_t*) {
+}
+
+#endif // PICO_CRITICAL_SECTION_H
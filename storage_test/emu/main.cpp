@@ -0,0 +1,233 @@
+// Storage code on the flash emulator
+//
+// Runs the log store from storage_test/src against emulated flash, much
+// faster than the board and with power loss on demand:
+//
+//   soak       appends with erase-ahead in between, reports write
+//              throughput in virtual time and how evenly sectors wore
+//   powerloss  cuts power in the middle of appends, remounts, and checks
+//              every value is the old or the new one. Reports mount time.
+//   bench      the on-device flash benchmarks, in virtual time
+//
+// Usage: storage_emu [soak|powerloss|bench|all] [count] [seed]
+//
+// Built by the emu environment in platformio.ini, or directly with
+//   g++ -std=gnu++17 -O2 -Iemu -Iemu/include emu/main.cpp -o storage_emu
+// from storage_test.
+//
+// Results are JSON lines like those of the benchmarks on the board.
+
+#include <Arduino.h>
+#include <chrono>
+#include "../src/flash_io.h"
+#include "../src/crc32.h"
+#include "../src/log_store.h"
+#include "../src/flash_bench.h"
+
+#define EMU_STORE_OFFSET 0x100000
+#define EMU_STORE_SECTORS 64
+#define EMU_BENCH_OFFSET 0x800000
+#define EMU_BENCH_SECTORS 32
+#define EMU_KEYS 8
+#define EMU_MAX_VALUE 8192
+
+// What each key should read back as
+uint8_t expected[EMU_KEYS][EMU_MAX_VALUE];
+uint32_t expectedSize[EMU_KEYS];
+bool expectedSet[EMU_KEYS];
+
+uint8_t value[EMU_MAX_VALUE];
+uint8_t readBack[EMU_MAX_VALUE];
+uint32_t seed = 1;
+
+uint32_t nextRandom() {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+// Mostly small values, now and then one over several sectors
+uint32_t randomSize() {
+  uint32_t pick = nextRandom() % 100;
+  if (pick < 80) return 16 + nextRandom() % 240;
+  if (pick < 98) return 256 + nextRandom() % 1792;
+  return 2048 + nextRandom() % (EMU_MAX_VALUE - 2048);
+}
+
+void randomValue(uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) value[i] = nextRandom();
+}
+
+unsigned long long hostMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool readsAs(LogStore& store, uint16_t key, const uint8_t* data, uint32_t size, bool present) {
+  uint32_t actual = 0;
+  bool found = store.read(key, readBack, sizeof(readBack), &actual);
+  if (!present) return !found;
+  return found && actual == size && memcmp(readBack, data, size) == 0;
+}
+
+// Every key reads back as expected, except skipKey
+int checkStore(LogStore& store, int skipKey = -1) {
+  int failures = 0;
+  for (int key = 0; key < EMU_KEYS; key++) {
+    if (key == skipKey) continue;
+    if (!readsAs(store, key, expected[key], expectedSize[key], expectedSet[key])) {
+      fprintf(stderr, "key %d does not read back as written\n", key);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+void expect(uint16_t key, const uint8_t* data, uint32_t size) {
+  memcpy(expected[key], data, size);
+  expectedSize[key] = size;
+  expectedSet[key] = true;
+}
+
+int runSoak(unsigned long appends) {
+  flashEmu.reset(seed);
+  memset(expectedSet, 0, sizeof(expectedSet));
+  LogStore store;
+  if (!store.begin(EMU_STORE_OFFSET, EMU_STORE_SECTORS) || !store.format()) return 1;
+
+  unsigned long long bytes = 0;
+  unsigned long long appendUs = 0;
+  unsigned long maxAppendUs = 0;
+  unsigned long long started = hostMicros();
+  int failures = 0;
+  for (unsigned long i = 0; i < appends; i++) {
+    uint16_t key = nextRandom() % EMU_KEYS;
+    uint32_t size = randomSize();
+    randomValue(size);
+
+    unsigned long before = micros();
+    if (!store.append(key, value, size)) {
+      fprintf(stderr, "append %lu failed\n", i);
+      failures++;
+      break;
+    }
+    unsigned long took = micros() - before;
+    appendUs += took;
+    if (took > maxAppendUs) maxAppendUs = took;
+    bytes += size;
+    expect(key, value, size);
+
+    // Idle time between writes goes to erasing ahead
+    delay(100);
+    store.eraseAhead(4);
+  }
+  unsigned long long hostUs = hostMicros() - started;
+
+  // Remount and compare the wear in the headers with what the flash saw
+  LogStore mounted;
+  mounted.begin(EMU_STORE_OFFSET, EMU_STORE_SECTORS);
+  failures += checkStore(mounted);
+  uint32_t countMismatches = 0;
+  for (uint32_t sector = 0; sector < EMU_STORE_SECTORS; sector++) {
+    if (mounted.sectorErases(sector) != flashEmu.eraseCount(EMU_STORE_OFFSET + sector * FLASH_SECTOR_SIZE)) {
+      countMismatches++;
+    }
+  }
+  failures += countMismatches;
+
+  uint32_t minErases, maxErases;
+  double meanErases;
+  flashEmu.wear(EMU_STORE_OFFSET, EMU_STORE_SECTORS, &minErases, &maxErases, &meanErases);
+  printf("{\"emu\":\"soak\",\"appends\":%lu,\"bytes\":%llu,\"meanAppendUs\":%llu,\"maxAppendUs\":%lu,"
+         "\"kbPerSec\":%llu,\"sectorErases\":%llu,\"pagePrograms\":%llu,\"writeAmplification\":%.2f,"
+         "\"minErases\":%u,\"maxErases\":%u,\"meanErases\":%.1f,\"headerCountMismatches\":%u,"
+         "\"missingErases\":%lu,\"hostMs\":%llu,\"failures\":%d}\n",
+         appends, bytes, appendUs / max(appends, 1ul), maxAppendUs,
+         appendUs ? bytes * 1000000 / appendUs / 1024 : 0,
+         flashEmu.stats.sectorErases, flashEmu.stats.pagePrograms, store.writeAmplification(),
+         minErases, maxErases, meanErases, countMismatches,
+         flashEmu.stats.missingErases, hostUs / 1000, failures);
+  return failures;
+}
+
+int runPowerLoss(unsigned long rounds) {
+  flashEmu.reset(seed);
+  memset(expectedSet, 0, sizeof(expectedSet));
+  {
+    LogStore store;
+    if (!store.begin(EMU_STORE_OFFSET, EMU_STORE_SECTORS) || !store.format()) return 1;
+  }
+
+  int failures = 0;
+  unsigned long cuts = 0;
+  unsigned long newValues = 0;
+  unsigned long long mountUs = 0;
+  unsigned long long maxMountUs = 0;
+  for (unsigned long round = 0; round < rounds; round++) {
+    LogStore store;
+    store.begin(EMU_STORE_OFFSET, EMU_STORE_SECTORS);
+
+    uint16_t key = nextRandom() % EMU_KEYS;
+    uint32_t size = randomSize();
+    randomValue(size);
+
+    // Somewhere in the append or the erase-ahead after it
+    flashEmu.powerLossAfter(nextRandom() % 16);
+    bool cut = false;
+    try {
+      if (!store.append(key, value, size)) {
+        fprintf(stderr, "round %lu: append failed\n", round);
+        failures++;
+      }
+      store.eraseAhead(2);
+    } catch (const EmuPowerLoss&) {
+      cut = true;
+      cuts++;
+    }
+    flashEmu.cancelPowerLoss();
+
+    // Reboot
+    unsigned long long started = hostMicros();
+    LogStore mounted;
+    mounted.begin(EMU_STORE_OFFSET, EMU_STORE_SECTORS);
+    unsigned long long took = hostMicros() - started;
+    mountUs += took;
+    if (took > maxMountUs) maxMountUs = took;
+
+    if (readsAs(mounted, key, value, size, true)) {
+      expect(key, value, size);
+      newValues++;
+    } else if (!cut || !readsAs(mounted, key, expected[key], expectedSize[key], expectedSet[key])) {
+      fprintf(stderr, "round %lu: key %u is neither the old nor the new value\n", round, key);
+      failures++;
+    }
+    failures += checkStore(mounted, key);
+  }
+
+  printf("{\"emu\":\"powerloss\",\"rounds\":%lu,\"cuts\":%lu,\"newValuesKept\":%lu,"
+         "\"meanMountHostUs\":%llu,\"maxMountHostUs\":%llu,\"sectorErases\":%llu,"
+         "\"missingErases\":%lu,\"failures\":%d}\n",
+         rounds, cuts, newValues, mountUs / max(rounds, 1ul), maxMountUs,
+         flashEmu.stats.sectorErases, flashEmu.stats.missingErases, failures);
+  return failures;
+}
+
+int runBench(int iterations) {
+  flashEmu.reset(seed);
+  if (!flashBench.begin(EMU_BENCH_OFFSET, EMU_BENCH_SECTORS)) return 1;
+  flashBench.run(Serial, iterations, EMU_STORE_OFFSET, EMU_STORE_SECTORS * FLASH_SECTOR_SIZE);
+  return flashEmu.stats.missingErases > 0;
+}
+
+int main(int argc, char** argv) {
+  const char* mode = argc > 1 ? argv[1] : "all";
+  unsigned long count = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+  seed = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+  crc32Begin();
+
+  int failures = 0;
+  bool all = strcmp(mode, "all") == 0;
+  if (all || strcmp(mode, "soak") == 0) failures += runSoak(count ? count : 200000);
+  if (all || strcmp(mode, "powerloss") == 0) failures += runPowerLoss(count ? count : 20000);
+  if (all || strcmp(mode, "bench") == 0) failures += runBench(count ? min(count, 256ul) : 64);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,357 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include <Arduino.h>
+#include "log_store.h"
+
+// Block compression for stored values. The value is cut into blocks of
+// COMPRESS_BLOCK_SIZE bytes, each compressed on its own with LZSS, so any
+// block can be decompressed without the ones before it and a damaged block
+// only loses itself. The window never reaches past the start of a block,
+// which bounds the compressor to about 4 KB of RAM and the decompressor to
+// the block it writes.
+//
+// Layout of a compressed value:
+//   CompressedHeader
+//   for each block:
+//     uint16_t length   compressed size, COMPRESS_STORED set if the block
+//                       is kept as is
+//     the block
+//
+// Every length sits in front of its block, so a value can be written while
+// it is compressed without holding more than one block. The log store
+// marks compressed values with LOG_VALUE_COMPRESSED, the magic only
+// confirms it.
+//
+// LZSS stream: a flag byte, then eight items. A set flag bit is a literal
+// byte, a clear one a match of two bytes, 12 bits of distance - 1 and
+// 4 bits of length - 3.
+
+#define COMPRESS_MAGIC 0x5A4C5052     // 'RPLZ'
+#define COMPRESS_BLOCK_SIZE 1024
+#define COMPRESS_STORED 0x8000
+
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH 18
+#define LZSS_HASH_BITS 10
+#define LZSS_MAX_CHAIN 16             // Candidates tried per position
+
+struct CompressedHeader {
+  uint32_t magic;
+  uint32_t rawSize;
+  uint16_t blockSize;
+  uint16_t blockCount;
+};
+
+// Compress one block. Returns the compressed size, or 0 if it would not
+// fit in outMax.
+size_t lzssCompress(const uint8_t* in, size_t size, uint8_t* out, size_t outMax) {
+  static int16_t head[1 << LZSS_HASH_BITS];
+  static int16_t prev[COMPRESS_BLOCK_SIZE];
+  if (size > COMPRESS_BLOCK_SIZE) return 0;
+  memset(head, 0xFF, sizeof(head));
+
+  size_t outPos = 0;
+  size_t flagPos = 0;
+  int flagBit = 8;
+  size_t pos = 0;
+  while (pos < size) {
+    if (flagBit == 8) {
+      if (outPos >= outMax) return 0;
+      flagPos = outPos++;
+      out[flagPos] = 0;
+      flagBit = 0;
+    }
+
+    // Longest earlier match along the hash chain
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+    uint32_t hash = 0;
+    if (pos + LZSS_MIN_MATCH <= size) {
+      hash = ((in[pos] << 6) ^ (in[pos + 1] << 3) ^ in[pos + 2]) & ((1 << LZSS_HASH_BITS) - 1);
+      int candidate = head[hash];
+      size_t longest = min((size_t)LZSS_MAX_MATCH, size - pos);
+      for (int tries = 0; candidate >= 0 && tries < LZSS_MAX_CHAIN; tries++) {
+        size_t length = 0;
+        while (length < longest && in[candidate + length] == in[pos + length]) length++;
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = pos - candidate;
+          if (length == longest) break;
+        }
+        candidate = prev[candidate];
+      }
+    }
+
+    if (bestLength >= LZSS_MIN_MATCH) {
+      if (outPos + 2 > outMax) return 0;
+      out[outPos++] = (bestDistance - 1) & 0xFF;
+      out[outPos++] = (((bestDistance - 1) >> 8) << 4) | (bestLength - LZSS_MIN_MATCH);
+    } else {
+      if (outPos >= outMax) return 0;
+      out[flagPos] |= 1 << flagBit;
+      out[outPos++] = in[pos];
+      bestLength = 1;
+    }
+    flagBit++;
+
+    // Index every position the item covered
+    for (size_t end = pos + bestLength; pos < end; pos++) {
+      if (pos + LZSS_MIN_MATCH <= size) {
+        hash = ((in[pos] << 6) ^ (in[pos + 1] << 3) ^ in[pos + 2]) & ((1 << LZSS_HASH_BITS) - 1);
+        prev[pos] = head[hash];
+        head[hash] = pos;
+      }
+    }
+  }
+  return outPos;
+}
+
+// Decompress one block of exactly outSize bytes. Returns false if the
+// stream is damaged.
+bool lzssDecompress(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize) {
+  size_t inPos = 0;
+  size_t outPos = 0;
+  while (outPos < outSize) {
+    if (inPos >= inSize) return false;
+    uint8_t flags = in[inPos++];
+    for (int bit = 0; bit < 8 && outPos < outSize; bit++) {
+      if (flags & (1 << bit)) {
+        if (inPos >= inSize) return false;
+        out[outPos++] = in[inPos++];
+      } else {
+        if (inPos + 2 > inSize) return false;
+        size_t distance = (in[inPos] | ((in[inPos + 1] >> 4) << 8)) + 1;
+        size_t length = (in[inPos + 1] & 0x0F) + LZSS_MIN_MATCH;
+        inPos += 2;
+        if (distance > outPos || outPos + length > outSize) return false;
+        for (size_t i = 0; i < length; i++, outPos++) {
+          out[outPos] = out[outPos - distance];
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Worst case size of a compressed value of size bytes
+#define COMPRESS_BOUND(size) (sizeof(CompressedHeader) + \
+  ((size) + COMPRESS_BLOCK_SIZE - 1) / COMPRESS_BLOCK_SIZE * sizeof(uint16_t) + (size))
+
+// Largest value whose block count fits the header
+#define COMPRESS_MAX_SIZE (0xFFFFUL * COMPRESS_BLOCK_SIZE)
+
+void compressHeader(CompressedHeader* header, size_t size) {
+  header->magic = COMPRESS_MAGIC;
+  header->rawSize = size;
+  header->blockSize = COMPRESS_BLOCK_SIZE;
+  header->blockCount = (size + COMPRESS_BLOCK_SIZE - 1) / COMPRESS_BLOCK_SIZE;
+}
+
+// Compress block number block of a value into out, which holds
+// COMPRESS_BLOCK_SIZE bytes. Returns the length as stored in front of it.
+// A block that doesn't get smaller is left in data, *packed then points
+// there.
+uint16_t compressBlock(const uint8_t* data, size_t size, uint16_t block, uint8_t* out,
+                       const uint8_t** packed) {
+  const uint8_t* raw = data + block * COMPRESS_BLOCK_SIZE;
+  size_t rawLength = min((size_t)COMPRESS_BLOCK_SIZE, size - block * COMPRESS_BLOCK_SIZE);
+  size_t length = lzssCompress(raw, rawLength, out, rawLength - 1);
+  if (length == 0) {
+    *packed = raw;
+    return rawLength | COMPRESS_STORED;
+  }
+  *packed = out;
+  return length;
+}
+
+// Compress a whole value into out. Returns the size, or 0 if out is too
+// small. Blocks that don't get smaller are stored as they are.
+size_t compressBlocks(const uint8_t* data, size_t size, uint8_t* out, size_t outMax) {
+  static uint8_t scratch[COMPRESS_BLOCK_SIZE];
+  CompressedHeader header;
+  compressHeader(&header, size);
+  if (size > COMPRESS_MAX_SIZE || sizeof(header) > outMax) return 0;
+  memcpy(out, &header, sizeof(header));
+
+  size_t pos = sizeof(header);
+  for (uint16_t block = 0; block < header.blockCount; block++) {
+    const uint8_t* packed;
+    uint16_t length = compressBlock(data, size, block, scratch, &packed);
+    size_t packedLength = length & ~COMPRESS_STORED;
+    if (pos + sizeof(length) + packedLength > outMax) return 0;
+    memcpy(out + pos, &length, sizeof(length));
+    memcpy(out + pos + sizeof(length), packed, packedLength);
+    pos += sizeof(length) + packedLength;
+  }
+  return pos;
+}
+
+// Hands a value out compressed, a block at a time, for LogStore::appendStream().
+// The log needs the size before the first part, so begin() compresses once
+// to count and read() again while writing, which keeps RAM at one block.
+class CompressingSource : public LogValueSource {
+private:
+  const uint8_t* data = NULL;
+  size_t rawSize = 0;
+  CompressedHeader header;
+  uint8_t pending[sizeof(uint16_t) + COMPRESS_BLOCK_SIZE];   // Length and block
+  const uint8_t* packed = NULL;  // The block, in pending or in data
+  size_t pendingSize = 0;
+  size_t pendingOffset = 0;
+  uint32_t nextBlock = 0;        // Block to compress next, the header counts as -1
+  bool headerSent = false;
+
+  // Make the next piece current, false at the end of the value
+  bool refill() {
+    pendingOffset = 0;
+    if (!headerSent) {
+      memcpy(pending, &header, sizeof(header));
+      packed = NULL;
+      pendingSize = sizeof(header);
+      headerSent = true;
+      return true;
+    }
+    if (nextBlock >= header.blockCount) return false;
+    uint16_t length = compressBlock(data, rawSize, nextBlock++, pending + sizeof(length), &packed);
+    memcpy(pending, &length, sizeof(length));
+    pendingSize = sizeof(length) + (length & ~COMPRESS_STORED);
+    return true;
+  }
+
+public:
+  // Returns the compressed size, 0 if the value is too large
+  uint32_t begin(const uint8_t* value, size_t size) {
+    if (size > COMPRESS_MAX_SIZE) return 0;
+    data = value;
+    rawSize = size;
+    compressHeader(&header, size);
+    uint32_t total = sizeof(header);
+    for (uint16_t block = 0; block < header.blockCount; block++) {
+      total += sizeof(uint16_t) + (compressBlock(data, size, block, pending, &packed) & ~COMPRESS_STORED);
+    }
+    nextBlock = 0;
+    headerSent = false;
+    pendingSize = pendingOffset = 0;
+    return total;
+  }
+
+  size_t read(uint8_t* out, size_t size) override {
+    size_t done = 0;
+    while (done < size) {
+      if (pendingOffset == pendingSize && !refill()) break;
+      // The length is always in pending, a stored block stays in data
+      const uint8_t* from;
+      size_t chunk;
+      if (packed && pendingOffset >= sizeof(uint16_t)) {
+        from = packed + pendingOffset - sizeof(uint16_t);
+        chunk = pendingSize - pendingOffset;
+      } else {
+        from = pending + pendingOffset;
+        chunk = (packed ? sizeof(uint16_t) : pendingSize) - pendingOffset;
+      }
+      chunk = min(chunk, size - done);
+      memcpy(out + done, from, chunk);
+      pendingOffset += chunk;
+      done += chunk;
+    }
+    return done;
+  }
+};
+
+// Reads a compressed value block by block, straight from its view
+class CompressedReader {
+private:
+  LogValueView view;
+  CompressedHeader header;
+
+public:
+  // False if the value isn't marked compressed or its header is damaged
+  bool begin(const LogValueView& value) {
+    view = value;
+    if (!view.compressed()) return false;
+    view.rewind();
+    return view.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+           header.magic == COMPRESS_MAGIC && header.blockSize != 0 &&
+           header.blockSize <= COMPRESS_BLOCK_SIZE &&
+           header.blockCount == (header.rawSize + header.blockSize - 1) / header.blockSize;
+  }
+
+  uint32_t rawSize() { return header.rawSize; }
+  uint16_t blockCount() { return header.blockCount; }
+
+  // Decompress one block into out, which must hold blockSize bytes.
+  // Returns its raw size, 0 if it is damaged.
+  size_t readBlock(uint16_t block, uint8_t* out) {
+    static uint8_t packed[COMPRESS_BLOCK_SIZE];
+    if (block >= header.blockCount) return 0;
+
+    // Blocks are found by skipping over the ones before them
+    uint16_t length;
+    view.rewind();
+    view.skip(sizeof(header));
+    for (uint16_t i = 0; ; i++) {
+      if (view.read((uint8_t*)&length, sizeof(length)) != sizeof(length)) return 0;
+      if (i == block) break;
+      view.skip(length & ~COMPRESS_STORED);
+    }
+    size_t rawLength = min((uint32_t)header.blockSize, header.rawSize - block * header.blockSize);
+    size_t packedLength = length & ~COMPRESS_STORED;
+    if (packedLength > sizeof(packed)) return 0;
+
+    if (length & COMPRESS_STORED) {
+      return (packedLength == rawLength && view.read(out, rawLength) == rawLength) ? rawLength : 0;
+    }
+    if (view.read(packed, packedLength) != packedLength) return 0;
+    return lzssDecompress(packed, packedLength, out, rawLength) ? rawLength : 0;
+  }
+
+  // Decompress up to maxSize bytes from the start
+  size_t read(uint8_t* out, size_t maxSize) {
+    static uint8_t block[COMPRESS_BLOCK_SIZE];
+    size_t done = 0;
+    for (uint16_t i = 0; i < header.blockCount && done < maxSize; i++) {
+      size_t length = readBlock(i, block);
+      if (length == 0) break;
+      size_t chunk = min(length, maxSize - done);
+      memcpy(out + done, block, chunk);
+      done += chunk;
+    }
+    return done;
+  }
+
+  // True if the value decompresses to exactly size bytes of data
+  bool equals(const uint8_t* data, size_t size) {
+    static uint8_t block[COMPRESS_BLOCK_SIZE];
+    if (header.rawSize != size) return false;
+    for (uint16_t i = 0; i < header.blockCount; i++) {
+      size_t length = readBlock(i, block);
+      if (length == 0 || memcmp(block, data + i * header.blockSize, length) != 0) return false;
+    }
+    return true;
+  }
+};
+
+// Store a value for key block compressed, streamed into the log so any
+// size does. Like LogStore::append(), the value key already holds is not
+// written again and sets *unchanged.
+bool appendCompressed(LogStore& store, uint16_t key, const void* data, uint32_t size,
+                      bool* unchanged = NULL) {
+  LogValueView current;
+  CompressedReader reader;
+  bool same = store.view(key, &current) && reader.begin(current) &&
+              reader.equals((const uint8_t*)data, size);
+  if (unchanged) *unchanged = same;
+  if (same) return true;
+
+  // Static, the block it holds is too much for the stack of core1
+  static CompressingSource source;
+  uint32_t compressedSize = source.begin((const uint8_t*)data, size);
+  if (compressedSize == 0) {
+    Serial.printf("ERROR: Value of %u bytes is too large to compress\n", size);
+    return false;
+  }
+  return store.appendStream(key, &source, compressedSize, LOG_VALUE_COMPRESSED);
+}
+
+#endif // BLOCK_COMPRESS_H
@@ -0,0 +1,170 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <Arduino.h>
+#include <hardware/dma.h>
+
+// CRC32 (IEEE, reflected), as used for storage records. crc32Update() can be
+// chained over several buffers starting from CRC32_INIT, crc32Final() gives
+// the checksum.
+//
+// Three implementations give the same result:
+//   crc32Bitwise()  eight shifts per byte, no tables, the reference
+//   crc32Slice8()   slice-by-8, eight 1 KB tables in RAM, 8 bytes per step
+//   crc32Dma()      the DMA sniffer computes the CRC while a channel reads
+//                   the data, optionally copying it somewhere on the way
+//
+// crc32Update() uses the table for short buffers such as headers, where
+// setting up a DMA transfer costs more than it saves, and the DMA sniffer
+// for longer ones once crc32Begin() has claimed a channel and checked that
+// it matches the table.
+
+#define CRC32_INIT 0xFFFFFFFF
+#define CRC32_POLY 0xEDB88320
+
+// Buffers at least this long go through the DMA sniffer
+#define CRC32_DMA_MIN 128
+
+uint32_t crc32Table[8][256];
+bool crc32TableReady = false;
+int crc32DmaChannel = -1;
+
+inline uint32_t crc32Final(uint32_t crc) {
+  return ~crc;
+}
+
+uint32_t crc32Bitwise(uint32_t crc, const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+    }
+  }
+  return crc;
+}
+
+void crc32BuildTables() {
+  for (int i = 0; i < 256; i++) {
+    uint8_t byte = i;
+    crc32Table[0][i] = crc32Bitwise(0, &byte, 1);
+  }
+  // Table k advances a byte through k more zero bytes
+  for (int i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++) {
+      uint32_t prev = crc32Table[k - 1][i];
+      crc32Table[k][i] = (prev >> 8) ^ crc32Table[0][prev & 0xFF];
+    }
+  }
+  crc32TableReady = true;
+}
+
+uint32_t crc32Slice8(uint32_t crc, const uint8_t* data, size_t size) {
+  if (!crc32TableReady) crc32BuildTables();
+
+  // The M0+ can't load unaligned words
+  while (size > 0 && ((uintptr_t)data & 3)) {
+    crc = (crc >> 8) ^ crc32Table[0][(crc ^ *data++) & 0xFF];
+    size--;
+  }
+
+  const uint32_t* words = (const uint32_t*)data;
+  while (size >= 8) {
+    uint32_t low = *words++ ^ crc;
+    uint32_t high = *words++;
+    crc = crc32Table[7][low & 0xFF] ^
+          crc32Table[6][(low >> 8) & 0xFF] ^
+          crc32Table[5][(low >> 16) & 0xFF] ^
+          crc32Table[4][low >> 24] ^
+          crc32Table[3][high & 0xFF] ^
+          crc32Table[2][(high >> 8) & 0xFF] ^
+          crc32Table[1][(high >> 16) & 0xFF] ^
+          crc32Table[0][high >> 24];
+    size -= 8;
+  }
+
+  data = (const uint8_t*)words;
+  while (size > 0) {
+    crc = (crc >> 8) ^ crc32Table[0][(crc ^ *data++) & 0xFF];
+    size--;
+  }
+  return crc;
+}
+
+uint32_t crc32ReverseBits(uint32_t v) {
+  v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+  v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+  v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+  return (v >> 16) | (v << 16);
+}
+
+// Run size bytes from data through the sniffer. With a destination the
+// bytes are copied there, otherwise they are all written to one scratch
+// word. Byte transfers keep the CRC independent of alignment.
+uint32_t crc32Dma(uint32_t crc, const uint8_t* data, size_t size, uint8_t* copyTo = NULL) {
+  if (crc32DmaChannel < 0) {
+    if (copyTo) memcpy(copyTo, data, size);
+    return crc32Slice8(crc, data, size);
+  }
+
+  static uint32_t scratch;
+  dma_channel_config config = dma_channel_get_default_config(crc32DmaChannel);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, copyTo != NULL);
+  channel_config_set_sniff_enable(&config, true);
+
+  // The sniffer shifts MSB first over bit reversed data, so its accumulator
+  // holds our reflected state bit reversed. Reading it back reversed gives
+  // the state directly.
+  dma_sniffer_enable(crc32DmaChannel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+  dma_sniffer_set_output_reverse_enabled(true);
+  dma_sniffer_set_output_invert_enabled(false);
+  dma_sniffer_set_data_accumulator(crc32ReverseBits(crc));
+
+  dma_channel_configure(crc32DmaChannel, &config,
+                        copyTo ? (void*)copyTo : (void*)&scratch, data, size, true);
+  dma_channel_wait_for_finish_blocking(crc32DmaChannel);
+  crc = dma_sniffer_get_data_accumulator();
+  dma_sniffer_disable();
+  return crc;
+}
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t size) {
+  if (size >= CRC32_DMA_MIN && crc32DmaChannel >= 0) {
+    return crc32Dma(crc, data, size);
+  }
+  return crc32Slice8(crc, data, size);
+}
+
+uint32_t calculateCRC32(const uint8_t* data, size_t size) {
+  return crc32Final(crc32Update(CRC32_INIT, data, size));
+}
+
+// Build the tables and claim a DMA channel for the sniffer. If the sniffer
+// disagrees with the table the channel is released again and only the
+// table is used.
+bool crc32Begin() {
+  crc32BuildTables();
+  if (crc32DmaChannel >= 0) return true;
+
+  crc32DmaChannel = dma_claim_unused_channel(false);
+  if (crc32DmaChannel < 0) {
+    Serial.println("CRC32: no free DMA channel, using tables only");
+    return false;
+  }
+
+  // Odd length and offset to cover the unaligned paths too
+  uint8_t test[CRC32_DMA_MIN + 7];
+  for (size_t i = 0; i < sizeof(test); i++) test[i] = i * 37 + 11;
+  uint32_t expected = crc32Slice8(0x12345678, test + 1, sizeof(test) - 1);
+  if (crc32Dma(0x12345678, test + 1, sizeof(test) - 1) != expected) {
+    Serial.println("CRC32: DMA sniffer result does not match, using tables only");
+    dma_channel_unclaim(crc32DmaChannel);
+    crc32DmaChannel = -1;
+    return false;
+  }
+  return true;
+}
+
+#endif // CRC32_H
@@ -0,0 +1,353 @@
+#ifndef FLASH_BENCH_H
+#define FLASH_BENCH_H
+
+#include <Arduino.h>
+#include <algorithm>
+#include "flash_io.h"
+#include "log_store.h"
+#include "block_compress.h"
+
+// Flash performance benchmarks. Each one repeats an operation and prints
+// one JSON object per line with latency percentiles in microseconds, plus
+// the throughput for operations that move data:
+//
+//   {"bench":"erase_sector","n":64,"bytes":4096,"minUs":...,"p50Us":...,
+//    "p90Us":...,"p99Us":...,"maxUs":...,"meanUs":...,"kbPerSec":...}
+//
+// Lines starting with '{' can be collected from the serial log as is. The
+// compression benchmarks add "ratio", compressed over raw size, and the
+// compressed appends the sectors they erased.
+//
+// The area given to begin() is erased and overwritten freely. It must hold
+// one 64 KB aligned block for the block erase, which is timed sector by
+// sector.
+
+#define BENCH_MAX_SAMPLES 256
+#define BENCH_BLOCK_SIZE 65536
+
+#ifndef XIP_NOCACHE_NOALLOC_BASE
+#define XIP_NOCACHE_NOALLOC_BASE 0x13000000
+#endif
+
+class FlashBench {
+private:
+  uint32_t blockOffset = 0;      // 64 KB aligned block inside the area
+  uint32_t samples[BENCH_MAX_SAMPLES];
+  size_t count = 0;
+  uint32_t seed = 1;
+  uint8_t data[FLASH_SECTOR_SIZE];
+
+  void fillRandom(uint8_t* out, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      seed = seed * 1664525 + 1013904223;
+      out[i] = seed >> 24;
+    }
+  }
+
+  void add(uint32_t us) {
+    if (count < BENCH_MAX_SAMPLES) samples[count++] = us;
+  }
+
+  uint32_t percentile(int p) {
+    return samples[(p * (count - 1) + 50) / 100];
+  }
+
+  // Text like the continuous write test logs, and slowly changing
+  // timestamped readings as a sensor would give
+  void fillText(uint8_t* out, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+      seed = seed * 1664525 + 1013904223;
+      char line[48];
+      int length = snprintf(line, sizeof(line), "Test write #%lu at %lu ms\n",
+                            (unsigned long)(seed >> 20), (unsigned long)(seed >> 8));
+      size_t chunk = min((size_t)length, size - done);
+      memcpy(out + done, line, chunk);
+      done += chunk;
+    }
+  }
+
+  void fillReadings(uint8_t* out, size_t size) {
+    uint32_t time = 0;
+    int16_t reading = 2048;
+    for (size_t i = 0; i + 6 <= size; i += 6) {
+      seed = seed * 1664525 + 1013904223;
+      time += 100;
+      reading += (int)(seed >> 29) - 4;
+      memcpy(out + i, &time, 4);
+      memcpy(out + i + 4, &reading, 2);
+    }
+    memset(out + size - size % 6, 0, size % 6);
+  }
+
+  void fill(uint8_t* out, size_t size, int kind) {
+    if (kind == 0) fillText(out, size);
+    else if (kind == 1) fillReadings(out, size);
+    else fillRandom(out, size);
+  }
+
+  // Print the samples collected since the last report and start over
+  void report(Print& out, const char* name, uint32_t bytesPerOp, const char* extra = NULL) {
+    if (count == 0) return;
+    std::sort(samples, samples + count);
+    unsigned long long total = 0;
+    for (size_t i = 0; i < count; i++) total += samples[i];
+
+    out.printf("{\"bench\":\"%s\",\"n\":%u,\"bytes\":%u,\"minUs\":%u,\"p50Us\":%u,"
+               "\"p90Us\":%u,\"p99Us\":%u,\"maxUs\":%u,\"meanUs\":%llu",
+               name, (unsigned)count, bytesPerOp, samples[0], percentile(50),
+               percentile(90), percentile(99), samples[count - 1], total / count);
+    if (bytesPerOp > 0 && total > 0) {
+      out.printf(",\"kbPerSec\":%llu", (unsigned long long)bytesPerOp * count * 1000000 / total / 1024);
+    }
+    if (extra) out.print(extra);
+    out.println("}");
+    count = 0;
+  }
+
+  // Raw operations, timed inside the lockout so only the flash is measured.
+  // Like flash_io.h, one lockout never covers more than a sector.
+  uint32_t timedErase(uint32_t offset) {
+    uint32_t ints = flashLock();
+    unsigned long started = micros();
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    uint32_t elapsed = micros() - started;
+    flashUnlock(ints, started, &flashStats.maxEraseLockUs);
+    flashStats.sectorsErased++;
+    return elapsed;
+  }
+
+  uint32_t timedProgram(uint32_t offset, const uint8_t* page) {
+    uint32_t ints = flashLock();
+    unsigned long started = micros();
+    flash_range_program(offset, page, FLASH_PAGE_SIZE);
+    uint32_t elapsed = micros() - started;
+    flashUnlock(ints, started, &flashStats.maxProgramLockUs);
+    flashStats.pagesProgrammed++;
+    flashStats.bytesProgrammed += FLASH_PAGE_SIZE;
+    return elapsed;
+  }
+
+  // Sum the words of a range so the reads can't be optimized away
+  static uint32_t readWords(const volatile uint32_t* words, size_t count) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < count; i++) sum += words[i];
+    return sum;
+  }
+
+public:
+  // Use sectors flash sectors at offset for the benchmarks
+  bool begin(uint32_t offset, uint32_t sectors) {
+    blockOffset = (offset + BENCH_BLOCK_SIZE - 1) & ~(BENCH_BLOCK_SIZE - 1);
+    if (blockOffset + BENCH_BLOCK_SIZE > offset + sectors * FLASH_SECTOR_SIZE) {
+      Serial.println("ERROR: Benchmark area holds no aligned 64 KB block");
+      return false;
+    }
+    return true;
+  }
+
+  // Erase of sectors holding random data
+  void benchEraseSector(Print& out, int iterations) {
+    for (int i = 0; i < iterations; i++) {
+      uint32_t sector = blockOffset + (i % (BENCH_BLOCK_SIZE / FLASH_SECTOR_SIZE)) * FLASH_SECTOR_SIZE;
+      fillRandom(data, sizeof(data));
+      if (!flashIsErased(sector, FLASH_SECTOR_SIZE)) flashEraseSector(sector);
+      flashProgram(sector, data, sizeof(data));
+      add(timedErase(sector));
+    }
+    report(out, "erase_sector", FLASH_SECTOR_SIZE);
+  }
+
+  // Erase of the whole 64 KB block with a page written in every sector.
+  // The 64 KB erase command would hold interrupts off for the whole block,
+  // so the block goes sector by sector and the lockouts are added up.
+  void benchEraseBlock(Print& out, int iterations) {
+    for (int i = 0; i < iterations; i++) {
+      fillRandom(data, FLASH_PAGE_SIZE);
+      for (uint32_t sector = 0; sector < BENCH_BLOCK_SIZE; sector += FLASH_SECTOR_SIZE) {
+        flashProgram(blockOffset + sector, data, FLASH_PAGE_SIZE);
+      }
+      uint32_t elapsed = 0;
+      for (uint32_t sector = 0; sector < BENCH_BLOCK_SIZE; sector += FLASH_SECTOR_SIZE) {
+        elapsed += timedErase(blockOffset + sector);
+      }
+      add(elapsed);
+    }
+    report(out, "erase_block", BENCH_BLOCK_SIZE);
+  }
+
+  // Program of random pages into erased sectors
+  void benchProgramPage(Print& out, int iterations) {
+    const uint32_t pagesPerBlock = BENCH_BLOCK_SIZE / FLASH_PAGE_SIZE;
+    for (int i = 0; i < iterations; i++) {
+      uint32_t page = blockOffset + (i % pagesPerBlock) * FLASH_PAGE_SIZE;
+      if (page % FLASH_SECTOR_SIZE == 0) flashEraseSector(page);
+      fillRandom(data, FLASH_PAGE_SIZE);
+      add(timedProgram(page, data));
+    }
+    report(out, "program_page", FLASH_PAGE_SIZE);
+  }
+
+  // 4 KB reads through the XIP cache, and through the uncached alias from
+  // across the given region so every read goes out to the flash
+  void benchXipRead(Print& out, int iterations, uint32_t regionOffset, uint32_t regionSize) {
+    volatile uint32_t sink = 0;
+    const uint32_t words = FLASH_SECTOR_SIZE / 4;
+
+    const volatile uint32_t* cached = (const volatile uint32_t*)(XIP_BASE + blockOffset);
+    sink += readWords(cached, words);
+    for (int i = 0; i < iterations; i++) {
+      unsigned long started = micros();
+      sink += readWords(cached, words);
+      add(micros() - started);
+    }
+    report(out, "xip_read_cached", FLASH_SECTOR_SIZE);
+
+    uint32_t sectors = regionSize / FLASH_SECTOR_SIZE;
+    for (int i = 0; i < iterations; i++) {
+      uint32_t offset = regionOffset + (i * 37 % sectors) * FLASH_SECTOR_SIZE;
+      const volatile uint32_t* uncached = (const volatile uint32_t*)(XIP_NOCACHE_NOALLOC_BASE + offset);
+      unsigned long started = micros();
+      sink += readWords(uncached, words);
+      add(micros() - started);
+    }
+    report(out, "xip_read_uncached", FLASH_SECTOR_SIZE);
+    (void)sink;
+  }
+
+  // Appends of random records to a log store on the block, including the
+  // reclaims they trigger once it wraps. With eraseAhead, free sectors are
+  // erased between appends, untimed, as idle time would.
+  void benchAppend(Print& out, int iterations, uint32_t recordSize, uint32_t eraseAhead = 0) {
+    LogStore store;
+    if (!store.begin(blockOffset, BENCH_BLOCK_SIZE / FLASH_SECTOR_SIZE) || !store.format()) {
+      return;
+    }
+    recordSize = min(recordSize, (uint32_t)sizeof(data));
+    for (int i = 0; i < iterations; i++) {
+      fillRandom(data, recordSize);
+      unsigned long started = micros();
+      if (!store.append(i % 4, data, recordSize)) break;
+      add(micros() - started);
+      while (eraseAhead > 0 && store.eraseAhead(eraseAhead)) {
+      }
+    }
+    char name[32];
+    snprintf(name, sizeof(name), eraseAhead > 0 ? "append_%u_erased_ahead" : "append_%u", recordSize);
+    report(out, name, recordSize);
+  }
+
+  // Compression and decompression of 4 KB of text, readings and random
+  // data, in RAM
+  void benchCompress(Print& out, int iterations) {
+    static const char* kinds[] = {"text", "readings", "random"};
+    static uint8_t packed[COMPRESS_BOUND(FLASH_SECTOR_SIZE)];
+    static uint8_t unpacked[COMPRESS_BLOCK_SIZE];
+    char name[32];
+    char extra[32];
+
+    for (int kind = 0; kind < 3; kind++) {
+      unsigned long long rawBytes = 0;
+      unsigned long long packedBytes = 0;
+      for (int i = 0; i < iterations; i++) {
+        fill(data, sizeof(data), kind);
+        unsigned long started = micros();
+        size_t size = compressBlocks(data, sizeof(data), packed, sizeof(packed));
+        add(micros() - started);
+        rawBytes += sizeof(data);
+        packedBytes += size;
+      }
+      snprintf(name, sizeof(name), "compress_%s", kinds[kind]);
+      snprintf(extra, sizeof(extra), ",\"ratio\":%.3f", (double)packedBytes / rawBytes);
+      report(out, name, sizeof(data), extra);
+
+      // The last value, block by block as CompressedReader does it
+      const CompressedHeader* header = (const CompressedHeader*)packed;
+      for (int i = 0; i < iterations; i++) {
+        const uint8_t* block = packed + sizeof(CompressedHeader);
+        unsigned long started = micros();
+        for (uint16_t b = 0; b < header->blockCount; b++) {
+          uint16_t stored;
+          memcpy(&stored, block, sizeof(stored));
+          block += sizeof(stored);
+          size_t length = stored & ~COMPRESS_STORED;
+          if (stored & COMPRESS_STORED) {
+            memcpy(unpacked, block, length);
+          } else {
+            lzssDecompress(block, length, unpacked, COMPRESS_BLOCK_SIZE);
+          }
+          block += length;
+        }
+        add(micros() - started);
+      }
+      snprintf(name, sizeof(name), "decompress_%s", kinds[kind]);
+      report(out, name, sizeof(data));
+    }
+  }
+
+  // Appends of text records to a log store on the block, compressed while
+  // appending or not. The time includes the compression, bytes is the raw
+  // size, so kbPerSec compares directly. Fewer bytes stored means fewer
+  // sectors to reclaim and erase.
+  void benchAppendCompressed(Print& out, int iterations, uint32_t recordSize, bool compress) {
+    LogStore store;
+    if (!store.begin(blockOffset, BENCH_BLOCK_SIZE / FLASH_SECTOR_SIZE) || !store.format()) {
+      return;
+    }
+    recordSize = min(recordSize, (uint32_t)sizeof(data));
+    unsigned long erasedBefore = flashStats.sectorsErased;
+    unsigned long long stored = 0;
+    int appended = 0;
+    for (int i = 0; i < iterations; i++) {
+      fillText(data, recordSize);
+      unsigned long started = micros();
+      bool ok = compress ? appendCompressed(store, i % 4, data, recordSize)
+                         : store.append(i % 4, data, recordSize);
+      if (!ok) break;
+      add(micros() - started);
+      uint32_t size = 0;
+      store.valueSize(i % 4, &size);
+      stored += size;
+      appended++;
+    }
+    char name[40];
+    char extra[64];
+    snprintf(name, sizeof(name), compress ? "append_%u_compressed" : "append_%u_text", recordSize);
+    snprintf(extra, sizeof(extra), ",\"ratio\":%.3f,\"sectorsErased\":%lu",
+             (double)stored / ((unsigned long long)recordSize * max(appended, 1)),
+             flashStats.sectorsErased - erasedBefore);
+    report(out, name, recordSize, extra);
+  }
+
+  // Run everything with the given number of iterations per benchmark
+  void run(Print& out, int iterations, uint32_t regionOffset, uint32_t regionSize) {
+    iterations = min(iterations, BENCH_MAX_SAMPLES);
+    out.printf("Benchmarking flash at offset 0x%X, %d iterations...\n", blockOffset, iterations);
+
+    benchEraseSector(out, iterations);
+    benchEraseBlock(out, max(iterations / 8, 4));
+    benchProgramPage(out, iterations);
+    benchXipRead(out, iterations, regionOffset, regionSize);
+    benchAppend(out, iterations, 32);
+    benchAppend(out, iterations, 256);
+    benchAppend(out, iterations, 1024);
+    benchAppend(out, iterations, 4096);
+    benchAppend(out, iterations, 256, 4);
+    benchAppend(out, iterations, 4096, 4);
+    benchCompress(out, iterations);
+    benchAppendCompressed(out, iterations, 1024, false);
+    benchAppendCompressed(out, iterations, 1024, true);
+    benchAppendCompressed(out, iterations, 4096, false);
+    benchAppendCompressed(out, iterations, 4096, true);
+
+    // Leave the block erased
+    for (uint32_t sector = 0; sector < BENCH_BLOCK_SIZE; sector += FLASH_SECTOR_SIZE) {
+      if (!flashIsErased(blockOffset + sector, FLASH_SECTOR_SIZE)) flashEraseSector(blockOffset + sector);
+    }
+    out.println("Benchmark completed");
+  }
+};
+
+FlashBench flashBench;
+
+#endif // FLASH_BENCH_H
@@ -0,0 +1,210 @@
+#ifndef FLASH_IO_H
+#define FLASH_IO_H
+
+#include <Arduino.h>
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+
+// Raw access to the onboard QSPI flash. Offsets are from the start of flash.
+// Reads go through the XIP window. Erase works on whole 4 KB sectors and
+// program on 256 byte pages, and NOR flash can only clear bits, so a page may
+// be programmed again as long as the new data only turns 1s into 0s. Bytes
+// left at 0xFF are not touched, which lets small records be appended into
+// a page that already holds data.
+//
+// While the boot ROM erases or programs, XIP is down and any code running
+// from flash would fault. For each single operation the other core is
+// parked in RAM and interrupts are disabled, then both are released before
+// the next one, so USB, WiFi and sampling interrupts keep being served
+// between sectors and pages.
+//
+// Worst case interrupt latency is therefore one 4 KB sector erase. QSPI NOR
+// parts rate that at 45-70 ms typical and 300-400 ms at most, and a 256 byte
+// page program at under 1 ms typical and 3 ms at most. Nothing here ever
+// holds interrupts off longer than one of those. The longest window actually
+// seen is kept in flashStats.
+
+#ifndef FLASH_SECTOR_SIZE
+#define FLASH_SECTOR_SIZE 4096
+#endif
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE 256
+#endif
+
+struct FlashStats {
+  unsigned long sectorsErased;
+  unsigned long pagesProgrammed;
+  unsigned long long bytesProgrammed;   // Payload bytes, not counting page padding
+  unsigned long verifyFailures;
+  unsigned long sectorsUnchanged;       // Skipped by flashUpdate()
+  unsigned long sectorsProgramOnly;     // Updated by flashUpdate() without an erase
+  unsigned long maxEraseLockUs;         // Longest interrupt-off window per operation
+  unsigned long maxProgramLockUs;
+  unsigned long long lockedUs;          // Total time with interrupts off
+};
+
+FlashStats flashStats = {};
+
+// Pointer to flash contents through the XIP window
+inline const uint8_t* flashData(uint32_t offset) {
+  return (const uint8_t*)(XIP_BASE + offset);
+}
+
+// True if every byte in the range reads as erased
+bool flashIsErased(uint32_t offset, size_t length) {
+  const uint8_t* p = flashData(offset);
+  for (size_t i = 0; i < length; i++) {
+    if (p[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+// Stop the other core and interrupts for one flash operation. The other
+// core is only idled if it is running.
+inline uint32_t flashLock() {
+  rp2040.idleOtherCore();
+  return save_and_disable_interrupts();
+}
+
+inline void flashUnlock(uint32_t ints, unsigned long started, unsigned long* maxLockUs) {
+  unsigned long locked = micros() - started;
+  restore_interrupts(ints);
+  rp2040.resumeOtherCore();
+  flashStats.lockedUs += locked;
+  if (locked > *maxLockUs) *maxLockUs = locked;
+}
+
+bool flashEraseSector(uint32_t offset) {
+  if (offset % FLASH_SECTOR_SIZE != 0) {
+    Serial.printf("ERROR: Erase offset 0x%X is not sector aligned\n", offset);
+    return false;
+  }
+
+  uint32_t ints = flashLock();
+  unsigned long started = micros();
+  flash_range_erase(offset, FLASH_SECTOR_SIZE);
+  flashUnlock(ints, started, &flashStats.maxEraseLockUs);
+  flashStats.sectorsErased++;
+
+  if (!flashIsErased(offset, FLASH_SECTOR_SIZE)) {
+    flashStats.verifyFailures++;
+    Serial.printf("ERROR: Sector at 0x%X did not erase\n", offset);
+    return false;
+  }
+  return true;
+}
+
+// Program length bytes at any offset. Each page the range touches is
+// programmed once, with 0xFF around the new bytes. The range must be erased
+// or only need 1 to 0 transitions.
+bool flashProgram(uint32_t offset, const void* data, size_t length) {
+  static uint8_t page[FLASH_PAGE_SIZE];
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint32_t end = offset + length;
+
+  for (uint32_t pageStart = offset - offset % FLASH_PAGE_SIZE; pageStart < end; pageStart += FLASH_PAGE_SIZE) {
+    uint32_t from = max(pageStart, offset);
+    uint32_t to = min(pageStart + FLASH_PAGE_SIZE, end);
+
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page + (from - pageStart), bytes + (from - offset), to - from);
+
+    uint32_t ints = flashLock();
+    unsigned long started = micros();
+    flash_range_program(pageStart, page, FLASH_PAGE_SIZE);
+    flashUnlock(ints, started, &flashStats.maxProgramLockUs);
+    flashStats.pagesProgrammed++;
+  }
+  flashStats.bytesProgrammed += length;
+
+  if (memcmp(flashData(offset), data, length) != 0) {
+    flashStats.verifyFailures++;
+    Serial.printf("ERROR: Program verify failed at 0x%X\n", offset);
+    return false;
+  }
+  return true;
+}
+
+// What flashUpdate() did with the sectors it touched
+struct FlashUpdateResult {
+  uint16_t unchanged;    // Already held the data
+  uint16_t programmed;   // Only needed 1 to 0 transitions, no erase
+  uint16_t erased;       // Erased and programmed again
+};
+
+// Write length bytes at offset, touching only what differs. Each sector is
+// compared with its current contents. Equal sectors are skipped, sectors
+// where the new data only clears bits are programmed in place, page by page
+// where they differ. Other sectors are erased, with any bytes outside the
+// range kept, and programmed again.
+bool flashUpdate(uint32_t offset, const void* data, size_t length, FlashUpdateResult* result = NULL) {
+  static uint8_t sector[FLASH_SECTOR_SIZE];
+  const uint8_t* bytes = (const uint8_t*)data;
+  FlashUpdateResult counts = {};
+  uint32_t end = offset + length;
+
+  for (uint32_t sectorStart = offset - offset % FLASH_SECTOR_SIZE; sectorStart < end; sectorStart += FLASH_SECTOR_SIZE) {
+    uint32_t from = max(sectorStart, offset);
+    uint32_t to = min(sectorStart + FLASH_SECTOR_SIZE, end);
+    const uint8_t* current = flashData(from);
+    const uint8_t* wanted = bytes + (from - offset);
+
+    if (memcmp(current, wanted, to - from) == 0) {
+      counts.unchanged++;
+      flashStats.sectorsUnchanged++;
+      continue;
+    }
+
+    bool clearOnly = true;
+    for (uint32_t i = 0; i < to - from && clearOnly; i++) {
+      clearOnly = (current[i] & wanted[i]) == wanted[i];
+    }
+
+    if (clearOnly) {
+      // Program just the pages that differ
+      for (uint32_t pageStart = from - from % FLASH_PAGE_SIZE; pageStart < to; pageStart += FLASH_PAGE_SIZE) {
+        uint32_t pageFrom = max(pageStart, from);
+        uint32_t pageTo = min(pageStart + FLASH_PAGE_SIZE, to);
+        if (memcmp(flashData(pageFrom), bytes + (pageFrom - offset), pageTo - pageFrom) != 0 &&
+            !flashProgram(pageFrom, bytes + (pageFrom - offset), pageTo - pageFrom)) {
+          return false;
+        }
+      }
+      counts.programmed++;
+      flashStats.sectorsProgramOnly++;
+      continue;
+    }
+
+    // Rebuild the whole sector in RAM, then skip pages left erased
+    memcpy(sector, flashData(sectorStart), FLASH_SECTOR_SIZE);
+    memcpy(sector + (from - sectorStart), wanted, to - from);
+    if (!flashEraseSector(sectorStart)) {
+      return false;
+    }
+    for (uint32_t page = 0; page < FLASH_SECTOR_SIZE; page += FLASH_PAGE_SIZE) {
+      bool blank = true;
+      for (uint32_t i = 0; i < FLASH_PAGE_SIZE && blank; i++) {
+        blank = sector[page + i] == 0xFF;
+      }
+      if (!blank && !flashProgram(sectorStart + page, sector + page, FLASH_PAGE_SIZE)) {
+        return false;
+      }
+    }
+    counts.erased++;
+  }
+
+  if (result) *result = counts;
+  return true;
+}
+
+void flashPrintStats(Print& out) {
+  out.printf("Flash: %lu sectors erased, %lu pages programmed (%llu bytes), %lu verify failures\n",
+             flashStats.sectorsErased, flashStats.pagesProgrammed,
+             flashStats.bytesProgrammed, flashStats.verifyFailures);
+  out.printf("  flashUpdate: %lu sectors unchanged, %lu programmed without erase\n",
+             flashStats.sectorsUnchanged, flashStats.sectorsProgramOnly);
+  out.printf("  longest interrupt-off window: erase %lu us, program %lu us, %llu us in total\n",
+             flashStats.maxEraseLockUs, flashStats.maxProgramLockUs, flashStats.lockedUs);
+}
+
+#endif // FLASH_IO_H
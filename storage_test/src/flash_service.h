@@ -0,0 +1,229 @@
+#ifndef FLASH_SERVICE_H
+#define FLASH_SERVICE_H
+
+#include <Arduino.h>
+#include <pico/critical_section.h>
+#include "log_store.h"
+#include "block_compress.h"
+
+// Background writer for a LogStore. submit() copies the value into a RAM
+// queue and returns at once, poll() does the flash work one step at a time:
+// a queued append if there is one, otherwise erasing a free sector ahead of
+// the head. Call poll() from loop() when there is time, or keep core1
+// running it. Completion callbacks run from poll(), on whichever core that
+// is, unless begin() was asked to defer them. Deferred callbacks wait until
+// dispatch() runs them on the core that calls it.
+//
+// Only poll() touches the store once begin() has been called. To read from
+// the store while poll() runs on the other core, pause() first and resume()
+// after. flush() alone isn't enough, erase-ahead carries on without writes.
+
+#define WRITE_QUEUE_SLOTS 16
+#define WRITE_QUEUE_BYTES 4096
+#define ERASE_AHEAD_SECTORS 4
+
+typedef void (*WriteCallback)(bool success, void* context);
+
+struct QueuedWrite {
+  uint16_t key;
+  uint32_t offset;       // Start of the value in the data ring
+  uint32_t size;
+  unsigned long queuedUs;
+  bool compress;         // Block compressed on the way into the store
+  WriteCallback callback;
+  void* context;
+};
+
+class FlashService {
+private:
+  LogStore* store = NULL;
+  critical_section_t lock;
+  volatile bool started = false;
+  volatile bool busy = false;    // poll() is working on the store
+  volatile bool paused = false;  // poll() leaves the store alone
+  bool deferCallbacks = false;
+
+  QueuedWrite slots[WRITE_QUEUE_SLOTS];
+  uint8_t slotHead = 0;          // Next slot to fill
+  uint8_t slotTail = 0;          // Oldest queued write
+  volatile uint8_t slotCount = 0;
+
+  // Values are kept whole, a value that doesn't fit before the end of the
+  // ring starts over at 0
+  uint8_t data[WRITE_QUEUE_BYTES];
+  uint32_t dataHead = 0;
+  uint32_t dataTail = 0;
+  uint32_t dataUsed = 0;         // Including space skipped at the end
+
+  // Finished writes whose callback waits for dispatch()
+  QueuedWrite done[WRITE_QUEUE_SLOTS];
+  bool doneSuccess[WRITE_QUEUE_SLOTS];
+  uint8_t doneHead = 0;
+  uint8_t doneTail = 0;
+  volatile uint8_t doneCount = 0;
+
+  // Statistics
+  unsigned long writesQueued = 0;
+  unsigned long writesDone = 0;
+  unsigned long writesFailed = 0;
+  unsigned long queueFull = 0;
+  unsigned long maxQueueUs = 0;  // Longest time from submit to completion
+
+public:
+  FlashService() {
+    critical_section_init(&lock);
+  }
+
+  // Start working on store. Everything before this may use the store
+  // directly. With deferred callbacks the caller runs them with dispatch().
+  void begin(LogStore* logStore, bool deferred = false) {
+    store = logStore;
+    deferCallbacks = deferred;
+    started = true;
+  }
+
+  // Queue a value for key, to be block compressed when it is appended if
+  // compress is set. Returns false without waiting if the queue is full or
+  // the value is larger than the queue.
+  bool submit(uint16_t key, const void* value, uint32_t size,
+              WriteCallback callback = NULL, void* context = NULL, bool compress = false) {
+    critical_section_enter_blocking(&lock);
+    uint32_t offset = dataHead;
+    uint32_t skipped = 0;
+    if (offset + size > WRITE_QUEUE_BYTES) {
+      skipped = WRITE_QUEUE_BYTES - offset;
+      offset = 0;
+    }
+    if (slotCount == WRITE_QUEUE_SLOTS || dataUsed + skipped + size > WRITE_QUEUE_BYTES) {
+      queueFull++;
+      critical_section_exit(&lock);
+      return false;
+    }
+
+    QueuedWrite& write = slots[slotHead];
+    write.key = key;
+    write.offset = offset;
+    write.size = size;
+    write.queuedUs = micros();
+    write.compress = compress;
+    write.callback = callback;
+    write.context = context;
+    if (size > 0) memcpy(data + offset, value, size);
+
+    dataHead = offset + size;
+    dataUsed += skipped + size;
+    slotHead = (slotHead + 1) % WRITE_QUEUE_SLOTS;
+    slotCount++;
+    writesQueued++;
+    critical_section_exit(&lock);
+    return true;
+  }
+
+  // Do one step of flash work. Returns true if something was done.
+  bool poll() {
+    if (!started) return false;
+
+    critical_section_enter_blocking(&lock);
+    // A write isn't taken while its callback would have nowhere to wait
+    bool haveWrite = slotCount > 0 && doneCount < WRITE_QUEUE_SLOTS;
+    QueuedWrite write;
+    if (paused) {
+      critical_section_exit(&lock);
+      return false;
+    }
+    if (haveWrite) write = slots[slotTail];
+    busy = true;
+    critical_section_exit(&lock);
+
+    if (!haveWrite) {
+      bool erased = store->eraseAhead(ERASE_AHEAD_SECTORS);
+      busy = false;
+      return erased;
+    }
+
+    // The value stays in the ring until the append is done
+    bool success = write.compress ? appendCompressed(*store, write.key, data + write.offset, write.size)
+                                  : store->append(write.key, data + write.offset, write.size);
+    unsigned long queuedFor = micros() - write.queuedUs;
+
+    critical_section_enter_blocking(&lock);
+    uint32_t end = write.offset + write.size;
+    // Give back the value and whatever was skipped before it
+    dataUsed -= (write.offset < dataTail ? WRITE_QUEUE_BYTES - dataTail : write.offset - dataTail) + write.size;
+    dataTail = end;
+    if (slotCount == 1) {
+      dataHead = dataTail = dataUsed = 0;
+    }
+    slotTail = (slotTail + 1) % WRITE_QUEUE_SLOTS;
+    slotCount--;
+    busy = false;
+    if (success) writesDone++; else writesFailed++;
+    if (queuedFor > maxQueueUs) maxQueueUs = queuedFor;
+    bool defer = deferCallbacks && write.callback;
+    if (defer) {
+      done[doneHead] = write;
+      doneSuccess[doneHead] = success;
+      doneHead = (doneHead + 1) % WRITE_QUEUE_SLOTS;
+      doneCount++;
+    }
+    critical_section_exit(&lock);
+
+    if (write.callback && !defer) write.callback(success, write.context);
+    return true;
+  }
+
+  // Run the deferred callbacks of finished writes. Returns how many ran.
+  uint8_t dispatch() {
+    uint8_t ran = 0;
+    while (doneCount > 0) {
+      critical_section_enter_blocking(&lock);
+      QueuedWrite write = done[doneTail];
+      bool success = doneSuccess[doneTail];
+      doneTail = (doneTail + 1) % WRITE_QUEUE_SLOTS;
+      doneCount--;
+      critical_section_exit(&lock);
+
+      write.callback(success, write.context);
+      ran++;
+    }
+    return ran;
+  }
+
+  // Keep poll() off the store until resume(). Waits for the step poll() is
+  // in, so the store can be read from this core afterwards.
+  void pause() {
+    critical_section_enter_blocking(&lock);
+    paused = true;
+    critical_section_exit(&lock);
+    while (busy) {
+    }
+  }
+
+  void resume() {
+    paused = false;
+  }
+
+  uint8_t pending() { return slotCount; }
+
+  // Wait until every queued write is done. Runs poll() itself unless core1
+  // is doing that. Deferred callbacks run from here as well, a full list
+  // of them would hold up the queue.
+  void flush(bool pollHere = true) {
+    while (slotCount > 0 || busy) {
+      if (deferCallbacks) dispatch();
+      if (pollHere) poll();
+    }
+    if (deferCallbacks) dispatch();
+  }
+
+  void printInfo(Print& out) {
+    out.printf("Flash service: %lu writes queued, %lu done, %lu failed, %lu rejected as full\n",
+               writesQueued, writesDone, writesFailed, queueFull);
+    out.printf("  %u pending, longest from submit to done %lu us\n",
+               slotCount, maxQueueUs);
+  }
+};
+
+FlashService flashService;
+
+#endif // FLASH_SERVICE_H
@@ -0,0 +1,887 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include <Arduino.h>
+#include "flash_io.h"
+#include "crc32.h"
+
+// Log-structured record store on a ring of flash sectors.
+//
+// Every sector starts with a header carrying a sector sequence number that
+// grows by one for each sector opened. Records are appended behind it into
+// erased flash, each with a record sequence number and a CRC, so writing
+// never erases. A value is stored under a small key and may be split into
+// parts across sectors. The newest value with all its parts intact wins.
+//
+// Mount finds the sector with the highest sequence, walks back through the
+// contiguous run of sectors before it and replays their records. A record
+// torn by power loss fails its CRC and is ignored along with the rest of
+// its value, the previous value of that key is still there.
+//
+// When free sectors run low the oldest sector is reclaimed. Values whose
+// newest copy starts there are appended again at the head, and the sector
+// joins the free ones. Free sectors are erased ahead of use by eraseAhead(),
+// called when there is time for it, so an append normally only programs
+// pages. A sector that is still dirty when the head reaches it is erased
+// then. Since the ring moves through every sector in turn, wear is spread
+// evenly.
+//
+// Each sector header carries how often the sector was erased and how many
+// program failures it had. Right after an erase the header is written with
+// these counts and the sequence and CRC left erased. Opening the sector
+// later only programs those two fields, so the counts survive without a
+// separate table. wear() and printWear() report them.
+
+#define LOG_SECTOR_MAGIC 0x474C5052   // 'RPLG'
+#define LOG_SECTOR_VERSION 2
+#define LOG_FREE_SEQUENCE 0xFFFFFFFF  // Sequence of an erased sector not opened yet
+#define LOG_RECORD_MAGIC 0x5243       // 'CR'
+#define LOG_MAX_KEYS 16
+// Set in the key of every part of a value stored block compressed, see
+// block_compress.h. Older records never have it.
+#define LOG_VALUE_COMPRESSED 0x8000
+#define LOG_KEY_MASK 0x7FFF
+
+struct LogSectorHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;
+  uint32_t eraseCount;   // Erases of this sector, written right after each one
+  uint16_t programFailures;
+  uint16_t reserved;
+  uint32_t sequence;     // Grows by one for every sector opened
+  uint32_t crc;          // CRC32 of the fields above
+};
+
+// Failures seen in sectors that weren't erased since, added to the header
+// on the next erase
+#define LOG_FAILURE_SLOTS 8
+
+struct LogSectorFailures {
+  uint32_t sector;
+  uint16_t count;
+};
+
+// Erase counts over all sectors of the store
+struct LogWearStats {
+  uint32_t sectors;
+  uint32_t minErases;
+  uint32_t maxErases;
+  uint32_t maxSector;            // Most erased sector
+  unsigned long long totalErases;
+  uint32_t programFailures;
+  uint32_t failingSectors;       // Sectors with at least one failure
+};
+
+struct LogRecordHeader {
+  uint16_t magic;        // LOG_RECORD_MAGIC, erased flash reads 0xFFFF
+  uint16_t key;          // LOG_VALUE_COMPRESSED added for a compressed value
+  uint16_t length;       // Payload bytes after the header
+  uint8_t part;          // Index of this part of the value
+  uint8_t parts;         // Number of parts in the value
+  uint32_t sequence;     // Grows by one for every record in the store
+  uint32_t crc;          // CRC32 of the fields above and the payload
+};
+
+// Records start on 4 byte boundaries
+#define LOG_ALIGN 4
+const uint32_t LOG_FIRST_RECORD = (sizeof(LogSectorHeader) + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+const uint32_t LOG_MAX_PART = FLASH_SECTOR_SIZE - LOG_FIRST_RECORD - sizeof(LogRecordHeader);
+
+// Don't start a part in less room than this, open the next sector instead
+const uint32_t LOG_MIN_PART = 64;
+
+// Newest complete value of a key
+struct LogValue {
+  uint32_t position;     // First record, as a byte position in the store
+  uint32_t size;
+  uint32_t sequence;     // Sequence of the first record, 0 if the key has no value
+  uint8_t parts;
+  uint16_t flags;        // LOG_VALUE_COMPRESSED or 0
+};
+
+uint32_t logRecordCrc(const LogRecordHeader* header, const uint8_t* payload) {
+  uint32_t crc = crc32Update(CRC32_INIT, (const uint8_t*)header, offsetof(LogRecordHeader, crc));
+  return crc32Final(crc32Update(crc, payload, header->length));
+}
+
+// Where writeValue() takes a value from when it isn't in RAM in one piece
+class LogValueSource {
+public:
+  virtual size_t read(uint8_t* out, size_t size) = 0;
+};
+
+// A run of bytes read in place through the XIP window
+struct FlashSpan {
+  const uint8_t* data;
+  uint32_t size;
+};
+
+// A stored value, read in place. The value may be split into parts across
+// sectors, nextSpan() hands them out one contiguous span at a time without
+// copying. read() copies instead, both continue where the other left off.
+class LogValueView : public LogValueSource {
+private:
+  uint32_t baseOffset = 0;
+  uint32_t sectorCount = 0;
+  uint32_t first = 0;            // First record of the value
+  uint32_t position = 0;         // Current record
+  uint32_t partOffset = 0;       // Bytes of the current part already read
+  uint32_t remaining = 0;
+  uint32_t valueSize = 0;
+  uint8_t parts = 0;
+  uint16_t flags = 0;
+
+  const LogRecordHeader* record() {
+    return (const LogRecordHeader*)flashData(baseOffset + position);
+  }
+
+  const uint8_t* payload() {
+    return flashData(baseOffset + position) + sizeof(LogRecordHeader);
+  }
+
+  // Parts are consecutive records, the next one follows directly or opens
+  // the next sector
+  void nextRecord() {
+    uint32_t within = position % FLASH_SECTOR_SIZE;
+    uint32_t next = within + ((sizeof(LogRecordHeader) + record()->length + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1));
+    if (next + sizeof(LogRecordHeader) > FLASH_SECTOR_SIZE ||
+        ((const LogRecordHeader*)flashData(baseOffset + position - within + next))->magic != LOG_RECORD_MAGIC) {
+      uint32_t sector = (position / FLASH_SECTOR_SIZE + 1) % sectorCount;
+      position = sector * FLASH_SECTOR_SIZE + LOG_FIRST_RECORD;
+    } else {
+      position += next - within;
+    }
+    partOffset = 0;
+  }
+
+public:
+  void begin(uint32_t storeOffset, uint32_t sectors, const LogValue& value) {
+    baseOffset = storeOffset;
+    sectorCount = sectors;
+    first = value.position;
+    valueSize = value.sequence ? value.size : 0;
+    parts = value.sequence ? value.parts : 0;
+    flags = value.sequence ? value.flags : 0;
+    rewind();
+  }
+
+  void rewind() {
+    position = first;
+    partOffset = 0;
+    remaining = valueSize;
+  }
+
+  uint32_t size() { return valueSize; }
+  uint32_t available() { return remaining; }
+  // Stored block compressed, read it through a CompressedReader
+  bool compressed() { return flags & LOG_VALUE_COMPRESSED; }
+
+  // The rest of the current part, then the following parts
+  bool nextSpan(FlashSpan* span) {
+    while (remaining > 0) {
+      if (partOffset == record()->length) {
+        nextRecord();
+        continue;
+      }
+      span->data = payload() + partOffset;
+      span->size = min(record()->length - partOffset, remaining);
+      partOffset += span->size;
+      remaining -= span->size;
+      return true;
+    }
+    return false;
+  }
+
+  size_t read(uint8_t* out, size_t size) override {
+    size_t done = 0;
+    while (done < size && remaining > 0) {
+      if (partOffset == record()->length) {
+        nextRecord();
+        continue;
+      }
+      size_t chunk = min((size_t)(record()->length - partOffset), size - done);
+      memcpy(out + done, payload() + partOffset, chunk);
+      partOffset += chunk;
+      done += chunk;
+      remaining -= chunk;
+    }
+    return done;
+  }
+
+  // Move ahead size bytes without copying them
+  size_t skip(size_t size) {
+    size_t done = 0;
+    while (done < size && remaining > 0) {
+      if (partOffset == record()->length) {
+        nextRecord();
+        continue;
+      }
+      size_t chunk = min((size_t)(record()->length - partOffset), size - done);
+      partOffset += chunk;
+      done += chunk;
+      remaining -= chunk;
+    }
+    return done;
+  }
+
+  // The value as a T in flash, or NULL unless it is exactly one T in one
+  // part. Payloads are 4 byte aligned.
+  template <typename T>
+  const T* as() {
+    static_assert(alignof(T) <= LOG_ALIGN, "type needs more alignment than records have");
+    if (parts != 1 || valueSize != sizeof(T)) return NULL;
+    return (const T*)(flashData(baseOffset + first) + sizeof(LogRecordHeader));
+  }
+};
+
+// Walks every record still in the log, oldest first, in place in flash.
+// Records that fail their CRC end the sector they are in, as on mount.
+class LogRecordIterator {
+private:
+  uint32_t baseOffset = 0;
+  uint32_t sectorCount = 0;
+  uint32_t sector = 0;
+  uint32_t sectorsLeft = 0;      // Including the current one
+  uint32_t pos = 0;              // Next record in the current sector
+  uint32_t headEnd = 0;          // End of the records in the head sector
+
+public:
+  void begin(uint32_t storeOffset, uint32_t sectors, uint32_t tail, uint32_t used, uint32_t headWritePos) {
+    baseOffset = storeOffset;
+    sectorCount = sectors;
+    sector = tail;
+    sectorsLeft = used;
+    pos = LOG_FIRST_RECORD;
+    headEnd = headWritePos;
+  }
+
+  bool next(const LogRecordHeader** header, FlashSpan* payload) {
+    while (sectorsLeft > 0) {
+      uint32_t end = (sectorsLeft == 1) ? headEnd : FLASH_SECTOR_SIZE;
+      const LogRecordHeader* record = (const LogRecordHeader*)flashData(baseOffset + sector * FLASH_SECTOR_SIZE + pos);
+      const uint8_t* data = (const uint8_t*)record + sizeof(LogRecordHeader);
+
+      if (pos + sizeof(LogRecordHeader) > end || record->magic != LOG_RECORD_MAGIC ||
+          record->length > FLASH_SECTOR_SIZE - pos - sizeof(LogRecordHeader) ||
+          record->crc != logRecordCrc(record, data)) {
+        sector = (sector + 1) % sectorCount;
+        sectorsLeft--;
+        pos = LOG_FIRST_RECORD;
+        continue;
+      }
+
+      *header = record;
+      payload->data = data;
+      payload->size = record->length;
+      pos += (sizeof(LogRecordHeader) + record->length + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+      return true;
+    }
+    return false;
+  }
+};
+
+class LogStore {
+private:
+  uint32_t baseOffset = 0;       // Flash offset of sector 0
+  uint32_t sectorCount = 0;
+  bool mounted = false;
+
+  uint32_t tailSector = 0;       // Oldest sector in use
+  uint32_t headSector = 0;       // Sector being appended to
+  uint32_t usedSectors = 0;      // Sectors from tail to head, 0 when empty
+  uint32_t headSequence = 0;
+  uint32_t writePos = FLASH_SECTOR_SIZE;   // Next record in the head sector, sector size when full
+  uint32_t nextRecordSequence = 1;
+  uint32_t erasedAhead = 0;      // Free sectors after the head known to be erased
+  LogValue values[LOG_MAX_KEYS];
+
+  // Statistics
+  unsigned long recordsAppended = 0;
+  unsigned long valuesAppended = 0;
+  unsigned long valuesUnchanged = 0;
+  unsigned long valuesRelocated = 0;
+  unsigned long sectorsReclaimed = 0;
+  unsigned long tornRecords = 0;
+  unsigned long erasesAhead = 0;
+  unsigned long erasesInline = 0;
+  unsigned long long bytesStored = 0;        // Appended by callers
+  unsigned long long bytesProgrammed = 0;    // Everything programmed, headers and moved values too
+  LogSectorFailures failures[LOG_FAILURE_SLOTS];
+
+  uint32_t sectorOffset(uint32_t sector) {
+    return baseOffset + sector * FLASH_SECTOR_SIZE;
+  }
+
+  static uint32_t alignUp(uint32_t n) {
+    return (n + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+  }
+
+  const LogSectorHeader* sectorHeader(uint32_t sector) {
+    return (const LogSectorHeader*)flashData(sectorOffset(sector));
+  }
+
+  // Header counts are readable from opened and prepared sectors alike
+  bool hasCounts(uint32_t sector) {
+    return sectorHeader(sector)->magic == LOG_SECTOR_MAGIC &&
+           sectorHeader(sector)->version == LOG_SECTOR_VERSION;
+  }
+
+  // Erased with a fresh header, ready to be opened
+  bool isPrepared(uint32_t sector) {
+    const LogSectorHeader* header = sectorHeader(sector);
+    return hasCounts(sector) && header->sequence == LOG_FREE_SEQUENCE && header->crc == 0xFFFFFFFF &&
+           flashIsErased(sectorOffset(sector) + sizeof(LogSectorHeader), FLASH_SECTOR_SIZE - sizeof(LogSectorHeader));
+  }
+
+  uint16_t pendingFailures(uint32_t sector) {
+    for (int i = 0; i < LOG_FAILURE_SLOTS; i++) {
+      if (failures[i].count && failures[i].sector == sector) return failures[i].count;
+    }
+    return 0;
+  }
+
+  void recordFailure(uint32_t sector) {
+    int slot = 0;
+    for (int i = 0; i < LOG_FAILURE_SLOTS; i++) {
+      if (failures[i].count && failures[i].sector == sector) {
+        slot = i;
+        break;
+      }
+      if (failures[i].count == 0 || failures[i].count < failures[slot].count) slot = i;
+    }
+    if (failures[slot].sector != sector) failures[slot].count = 0;
+    failures[slot].sector = sector;
+    failures[slot].count++;
+  }
+
+  // Write the header of an erased sector with its counts
+  bool writeFreeHeader(uint32_t sector, uint32_t eraseCount, uint16_t programFailures) {
+    LogSectorHeader header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = LOG_SECTOR_MAGIC;
+    header.version = LOG_SECTOR_VERSION;
+    header.headerSize = sizeof(LogSectorHeader);
+    header.eraseCount = eraseCount;
+    header.programFailures = programFailures;
+    bytesProgrammed += offsetof(LogSectorHeader, sequence);
+    return flashProgram(sectorOffset(sector), &header, offsetof(LogSectorHeader, sequence));
+  }
+
+  // Erase a sector and carry its counts over into the new header
+  bool prepareSector(uint32_t sector) {
+    uint32_t eraseCount = 0;
+    uint32_t programFailures = pendingFailures(sector);
+    if (hasCounts(sector)) {
+      eraseCount = sectorHeader(sector)->eraseCount;
+      programFailures += sectorHeader(sector)->programFailures;
+    }
+
+    bool erased = flashEraseSector(sectorOffset(sector));
+    if (!erased) programFailures++;
+    for (int i = 0; i < LOG_FAILURE_SLOTS; i++) {
+      if (failures[i].sector == sector) failures[i].count = 0;
+    }
+    // Even a failed erase leaves the count behind if it can
+    bool written = writeFreeHeader(sector, eraseCount + 1, min(programFailures, (uint32_t)0xFFFF));
+    return erased && written;
+  }
+
+  // Make a free sector ready to open. Returns false if that failed, sets
+  // *erased if it took an erase.
+  bool readySector(uint32_t sector, bool* erased) {
+    *erased = false;
+    if (isPrepared(sector)) return true;
+    if (flashIsErased(sectorOffset(sector), FLASH_SECTOR_SIZE)) {
+      // Never used, or erased before the header could be written
+      return writeFreeHeader(sector, 0, 0);
+    }
+    *erased = true;
+    return prepareSector(sector);
+  }
+
+  bool readSectorHeader(uint32_t sector, LogSectorHeader* header) {
+    memcpy(header, flashData(sectorOffset(sector)), sizeof(LogSectorHeader));
+    return header->magic == LOG_SECTOR_MAGIC &&
+           header->version == LOG_SECTOR_VERSION &&
+           header->crc == calculateCRC32((const uint8_t*)header, offsetof(LogSectorHeader, crc));
+  }
+
+  // Replay the records of one sector. Returns where appending would continue,
+  // or the sector size if the sector is full or holds a torn record.
+  uint32_t scanSector(uint32_t sector, LogValue* pending, uint16_t* pendingKey, uint32_t* lastSequence) {
+    uint32_t pos = LOG_FIRST_RECORD;
+    while (pos + sizeof(LogRecordHeader) <= FLASH_SECTOR_SIZE) {
+      const LogRecordHeader* header = (const LogRecordHeader*)flashData(sectorOffset(sector) + pos);
+      if (header->magic == 0xFFFF) {
+        // Free space must be fully erased, or a write was cut short here
+        return flashIsErased(sectorOffset(sector) + pos, FLASH_SECTOR_SIZE - pos) ? pos : FLASH_SECTOR_SIZE;
+      }
+
+      const uint8_t* payload = (const uint8_t*)header + sizeof(LogRecordHeader);
+      if (header->magic != LOG_RECORD_MAGIC ||
+          header->length > FLASH_SECTOR_SIZE - pos - sizeof(LogRecordHeader) ||
+          header->crc != logRecordCrc(header, payload)) {
+        tornRecords++;
+        pending->sequence = 0;
+        return FLASH_SECTOR_SIZE;
+      }
+
+      // A part continues the pending value only if nothing came in between
+      if (header->part == 0) {
+        pending->position = sector * FLASH_SECTOR_SIZE + pos;
+        pending->size = header->length;
+        pending->sequence = header->sequence;
+        pending->parts = header->parts;
+        pending->flags = header->key & ~LOG_KEY_MASK;
+        *pendingKey = header->key;
+      } else if (pending->sequence != 0 && header->key == *pendingKey &&
+                 header->parts == pending->parts &&
+                 header->sequence == *lastSequence + 1 &&
+                 header->part == header->sequence - pending->sequence) {
+        pending->size += header->length;
+      } else {
+        pending->sequence = 0;
+      }
+
+      if (pending->sequence != 0 && header->part == header->parts - 1) {
+        uint16_t key = *pendingKey & LOG_KEY_MASK;
+        if (key < LOG_MAX_KEYS) values[key] = *pending;
+        pending->sequence = 0;
+      }
+
+      *lastSequence = header->sequence;
+      if (header->sequence >= nextRecordSequence) nextRecordSequence = header->sequence + 1;
+      pos += alignUp(sizeof(LogRecordHeader) + header->length);
+    }
+    return FLASH_SECTOR_SIZE;
+  }
+
+  // Start appending to the next sector in the ring
+  bool openSector() {
+    if (usedSectors >= sectorCount) {
+      Serial.println("ERROR: Log store is full");
+      return false;
+    }
+
+    uint32_t sector = (headSector + 1) % sectorCount;
+    if (erasedAhead > 0) {
+      erasedAhead--;
+    } else {
+      // A reclaimed sector eraseAhead() didn't get to yet
+      bool erased;
+      if (!readySector(sector, &erased)) return false;
+      if (erased) erasesInline++;
+    }
+
+    // Only the sequence and CRC are left to program
+    LogSectorHeader header;
+    memcpy(&header, sectorHeader(sector), sizeof(header));
+    header.sequence = headSequence + 1;
+    header.crc = calculateCRC32((const uint8_t*)&header, offsetof(LogSectorHeader, crc));
+    bytesProgrammed += sizeof(header) - offsetof(LogSectorHeader, sequence);
+    if (!flashProgram(sectorOffset(sector) + offsetof(LogSectorHeader, sequence), &header.sequence,
+                      sizeof(header) - offsetof(LogSectorHeader, sequence))) {
+      recordFailure(sector);
+      return false;
+    }
+
+    if (usedSectors == 0) tailSector = sector;
+    headSector = sector;
+    headSequence = header.sequence;
+    usedSectors++;
+    writePos = LOG_FIRST_RECORD;
+    return true;
+  }
+
+  // Room for a part at pos, or 0 if a new sector should be opened
+  static uint32_t partRoom(uint32_t pos, uint32_t remaining) {
+    if (pos + sizeof(LogRecordHeader) >= FLASH_SECTOR_SIZE) return 0;
+    uint32_t room = FLASH_SECTOR_SIZE - pos - sizeof(LogRecordHeader);
+    return room >= min(remaining, LOG_MIN_PART) ? room : 0;
+  }
+
+  // Number of parts a value of size bytes is split into when appended now
+  uint32_t partsFor(uint32_t size) {
+    uint32_t pos = writePos;
+    uint32_t parts = 0;
+    do {
+      uint32_t room = partRoom(pos, size);
+      if (room == 0) {
+        pos = LOG_FIRST_RECORD;
+        room = partRoom(pos, size);
+      }
+      uint32_t chunk = min(size, room);
+      size -= chunk;
+      pos = alignUp(pos + sizeof(LogRecordHeader) + chunk);
+      parts++;
+    } while (size > 0);
+    return parts;
+  }
+
+  // Worst case sectors needed for size bytes of values
+  static uint32_t sectorsFor(uint32_t size) {
+    return (size + LOG_MAX_PART - LOG_MIN_PART - 1) / (LOG_MAX_PART - LOG_MIN_PART) + 1;
+  }
+
+  // Nothing more goes into a head sector that failed to program, the next
+  // append opens a new one
+  bool programFailed() {
+    recordFailure(headSector);
+    writePos = FLASH_SECTOR_SIZE;
+    return false;
+  }
+
+  // Append a value from RAM, or from source when data is NULL. Payload goes
+  // first and the header last, so a cut off append leaves no valid record
+  // behind.
+  bool writeValue(uint16_t key, uint32_t size, const uint8_t* data, LogValueSource* source,
+                  uint16_t flags = 0) {
+    uint32_t parts = partsFor(size);
+    if (parts > 255) {
+      Serial.printf("ERROR: Value of %u bytes needs too many parts\n", size);
+      return false;
+    }
+
+    LogValue written;
+    written.size = size;
+    written.parts = parts;
+    written.flags = flags;
+    written.sequence = nextRecordSequence;
+
+    uint32_t remaining = size;
+    for (uint32_t part = 0; part < parts; part++) {
+      uint32_t room = partRoom(writePos, remaining);
+      if (room == 0) {
+        if (!openSector()) return false;
+        room = partRoom(writePos, remaining);
+      }
+
+      LogRecordHeader header;
+      header.magic = LOG_RECORD_MAGIC;
+      header.key = key | flags;
+      header.length = min(remaining, room);
+      header.part = part;
+      header.parts = parts;
+      header.sequence = nextRecordSequence++;
+
+      uint32_t recordOffset = sectorOffset(headSector) + writePos;
+      uint32_t crc = crc32Update(CRC32_INIT, (const uint8_t*)&header, offsetof(LogRecordHeader, crc));
+      if (data) {
+        const uint8_t* payload = data + (size - remaining);
+        crc = crc32Update(crc, payload, header.length);
+        if (!flashProgram(recordOffset + sizeof(header), payload, header.length)) return programFailed();
+      } else {
+        // Taken from the source a page at a time
+        uint8_t chunk[FLASH_PAGE_SIZE];
+        for (uint32_t done = 0; done < header.length; ) {
+          size_t got = source->read(chunk, min((uint32_t)sizeof(chunk), header.length - done));
+          if (got == 0) return false;
+          crc = crc32Update(crc, chunk, got);
+          if (!flashProgram(recordOffset + sizeof(header) + done, chunk, got)) return programFailed();
+          done += got;
+        }
+      }
+      header.crc = crc32Final(crc);
+      if (!flashProgram(recordOffset, &header, sizeof(header))) return programFailed();
+      bytesProgrammed += sizeof(header) + header.length;
+
+      if (part == 0) written.position = headSector * FLASH_SECTOR_SIZE + writePos;
+      writePos = alignUp(writePos + sizeof(header) + header.length);
+      remaining -= header.length;
+      recordsAppended++;
+    }
+
+    if (key < LOG_MAX_KEYS) values[key] = written;
+    return true;
+  }
+
+  // True if key already holds exactly these bytes
+  bool valueEquals(uint16_t key, const uint8_t* data, uint32_t size) {
+    if (values[key].sequence == 0 || values[key].flags != 0 || values[key].size != size) return false;
+    LogValueView reader;
+    reader.begin(baseOffset, sectorCount, values[key]);
+    uint8_t chunk[64];
+    for (uint32_t done = 0; done < size; ) {
+      size_t got = reader.read(chunk, min((uint32_t)sizeof(chunk), size - done));
+      if (got == 0 || memcmp(chunk, data + done, got) != 0) return false;
+      done += got;
+    }
+    return true;
+  }
+
+  uint32_t liveBytes() {
+    uint32_t total = 0;
+    for (int key = 0; key < LOG_MAX_KEYS; key++) {
+      if (values[key].sequence) total += values[key].size;
+    }
+    return total;
+  }
+
+  // Move the live values out of the oldest sector and free it. It is erased
+  // later, until then mount still sees it as older history.
+  bool reclaimOldest() {
+    uint32_t sector = tailSector;
+    for (int key = 0; key < LOG_MAX_KEYS; key++) {
+      if (values[key].sequence && values[key].position / FLASH_SECTOR_SIZE == sector) {
+        LogValueView source;
+        source.begin(baseOffset, sectorCount, values[key]);
+        if (!writeValue(key, values[key].size, NULL, &source, values[key].flags)) return false;
+        valuesRelocated++;
+      }
+    }
+
+    tailSector = (sector + 1) % sectorCount;
+    usedSectors--;
+    sectorsReclaimed++;
+    return true;
+  }
+
+  // Prepared sectors right after the head are ready to open
+  void countPrepared() {
+    erasedAhead = 0;
+    while (erasedAhead < sectorCount - usedSectors &&
+           isPrepared((headSector + 1 + erasedAhead) % sectorCount)) {
+      erasedAhead++;
+    }
+  }
+
+  // Reclaim until a value of size bytes fits with room left to move every
+  // live value once more
+  bool ensureSpace(uint32_t size) {
+    // Moving values uses sectors too, so give up after one pass of the ring
+    uint32_t needed = sectorsFor(size) + sectorsFor(liveBytes());
+    for (uint32_t i = 0; i < sectorCount && sectorCount - usedSectors < needed && usedSectors > 1; i++) {
+      if (!reclaimOldest()) return false;
+    }
+    if (sectorCount - usedSectors < sectorsFor(size)) {
+      Serial.printf("ERROR: No room for a value of %u bytes\n", size);
+      return false;
+    }
+    return true;
+  }
+
+public:
+  // Mount the store on sectors flash sectors starting at offset. Finds the
+  // newest state, nothing is written.
+  bool begin(uint32_t offset, uint32_t sectors) {
+    if (offset % FLASH_SECTOR_SIZE != 0 || sectors < 4) {
+      Serial.println("ERROR: Log store region must be sector aligned and at least 4 sectors");
+      return false;
+    }
+    baseOffset = offset;
+    sectorCount = sectors;
+    memset(values, 0, sizeof(values));
+    nextRecordSequence = 1;
+    erasedAhead = 0;
+    tornRecords = 0;
+    memset(failures, 0, sizeof(failures));
+
+    // The head is the sector with the highest sequence
+    bool found = false;
+    LogSectorHeader header;
+    for (uint32_t sector = 0; sector < sectorCount; sector++) {
+      if (readSectorHeader(sector, &header) && (!found || header.sequence > headSequence)) {
+        found = true;
+        headSector = sector;
+        headSequence = header.sequence;
+      }
+    }
+
+    if (!found) {
+      // Empty store, the first append opens sector 0
+      headSector = sectorCount - 1;
+      headSequence = 0;
+      usedSectors = 0;
+      writePos = FLASH_SECTOR_SIZE;
+      countPrepared();
+      mounted = true;
+      return true;
+    }
+
+    // Older sectors in use directly precede the head
+    tailSector = headSector;
+    usedSectors = 1;
+    uint32_t sequence = headSequence;
+    while (usedSectors < sectorCount) {
+      uint32_t previous = (tailSector + sectorCount - 1) % sectorCount;
+      if (!readSectorHeader(previous, &header) || header.sequence != sequence - 1) break;
+      tailSector = previous;
+      sequence--;
+      usedSectors++;
+    }
+
+    LogValue pending;
+    uint16_t pendingKey = 0;
+    uint32_t lastSequence = 0;
+    pending.sequence = 0;
+    for (uint32_t i = 0; i < usedSectors; i++) {
+      uint32_t sector = (tailSector + i) % sectorCount;
+      writePos = scanSector(sector, &pending, &pendingKey, &lastSequence);
+    }
+
+    countPrepared();
+    mounted = true;
+    return true;
+  }
+
+  // Drop everything by erasing the sectors in use, keeping their counts
+  bool format() {
+    for (uint32_t sector = 0; sector < sectorCount; sector++) {
+      LogSectorHeader header;
+      if (readSectorHeader(sector, &header) && !prepareSector(sector)) {
+        return false;
+      }
+    }
+    return begin(baseOffset, sectorCount);
+  }
+
+  // Store a new value for key. The previous value stays readable until the
+  // new one is complete. Writing the value the key already holds is skipped
+  // and sets *unchanged.
+  bool append(uint16_t key, const void* data, uint32_t size, bool* unchanged = NULL) {
+    if (!mounted || key >= LOG_MAX_KEYS) return false;
+    bool same = valueEquals(key, (const uint8_t*)data, size);
+    if (unchanged) *unchanged = same;
+    if (same) {
+      valuesUnchanged++;
+      return true;
+    }
+    if (!ensureSpace(size)) return false;
+    if (!writeValue(key, size, (const uint8_t*)data, NULL)) return false;
+    valuesAppended++;
+    bytesStored += size;
+    return true;
+  }
+
+  // Store a value of size bytes for key as source hands it out, with flags
+  // in its records. Nothing is compared with the previous value.
+  bool appendStream(uint16_t key, LogValueSource* source, uint32_t size, uint16_t flags = 0) {
+    if (!mounted || key >= LOG_MAX_KEYS) return false;
+    if (!ensureSpace(size)) return false;
+    if (!writeValue(key, size, NULL, source, flags)) return false;
+    valuesAppended++;
+    bytesStored += size;
+    return true;
+  }
+
+  // Size of the newest value of key, or false if there is none
+  bool valueSize(uint16_t key, uint32_t* size) {
+    if (!mounted || key >= LOG_MAX_KEYS || values[key].sequence == 0) return false;
+    *size = values[key].size;
+    return true;
+  }
+
+  // View the newest value of key in place
+  bool view(uint16_t key, LogValueView* view) {
+    if (!mounted || key >= LOG_MAX_KEYS || values[key].sequence == 0) return false;
+    view->begin(baseOffset, sectorCount, values[key]);
+    return true;
+  }
+
+  // Iterate over all records still in the log, including older values
+  void records(LogRecordIterator* iterator) {
+    iterator->begin(baseOffset, sectorCount, tailSector, mounted ? usedSectors : 0, writePos);
+  }
+
+  // Copy up to maxSize bytes of the newest value of key
+  bool read(uint16_t key, void* data, uint32_t maxSize, uint32_t* actualSize) {
+    if (!mounted || key >= LOG_MAX_KEYS || values[key].sequence == 0) return false;
+    LogValueView reader;
+    reader.begin(baseOffset, sectorCount, values[key]);
+    *actualSize = reader.read((uint8_t*)data, min(maxSize, values[key].size));
+    return true;
+  }
+
+  uint32_t freeSectors() { return sectorCount - usedSectors; }
+
+  // Make sure up to target free sectors after the head are erased. Does at
+  // most one erase per call, returns true if there may be more to do.
+  bool eraseAhead(uint32_t target) {
+    if (!mounted || erasedAhead >= min(target, freeSectors())) return false;
+
+    uint32_t sector = (headSector + 1 + erasedAhead) % sectorCount;
+    bool erased;
+    if (!readySector(sector, &erased)) return false;
+    if (erased) erasesAhead++;
+    erasedAhead++;
+    return erasedAhead < min(target, freeSectors());
+  }
+
+  // Erase and failure counts as kept in the sector header, sectors without
+  // a header count as never erased
+  uint32_t sectorErases(uint32_t sector, uint16_t* programFailures = NULL) {
+    uint32_t erases = hasCounts(sector) ? sectorHeader(sector)->eraseCount : 0;
+    if (programFailures) {
+      *programFailures = (hasCounts(sector) ? sectorHeader(sector)->programFailures : 0) + pendingFailures(sector);
+    }
+    return erases;
+  }
+
+  void wear(LogWearStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->sectors = sectorCount;
+    stats->minErases = 0xFFFFFFFF;
+    for (uint32_t sector = 0; sector < sectorCount; sector++) {
+      uint16_t programFailures;
+      uint32_t erases = sectorErases(sector, &programFailures);
+      if (erases < stats->minErases) stats->minErases = erases;
+      if (erases > stats->maxErases) {
+        stats->maxErases = erases;
+        stats->maxSector = sector;
+      }
+      stats->totalErases += erases;
+      stats->programFailures += programFailures;
+      if (programFailures > 0) stats->failingSectors++;
+    }
+  }
+
+  // Bytes programmed per byte appended since mount, moved values and
+  // headers included
+  float writeAmplification() {
+    return bytesStored > 0 ? (float)bytesProgrammed / bytesStored : 0;
+  }
+
+  void printWear(Print& out) {
+    LogWearStats stats;
+    wear(&stats);
+    out.printf("Wear: erases per sector min %u, mean %llu, max %u (sector %u)\n",
+               stats.minErases, stats.totalErases / stats.sectors, stats.maxErases, stats.maxSector);
+    out.printf("  %u program failures in %u sectors, write amplification %.2f since boot\n",
+               stats.programFailures, stats.failingSectors, writeAmplification());
+  }
+
+  // Wear as one JSON object, with the count of every sector
+  void printWearJson(Print& out) {
+    LogWearStats stats;
+    wear(&stats);
+    out.printf("{\"sectors\":%u,\"minErases\":%u,\"maxErases\":%u,\"maxSector\":%u,\"totalErases\":%llu,"
+               "\"programFailures\":%u,\"failingSectors\":%u,\"bytesStored\":%llu,\"bytesProgrammed\":%llu,"
+               "\"writeAmplification\":%.3f,\"eraseCounts\":[",
+               stats.sectors, stats.minErases, stats.maxErases, stats.maxSector, stats.totalErases,
+               stats.programFailures, stats.failingSectors, bytesStored, bytesProgrammed, writeAmplification());
+    for (uint32_t sector = 0; sector < sectorCount; sector++) {
+      out.printf(sector > 0 ? ",%u" : "%u", sectorErases(sector));
+    }
+    out.println("]}");
+  }
+
+  void printInfo(Print& out) {
+    out.printf("Log store: %u of %u sectors in use (%u to %u), head sequence %u\n",
+               usedSectors, sectorCount, tailSector, headSector, headSequence);
+    out.printf("  next record %u, %lu records and %lu values appended, %lu unchanged values skipped\n",
+               nextRecordSequence, recordsAppended, valuesAppended, valuesUnchanged);
+    out.printf("  %lu torn records skipped at mount\n", tornRecords);
+    out.printf("  %lu sectors reclaimed, %lu values moved\n", sectorsReclaimed, valuesRelocated);
+    out.printf("  %u sectors erased ahead, %lu erases ahead and %lu inline\n",
+               erasedAhead, erasesAhead, erasesInline);
+    for (int key = 0; key < LOG_MAX_KEYS; key++) {
+      if (values[key].sequence) {
+        out.printf("  key %d: %u bytes in %u parts, sequence %u\n",
+                   key, values[key].size, values[key].parts, values[key].sequence);
+      }
+    }
+  }
+};
+
+#endif // LOG_STORE_H
@@ -4,20 +4,30 @@
 #include <Arduino.h>
 #include <hardware/flash.h>
 #include <hardware/sync.h>
+#include "flash_io.h"
+#include "crc32.h"
+#include "log_store.h"
+#include "flash_bench.h"
+#include "flash_service.h"
+#include "block_compress.h"
 
 // Configuration options - TURN THESE OFF AFTER TESTING
-#define FORCE_FORMAT true
+// The log store recovers on mount, so there is no need to format every boot
+#define FORCE_FORMAT false
 #define CONTINUOUS_WRITE_TEST true
+#define CRC_BENCHMARK true
+#define FLASH_BENCHMARK true
+#define BENCH_ITERATIONS 64
+// Run queued writes and erase-ahead on core1 instead of from loop()
+#define FLASH_SERVICE_ON_CORE1 false
+// Compress the data value as it is appended, directly or through the
+// queue. readStorage() reads both kinds.
+#define COMPRESS_DATA true
 
 // SAFETY FIRST: Use a small, fixed portion of flash at a safe location 
 // The RP2040 has program code at the beginning of flash, we'll use a small 
 // section near the end that won't interfere with the program
 
-// Avoid redefining FLASH_SECTOR_SIZE since it's already defined
-#ifndef FLASH_SECTOR_SIZE
-#define FLASH_SECTOR_SIZE 4096
-#endif
-
 // FLASH MEMORY LAYOUT OPTIMIZATION
 // Based on your device's specific memory map:
 
@@ -30,7 +40,8 @@
 #define FLASH_BASE_ADDR 0x10000000
 #define EEPROM_START 0x10b88680
 #define EEPROM_SIZE 0x1000  // Typical size (4KB)
-#define STORAGE_START (EEPROM_START + EEPROM_SIZE)
+// Erase works on whole sectors, so round up to the next sector boundary
+#define STORAGE_START ((EEPROM_START + EEPROM_SIZE + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1))
 
 // Calculate offset from base address
 #define FLASH_TARGET_OFFSET (STORAGE_START - FLASH_BASE_ADDR)
@@ -39,21 +50,19 @@
 #define STORAGE_SECTORS 1024
 #define STORAGE_SIZE (STORAGE_SECTORS * FLASH_SECTOR_SIZE)
 
-// Extended storage header with boot count
-struct StorageHeader {
-  uint32_t magic;        // Magic number to identify our storage
-  uint32_t version;      // Version of the storage format
-  uint32_t dataSize;     // How much actual data is stored
-  uint32_t bootCount;    // Boot counter
-  uint32_t writeCount;   // Number of writes since boot
-  uint32_t crc;          // CRC32 checksum of the data
-};
+// The last few sectors are kept out of the log for the boundary tests and
+// the benchmarks, which need a 64 KB aligned block in there
+#define TEST_SECTORS 32
+#define LOG_SECTORS (STORAGE_SECTORS - TEST_SECTORS)
+#define TEST_TARGET_OFFSET (FLASH_TARGET_OFFSET + LOG_SECTORS * FLASH_SECTOR_SIZE)
 
-// Magic number to identify our storage (ASCII 'RPST' = RP2040 STorage)
-#define STORAGE_MAGIC 0x52505354
+// Keys of the values kept in the log store
+#define KEY_BOOT_COUNT 1
+#define KEY_DATA 2
 
 // Buffer for reading/writing data - allocate only what we need
 uint8_t buffer[FLASH_SECTOR_SIZE];
+LogStore logStore;
 bool storageInitialized = false;
 uint32_t bootCount = 0;
 uint32_t writeCount = 0;
@@ -61,10 +70,12 @@ uint32_t writeCount = 0;
 // Forward declarations
 bool initStorage(bool forceFormat = false);
 bool readStorage(uint8_t* data, size_t maxSize, size_t* actualSize);
+bool viewStorage(LogValueView* view);
 bool writeStorage(const uint8_t* data, size_t size);
-uint32_t calculateCRC32(const uint8_t* data, size_t size);
 bool testWriteSector(uint32_t sectorIndex, const char* testMessage);
 void testFlashBoundaries();
+void benchmarkCRC32();
+void onTestWriteDone(bool success, void* context);
 
 void setup() {
   pinMode(LED_BUILTIN, OUTPUT);
@@ -82,6 +93,9 @@ void setup() {
   Serial.printf("Storage size: %d KB (%d sectors) at offset 0x%X\n", 
                STORAGE_SIZE / 1024, STORAGE_SECTORS, FLASH_TARGET_OFFSET);
   
+  // Set up the CRC before the mount checks every record
+  crc32Begin();
+
   // Initialize our storage - no try/catch since exceptions are disabled
   bool success = initStorage(FORCE_FORMAT);
   
@@ -99,19 +113,37 @@ void setup() {
     }
   }
   
-  Serial.printf("This is boot #%u\n\n", bootCount);
-  
-  // Test by reading existing data
-  size_t dataSize = 0;
-  if (readStorage(buffer, sizeof(buffer) - sizeof(StorageHeader), &dataSize)) {
-    if (dataSize > 0) {
-      Serial.printf("Read %u bytes of data from storage\n", dataSize);
+  Serial.printf("This is boot #%u\n", bootCount);
+  logStore.printInfo(Serial);
+  logStore.printWear(Serial);
+  Serial.println();
+  
+  // Test by reading existing data in place, without copying it to RAM
+  LogValueView view;
+  CompressedReader compressed;
+  if (viewStorage(&view)) {
+    if (view.compressed() && compressed.begin(view)) {
+      // Only the first block needs decompressing for the preview
+      Serial.printf("Found %u bytes of data in storage, compressed to %u\n",
+                    compressed.rawSize(), view.size());
+      Serial.println("Data preview (ASCII):");
+      size_t length = compressed.readBlock(0, buffer);
+      for (size_t i = 0; i < length && i < 128; i++) {
+        Serial.print(buffer[i] >= 32 && buffer[i] <= 126 ? (char)buffer[i] : '.');
+      }
+      Serial.println("\n");
+    } else if (view.size() > 0) {
+      Serial.printf("Found %u bytes of data in storage\n", view.size());
       Serial.println("Data preview (ASCII):");
-      for (size_t i = 0; i < min(dataSize, 128UL); i++) {
-        if (buffer[i] >= 32 && buffer[i] <= 126) {
-          Serial.print((char)buffer[i]);
-        } else {
-          Serial.print('.');
+      FlashSpan span;
+      size_t shown = 0;
+      while (shown < 128 && view.nextSpan(&span)) {
+        for (size_t i = 0; i < span.size && shown < 128; i++, shown++) {
+          if (span.data[i] >= 32 && span.data[i] <= 126) {
+            Serial.print((char)span.data[i]);
+          } else {
+            Serial.print('.');
+          }
         }
       }
       Serial.println("\n");
@@ -121,6 +153,21 @@ void setup() {
   } else {
     Serial.println("ERROR: Failed to read from storage");
   }
+
+  // Older data stays in the log until its sector is reclaimed
+  LogRecordIterator records;
+  const LogRecordHeader* record;
+  FlashSpan payload;
+  unsigned long dataRecords = 0;
+  unsigned long dataBytes = 0;
+  logStore.records(&records);
+  while (records.next(&record, &payload)) {
+    if ((record->key & LOG_KEY_MASK) == KEY_DATA) {
+      dataRecords++;
+      dataBytes += payload.size;
+    }
+  }
+  Serial.printf("History: %lu data records, %lu bytes still in the log\n\n", dataRecords, dataBytes);
   
   // Write a small test message
   char testData[256];
@@ -140,6 +187,21 @@ void setup() {
 
   // Add this to setup() after initialization to test boundaries
   testFlashBoundaries();
+  flashPrintStats(Serial);
+
+  if (CRC_BENCHMARK) {
+    benchmarkCRC32();
+  }
+
+  if (FLASH_BENCHMARK && flashBench.begin(TEST_TARGET_OFFSET, TEST_SECTORS)) {
+    Serial.println();
+    flashBench.run(Serial, BENCH_ITERATIONS, FLASH_TARGET_OFFSET, STORAGE_SIZE);
+    flashPrintStats(Serial);
+  }
+
+  // From here on writes go through the queue. Callbacks are kept for loop()
+  // so core1 never prints over core0.
+  flashService.begin(&logStore, FLASH_SERVICE_ON_CORE1);
 }
 
 void loop() {
@@ -163,69 +225,96 @@ void loop() {
               "Test write #%u at %lu ms\n", 
               writeCount, millis());
       
-      if (writeStorage((uint8_t*)testData, strlen(testData))) {
-        Serial.printf("Write test #%u successful\n", writeCount);
-      } else {
-        Serial.printf("Write test #%u FAILED\n", writeCount);
+      // Only copies into the queue, the flash work happens in poll()
+      unsigned long started = micros();
+      bool queued = flashService.submit(KEY_DATA, testData, strlen(testData), onTestWriteDone,
+                                        (void*)(uintptr_t)writeCount, COMPRESS_DATA);
+      unsigned long submitUs = micros() - started;
+      if (!queued) {
+        Serial.printf("Write test #%u FAILED, queue full\n", writeCount);
+      } else if (writeCount % 100 == 0) {
+        Serial.printf("Write test #%u queued in %lu us\n", writeCount, submitUs);
+        // Core1 may be in the middle of an append or erase
+        flashService.pause();
+        flashPrintStats(Serial);
+        flashService.printInfo(Serial);
+        logStore.printWear(Serial);
+        flashService.resume();
       }
     }
   }
   
+  // 'w' on the serial port prints the wear of every sector as JSON
+  if (Serial.available() && Serial.read() == 'w') {
+    flashService.pause();
+    logStore.printWearJson(Serial);
+    flashService.resume();
+  }
+
+  // Queued writes first, erase-ahead when there are none
+  if (!FLASH_SERVICE_ON_CORE1) {
+    flashService.poll();
+  } else {
+    flashService.dispatch();
+  }
+  
   delay(10);
 }
 
+#if FLASH_SERVICE_ON_CORE1
+void setup1() {
+}
+
+void loop1() {
+  if (!flashService.poll()) {
+    delay(1);
+  }
+}
+#endif
+
+// Called once a queued test write is in flash, from poll() or, with the
+// service on core1, from dispatch() in loop()
+void onTestWriteDone(bool success, void* context) {
+  unsigned int number = (uintptr_t)context;
+  if (success) {
+    Serial.printf("Write test #%u successful\n", number);
+  } else {
+    Serial.printf("Write test #%u FAILED\n", number);
+  }
+}
+
 // Initialize the storage system
 bool initStorage(bool forceFormat) {
-  // Copy current flash content to our buffer (safely)
-  memcpy(buffer, (void*)(XIP_BASE + FLASH_TARGET_OFFSET), sizeof(buffer));
-  
-  // Check if there's a valid header
-  StorageHeader* header = (StorageHeader*)buffer;
-  
-  if (!forceFormat && header->magic == STORAGE_MAGIC) {
-    Serial.printf("Storage header found: version %u, data size %u bytes, boot count %u\n", 
-                 header->version, header->dataSize, header->bootCount);
-    
-    // Increment boot count
-    bootCount = header->bootCount + 1;
-    header->bootCount = bootCount;
-    header->writeCount = 0; // Reset write count for this boot
-    
-    // Write the updated header with incremented boot count
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(FLASH_TARGET_OFFSET, buffer, FLASH_SECTOR_SIZE);
-    restore_interrupts(ints);
-    
-  } else {
-    // Initialize or reformat
-    if (forceFormat) {
-      Serial.println("Forced format requested - initializing storage");
-    } else {
-      Serial.println("No valid storage header found - initializing new storage");
+  // Mounting only reads, nothing is erased at boot
+  if (!logStore.begin(FLASH_TARGET_OFFSET, LOG_SECTORS)) {
+    return false;
+  }
+
+  if (forceFormat) {
+    Serial.println("Forced format requested - initializing storage");
+    if (!logStore.format()) {
+      return false;
     }
-    
-    // Clear buffer first for safety
-    memset(buffer, 0, sizeof(buffer));
-    
-    // Set up new header
-    header->magic = STORAGE_MAGIC;
-    header->version = 1;
-    header->dataSize = 0;
-    header->bootCount = 1; // Start at 1 for the first boot
-    header->writeCount = 0;
-    header->crc = 0;
-    
-    // Write the empty header to flash
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(FLASH_TARGET_OFFSET, buffer, FLASH_SECTOR_SIZE);
-    restore_interrupts(ints);
-    
-    bootCount = 1;
-    writeCount = 0;
   }
-  
+
+  uint32_t lastBoot = 0;
+  LogValueView view;
+  const uint32_t* storedBoot = logStore.view(KEY_BOOT_COUNT, &view) ? view.as<uint32_t>() : NULL;
+  if (storedBoot) {
+    lastBoot = *storedBoot;
+    Serial.printf("Storage found: last boot was #%u\n", lastBoot);
+  } else {
+    Serial.println("No boot count found - initializing new storage");
+    lastBoot = 0;
+  }
+
+  // Appending the new count is a few bytes into already erased flash
+  bootCount = lastBoot + 1;
+  writeCount = 0;
+  if (!logStore.append(KEY_BOOT_COUNT, &bootCount, sizeof(bootCount))) {
+    return false;
+  }
+
   storageInitialized = true;
   return true;
 }
@@ -235,118 +324,73 @@ bool readStorage(uint8_t* data, size_t maxSize, size_t* actualSize) {
   if (!storageInitialized && !initStorage(false)) {
     return false;
   }
-  
-  // Read header directly from flash
-  StorageHeader header;
-  memcpy(&header, (void*)(XIP_BASE + FLASH_TARGET_OFFSET), sizeof(StorageHeader));
-  
-  // Check header
-  if (header.magic != STORAGE_MAGIC) {
-    Serial.println("Invalid magic number in storage header during read");
-    return false;
+
+  LogValueView view;
+  CompressedReader compressed;
+  if (logStore.view(KEY_DATA, &view) && view.compressed()) {
+    if (!compressed.begin(view)) {
+      Serial.println("ERROR: Compressed data is damaged");
+      return false;
+    }
+    *actualSize = compressed.read(data, maxSize);
+    return true;
   }
-  
-  // Safety check data size
-  if (header.dataSize > STORAGE_SIZE - sizeof(StorageHeader)) {
-    Serial.println("Invalid data size in header");
-    *actualSize = 0;
+
+  uint32_t size = 0;
+  if (!logStore.read(KEY_DATA, data, maxSize, &size)) {
+    // Nothing written yet
+    size = 0;
+  }
+  *actualSize = size;
+  return true;
+}
+
+// View the stored data in place in flash, without a size limit. This is
+// the value as stored, use CompressedReader on it if view->compressed().
+bool viewStorage(LogValueView* view) {
+  if (!storageInitialized && !initStorage(false)) {
     return false;
   }
-  
-  // Calculate safe amount to copy
-  size_t copySize = min(maxSize, header.dataSize);
-  
-  // Read data directly from flash
-  memcpy(data, (void*)(XIP_BASE + FLASH_TARGET_OFFSET + sizeof(StorageHeader)), copySize);
-  *actualSize = copySize;
-  
+
+  if (!logStore.view(KEY_DATA, view)) {
+    // Nothing written yet, an empty view
+    *view = LogValueView();
+  }
   return true;
 }
 
-// Write data to storage - simplified version
+// Write data to storage. The new value is appended, the previous one stays
+// readable until it is complete. This writes directly, so it is for use
+// before flashService.begin().
 bool writeStorage(const uint8_t* data, size_t size) {
-  // Safety checks
   if (!storageInitialized && !initStorage(false)) {
     return false;
   }
-  
-  if (size > STORAGE_SIZE - sizeof(StorageHeader)) {
-    Serial.println("ERROR: Data too large for storage");
+
+  // Blocks are compressed one by one, so a damaged one doesn't take the
+  // rest of the value with it
+  bool unchanged = false;
+  bool appended = COMPRESS_DATA ? appendCompressed(logStore, KEY_DATA, data, size, &unchanged)
+                                : logStore.append(KEY_DATA, data, size, &unchanged);
+  if (!appended) {
+    Serial.println("ERROR: Failed to append data to the log");
     return false;
   }
-  
-  // Read the current header
-  StorageHeader header;
-  memcpy(&header, (void*)(XIP_BASE + FLASH_TARGET_OFFSET), sizeof(StorageHeader));
-  
-  // Update header for new write
-  header.magic = STORAGE_MAGIC;
-  header.version = 1;
-  header.dataSize = size;
-  header.bootCount = bootCount;
-  header.writeCount = ++writeCount;
-  header.crc = calculateCRC32(data, size);
-  
-  // Copy header to buffer
-  memcpy(buffer, &header, sizeof(header));
-  
-  // Copy data after header
-  size_t dataInFirstSector = min(size, FLASH_SECTOR_SIZE - sizeof(StorageHeader));
-  memcpy(buffer + sizeof(StorageHeader), data, dataInFirstSector);
-  
-  // Erase and write first sector with header and initial data
-  uint32_t ints = save_and_disable_interrupts();
-  flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE);
-  flash_range_program(FLASH_TARGET_OFFSET, buffer, FLASH_SECTOR_SIZE);
-  
-  // If there's more data, write it sector by sector
-  if (size > dataInFirstSector) {
-    size_t remaining = size - dataInFirstSector;
-    size_t offset = dataInFirstSector;
-    size_t sectorOffset = 1;
-    
-    while (remaining > 0 && sectorOffset < STORAGE_SECTORS) {
-      // Clear buffer for safety
-      memset(buffer, 0, FLASH_SECTOR_SIZE);
-      
-      // Copy next chunk of data
-      size_t chunkSize = min(remaining, FLASH_SECTOR_SIZE);
-      memcpy(buffer, data + offset, chunkSize);
-      
-      // Erase and write this sector
-      flash_range_erase(FLASH_TARGET_OFFSET + (sectorOffset * FLASH_SECTOR_SIZE), FLASH_SECTOR_SIZE);
-      flash_range_program(FLASH_TARGET_OFFSET + (sectorOffset * FLASH_SECTOR_SIZE), buffer, FLASH_SECTOR_SIZE);
-      
-      remaining -= chunkSize;
-      offset += chunkSize;
-      sectorOffset++;
-    }
+  if (unchanged) {
+    Serial.println("Data unchanged, nothing written");
   }
-  
-  restore_interrupts(ints);
+  writeCount++;
   return true;
 }
 
-// CRC32 calculation
-uint32_t calculateCRC32(const uint8_t* data, size_t size) {
-  uint32_t crc = 0xFFFFFFFF;
-  for (size_t i = 0; i < size; i++) {
-    crc ^= data[i];
-    for (int j = 0; j < 8; j++) {
-      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
-    }
-  }
-  return ~crc;
-}
-
 // Test writing to a specific sector
 bool testWriteSector(uint32_t sectorIndex, const char* testMessage) {
-  if (sectorIndex >= STORAGE_SECTORS) {
-    Serial.printf("Error: Sector %u is beyond our storage area\n", sectorIndex);
+  if (sectorIndex >= TEST_SECTORS) {
+    Serial.printf("Error: Sector %u is beyond the test area\n", sectorIndex);
     return false;
   }
   
-  uint32_t sectorOffset = FLASH_TARGET_OFFSET + (sectorIndex * FLASH_SECTOR_SIZE);
+  uint32_t sectorOffset = TEST_TARGET_OFFSET + (sectorIndex * FLASH_SECTOR_SIZE);
   
   // Prepare test data
   memset(buffer, 0xAA, FLASH_SECTOR_SIZE); // Fill with pattern
@@ -355,14 +399,16 @@ bool testWriteSector(uint32_t sectorIndex, const char* testMessage) {
   sprintf((char*)buffer + msgLen, " (Sector %u at offset 0x%X)", 
          sectorIndex, sectorOffset);
   
-  // Write to the sector
-  uint32_t ints = save_and_disable_interrupts();
-  flash_range_erase(sectorOffset, FLASH_SECTOR_SIZE);
-  flash_range_program(sectorOffset, buffer, FLASH_SECTOR_SIZE);
-  restore_interrupts(ints);
+  // Write to the sector, skipped if it already holds the same data
+  FlashUpdateResult result;
+  if (!flashUpdate(sectorOffset, buffer, FLASH_SECTOR_SIZE, &result)) {
+    return false;
+  }
   
-  Serial.printf("Wrote test data to sector %u (offset 0x%X)\n", 
-               sectorIndex, sectorOffset);
+  Serial.printf("Wrote test data to sector %u (offset 0x%X): %s\n", 
+               sectorIndex, sectorOffset,
+               result.unchanged ? "unchanged, skipped" :
+               result.programmed ? "programmed without erase" : "erased and programmed");
   return true;
 }
 
@@ -370,18 +416,70 @@ bool testWriteSector(uint32_t sectorIndex, const char* testMessage) {
 void testFlashBoundaries() {
   Serial.println("\nTesting flash storage boundaries...");
   
-  // Test first sector (already contains our header)
-  Serial.println("First sector already contains our header");
+  // The log owns everything before the test area
+  Serial.printf("Log store uses sectors 0 to %u\n", LOG_SECTORS - 1);
   
   // Test last sector
-  if (testWriteSector(STORAGE_SECTORS - 1, "Testing last sector")) {
+  if (testWriteSector(TEST_SECTORS - 1, "Testing last sector")) {
     Serial.println("Last sector write successful!");
   }
   
-  // Test middle sector
-  if (testWriteSector(STORAGE_SECTORS / 2, "Testing middle sector")) {
-    Serial.println("Middle sector write successful!");
+  // Test first sector after the log
+  if (testWriteSector(0, "Testing first test sector")) {
+    Serial.println("First test sector write successful!");
   }
   
   Serial.println("Boundary testing completed");
-}
\ No newline at end of file
+}
+
+// Time one CRC implementation over size bytes, in passes of at most passSize
+void benchmarkCRC32Run(const char* name, const char* source,
+                       uint32_t (*crcFunction)(uint32_t, const uint8_t*, size_t),
+                       const uint8_t* data, size_t passSize, size_t size) {
+  uint32_t crc = CRC32_INIT;
+  unsigned long start = micros();
+  for (size_t done = 0; done < size; done += passSize) {
+    // RAM buffers are run over again, flash is walked through
+    const uint8_t* pass = (data == buffer) ? data : data + done;
+    crc = crcFunction(crc, pass, min(passSize, size - done));
+  }
+  unsigned long elapsed = max(micros() - start, 1UL);
+  Serial.printf("  %-8s %-6s %8u bytes in %8lu us: %6llu KB/s (crc %08X)\n",
+               name, source, size, elapsed,
+               (unsigned long long)size * 1000000 / elapsed / 1024, crc32Final(crc));
+}
+
+// Compare the CRC implementations on RAM and on the storage region in flash
+void benchmarkCRC32() {
+  Serial.println("\nBenchmarking CRC32...");
+  Serial.printf("DMA sniffer %s\n", crc32DmaChannel >= 0 ? "in use" : "not available");
+
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = i * 31 + 7;
+  }
+  const uint8_t* region = flashData(FLASH_TARGET_OFFSET);
+
+  auto dmaCrc = [](uint32_t crc, const uint8_t* data, size_t size) {
+    return crc32Dma(crc, data, size);
+  };
+  // Copy out of flash into RAM with the CRC computed on the way
+  auto dmaCopyCrc = [](uint32_t crc, const uint8_t* data, size_t size) {
+    return crc32Dma(crc, data, size, buffer);
+  };
+
+  benchmarkCRC32Run("bitwise", "RAM", crc32Bitwise, buffer, sizeof(buffer), 64 * 1024);
+  benchmarkCRC32Run("slice8", "RAM", crc32Slice8, buffer, sizeof(buffer), 256 * 1024);
+  benchmarkCRC32Run("dma", "RAM", dmaCrc, buffer, sizeof(buffer), 256 * 1024);
+
+  // The whole storage region, far larger than the XIP cache
+  benchmarkCRC32Run("bitwise", "flash", crc32Bitwise, region, sizeof(buffer), 256 * 1024);
+  benchmarkCRC32Run("slice8", "flash", crc32Slice8, region, sizeof(buffer), STORAGE_SIZE);
+  benchmarkCRC32Run("dma", "flash", dmaCrc, region, sizeof(buffer), STORAGE_SIZE);
+  benchmarkCRC32Run("dma+copy", "flash", dmaCopyCrc, region, sizeof(buffer), STORAGE_SIZE);
+
+  // Short buffers like record headers
+  benchmarkCRC32Run("slice8", "RAM", crc32Slice8, buffer, 16, 64 * 1024);
+  benchmarkCRC32Run("dma", "RAM", dmaCrc, buffer, 16, 64 * 1024);
+
+  Serial.printf("crc32Update() uses slice8 below %u bytes and dma from there on\n", CRC32_DMA_MIN);
+}
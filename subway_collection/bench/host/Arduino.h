@@ -0,0 +1,209 @@
+// Minimal Arduino core for the host build of the firmware (see bench/).
+// Only what the sketch and its headers use is provided.
+#pragma once
+
+// Everything the firmware headers pull in is included here first, before
+// LittleFS_Mbed_RP2040.h redirects the stdio file calls to the memory
+// filesystem
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define HEX 16
+#define DEC 10
+#define A0 26
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define LED_BUILTIN 25
+#define BOARD_NAME "host"
+
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+using std::min;
+using std::max;
+
+// The clock is the host's steady clock plus all the time spent in delay().
+// delay() returns at once, so the sketch runs as fast as the host allows
+// while the timestamps it stores still advance as they would on the board.
+extern unsigned long long hostDelayUs;
+
+inline unsigned long long hostMicros() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+// 32 bit like on the board, so wraparound is handled the same way
+inline unsigned long micros() { return (uint32_t)(hostMicros() + hostDelayUs); }
+inline unsigned long millis() { return (uint32_t)((hostMicros() + hostDelayUs) / 1000); }
+inline void delay(unsigned long ms) { hostDelayUs += ms * 1000ULL; }
+inline void delayMicroseconds(unsigned int us) { hostDelayUs += us; }
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return LOW; }
+inline void analogWrite(int, int) {}
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+class String {
+public:
+  std::string s;
+
+  String() {}
+  String(const char* c) : s(c ? c : "") {}
+  String(const std::string& x) : s(x) {}
+  String(char c) : s(1, c) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(unsigned int v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+  String(float v, int decimals = 2) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.*f", decimals, v);
+    s = text;
+  }
+
+  unsigned int length() const { return s.size(); }
+  const char* c_str() const { return s.c_str(); }
+  char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+
+  String substring(unsigned int from) const {
+    return from >= s.size() ? String() : String(s.substr(from));
+  }
+  String substring(unsigned int from, unsigned int to) const {
+    if (to < from) std::swap(from, to);
+    if (from >= s.size()) return String();
+    return String(s.substr(from, to - from));
+  }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t p = s.find(c, from);
+    return p == std::string::npos ? -1 : (int)p;
+  }
+  int indexOf(const char* x, unsigned int from = 0) const {
+    size_t p = s.find(x, from);
+    return p == std::string::npos ? -1 : (int)p;
+  }
+  int indexOf(const String& x, unsigned int from = 0) const { return indexOf(x.c_str(), from); }
+
+  bool startsWith(const String& x) const { return s.compare(0, x.s.size(), x.s) == 0; }
+  bool endsWith(const String& x) const {
+    return s.size() >= x.s.size() && s.compare(s.size() - x.s.size(), x.s.size(), x.s) == 0;
+  }
+  bool equalsIgnoreCase(const String& o) const {
+    if (o.s.size() != s.size()) return false;
+    for (size_t i = 0; i < s.size(); i++) {
+      if (tolower(s[i]) != tolower(o.s[i])) return false;
+    }
+    return true;
+  }
+
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+
+  void trim() {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    size_t last = s.find_last_not_of(" \t\r\n");
+    s = first == std::string::npos ? "" : s.substr(first, last - first + 1);
+  }
+  void toLowerCase() {
+    for (char& c : s) c = tolower(c);
+  }
+
+  String& operator+=(char c) { s += c; return *this; }
+  String& operator+=(const char* o) { s += o; return *this; }
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  bool operator==(const char* o) const { return s == o; }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator!=(const char* o) const { return s != o; }
+  friend String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+  friend String operator+(const String& a, const char* b) { return String(a.s + b); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.s); }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  virtual void flush() {}
+
+  size_t print(const char* str) { return write(str); }
+  size_t print(const String& str) { return write(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC) { return printFormatted(base == HEX ? "%X" : "%d", v); }
+  size_t print(unsigned int v, int base = DEC) { return printFormatted(base == HEX ? "%X" : "%u", v); }
+  size_t print(long v, int base = DEC) { return printFormatted(base == HEX ? "%lX" : "%ld", v); }
+  size_t print(unsigned long v, int base = DEC) { return printFormatted(base == HEX ? "%lX" : "%lu", v); }
+  size_t print(long long v) { return printFormatted("%lld", v); }
+  size_t print(unsigned long long v) { return printFormatted("%llu", v); }
+  size_t print(double v, int decimals = 2) { return printFormatted("%.*f", decimals, v); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <typename T> size_t println(T v, int format) { size_t n = print(v, format); return n + println(); }
+
+  int printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    write(text);
+    return n;
+  }
+
+private:
+  size_t printFormatted(const char* format, ...) {
+    char text[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    return write(text);
+  }
+};
+
+// Serial output is dropped unless the benchmark runs verbose
+class HardwareSerial : public Print {
+public:
+  bool echo = false;
+
+  void begin(unsigned long) {}
+  operator bool() { return true; }
+  int available() { return 0; }
+  int read() { return -1; }
+  size_t write(uint8_t c) override {
+    if (echo) fputc(c, stderr);
+    return 1;
+  }
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
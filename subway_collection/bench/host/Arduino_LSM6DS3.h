@@ -0,0 +1,43 @@
+// IMU stand-in for the host build. The benchmark sets the reading that the
+// next updateSensor() call will see.
+#pragma once
+#include <Arduino.h>
+
+struct ImuReading {
+  float accel[3];
+  float gyro[3];
+  float temperature;
+};
+
+class LSM6DS3Class {
+public:
+  ImuReading reading = { { 0, 0, 1 }, { 0, 0, 0 }, 25 };
+  float sampleRateHz = 104;
+
+  int begin() { return 1; }
+  void end() {}
+  float accelerationSampleRate() { return sampleRateHz; }
+  float gyroscopeSampleRate() { return sampleRateHz; }
+  int accelerationAvailable() { return 1; }
+  int gyroscopeAvailable() { return 1; }
+  int temperatureAvailable() { return 1; }
+
+  int readAcceleration(float& x, float& y, float& z) {
+    x = reading.accel[0];
+    y = reading.accel[1];
+    z = reading.accel[2];
+    return 1;
+  }
+  int readGyroscope(float& x, float& y, float& z) {
+    x = reading.gyro[0];
+    y = reading.gyro[1];
+    z = reading.gyro[2];
+    return 1;
+  }
+  int readTemperature(float& t) {
+    t = reading.temperature;
+    return 1;
+  }
+};
+
+extern LSM6DS3Class IMU;
@@ -0,0 +1,20 @@
+// LittleFS_Mbed_RP2040 stand-in for the host build. The partition is the
+// in-memory filesystem from memfs.h, the storage layer's stdio calls are
+// redirected to it.
+#pragma once
+#include <Arduino.h>
+#include "memfs.h"
+
+#define LFS_MBED_RP2040_VERSION "LittleFS_Mbed_RP2040 host memory filesystem"
+#define MBED_LITTLEFS_FILE_PREFIX "/littlefs"
+
+#define fopen(path, mode) memfs_fopen(path, mode)
+#define remove(path) memfs_remove(path)
+#define rename(from, to) memfs_rename(from, to)
+#define statvfs(path, st) memfs_statvfs(path, st)
+#define fsync(fd) memfs_fsync(fd)
+
+class LittleFS_MBED {
+public:
+  bool init() { return true; }
+};
@@ -0,0 +1,66 @@
+// WiFiNINA stand-in for the host build. The benchmark hands requests to
+// handleClient() through a WiFiClient holding the request and collecting
+// the response. Outgoing connections always fail.
+#pragma once
+#include <Arduino.h>
+
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+
+class IPAddress {
+public:
+  operator const char*() const { return "127.0.0.1"; }
+};
+
+class WiFiClient : public Print {
+public:
+  std::string request;
+  size_t readPos = 0;
+  std::string response;
+  bool open = false;
+
+  int connect(const char*, uint16_t) { return 0; }
+  int connect(IPAddress, uint16_t) { return 0; }
+  uint8_t connected() { return open; }
+  operator bool() { return open; }
+  void stop() { open = false; }
+  void setTimeout(unsigned long) {}
+
+  int available() { return request.size() - readPos; }
+  int read() { return readPos < request.size() ? (uint8_t)request[readPos++] : -1; }
+  int read(uint8_t* buffer, size_t size) {
+    size_t n = min(size, request.size() - readPos);
+    memcpy(buffer, request.data() + readPos, n);
+    readPos += n;
+    return n;
+  }
+  int peek() { return readPos < request.size() ? (uint8_t)request[readPos] : -1; }
+
+  size_t write(uint8_t c) override {
+    response += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    response.append((const char*)buffer, size);
+    return size;
+  }
+  using Print::write;
+};
+
+class WiFiServer {
+public:
+  WiFiServer(int) {}
+  void begin() {}
+  WiFiClient available() { return WiFiClient(); }
+};
+
+class WiFiClass {
+public:
+  int status() { return WL_CONNECTED; }
+  int begin(const char*, const char*) { return WL_CONNECTED; }
+  IPAddress localIP() { return IPAddress(); }
+  void macAddress(uint8_t* mac) { memset(mac, 0, 6); }
+  int32_t RSSI() { return -50; }
+};
+
+extern WiFiClass WiFi;
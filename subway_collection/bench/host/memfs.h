@@ -0,0 +1,208 @@
+// In-memory filesystem behind the stdio calls the storage layer makes.
+// Paths under MBED_LITTLEFS_FILE_PREFIX live in RAM, anything else goes to
+// the host. Usage is counted in whole blocks like LittleFS does, so
+// retention sees the partition fill up the same way, and every byte and
+// sync that reaches the "flash" is counted for the benchmark.
+#pragma once
+#include <Arduino.h>
+#include <errno.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+struct MemFsStats {
+  unsigned long long bytesWritten = 0;  // Bytes handed to the filesystem
+  unsigned long writes = 0;             // Write calls that reached it
+  unsigned long long tailCopyBytes = 0; // Of bytesWritten, file tails copied by writes before EOF
+  unsigned long syncs = 0;
+  unsigned long opens = 0;
+  unsigned long renames = 0;
+  unsigned long removes = 0;
+  unsigned long fullErrors = 0;         // Writes refused for lack of space
+};
+
+class MemFs {
+public:
+  const char* prefix;
+  size_t blockSize = 4096;
+  size_t totalBlocks;
+  size_t reservedBlocks = 2;            // Superblock pair
+  MemFsStats stats;
+  std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+
+  MemFs(const char* mountPrefix, size_t sizeBytes)
+    : prefix(mountPrefix), totalBlocks(sizeBytes / 4096) {}
+
+  bool owns(const char* path) {
+    size_t n = strlen(prefix);
+    return strncmp(path, prefix, n) == 0 && (path[n] == '/' || path[n] == '\0');
+  }
+
+  static size_t blocksFor(size_t size) {
+    // Every file takes at least one block for its metadata
+    return size == 0 ? 1 : (size + 4095) / 4096;
+  }
+
+  size_t usedBlocks() {
+    size_t used = reservedBlocks;
+    for (auto& file : files) used += blocksFor(file.second->size());
+    return used;
+  }
+
+  unsigned long long storedBytes(const char* namePrefix = "") {
+    unsigned long long total = 0;
+    size_t n = strlen(namePrefix);
+    for (auto& file : files) {
+      const char* name = file.first.c_str() + strlen(prefix) + 1;
+      if (strncmp(name, namePrefix, n) == 0) total += file.second->size();
+    }
+    return total;
+  }
+
+  void format() {
+    files.clear();
+    stats = MemFsStats();
+  }
+
+  FILE* open(const char* path, const char* mode);
+};
+
+extern MemFs memFs;
+
+// An open file: a shared buffer and a position, served through fopencookie
+struct MemFsHandle {
+  std::shared_ptr<std::vector<uint8_t>> data;
+  off64_t position = 0;
+  bool append = false;
+};
+
+inline ssize_t memFsRead(void* cookie, char* buffer, size_t size) {
+  MemFsHandle* h = (MemFsHandle*)cookie;
+  if (h->position >= (off64_t)h->data->size()) return 0;
+  size_t n = min(size, (size_t)(h->data->size() - h->position));
+  memcpy(buffer, h->data->data() + h->position, n);
+  h->position += n;
+  return n;
+}
+
+inline ssize_t memFsWrite(void* cookie, const char* buffer, size_t size) {
+  MemFsHandle* h = (MemFsHandle*)cookie;
+  if (h->append) h->position = h->data->size();
+
+  // LittleFS links file blocks back to front, changing one means writing
+  // it and every block after it again. Charge the old bytes copied.
+  size_t oldSize = h->data->size();
+  size_t copied = 0;
+  if (h->position < oldSize) {
+    size_t blockStart = h->position / memFs.blockSize * memFs.blockSize;
+    size_t overwritten = min(size, oldSize - h->position);
+    copied = oldSize - blockStart - overwritten;
+  }
+
+  size_t end = h->position + size;
+  if (end > h->data->size()) {
+    size_t extraBlocks = MemFs::blocksFor(end) - MemFs::blocksFor(h->data->size());
+    if (memFs.usedBlocks() + extraBlocks > memFs.totalBlocks) {
+      memFs.stats.fullErrors++;
+      errno = ENOSPC;
+      return -1;
+    }
+    h->data->resize(end);
+  }
+  memcpy(h->data->data() + h->position, buffer, size);
+  h->position = end;
+
+  memFs.stats.bytesWritten += size + copied;
+  memFs.stats.tailCopyBytes += copied;
+  memFs.stats.writes++;
+  return size;
+}
+
+inline int memFsSeek(void* cookie, off64_t* offset, int whence) {
+  MemFsHandle* h = (MemFsHandle*)cookie;
+  off64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? h->position : h->data->size();
+  if (base + *offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  h->position = base + *offset;
+  *offset = h->position;
+  return 0;
+}
+
+inline int memFsClose(void* cookie) {
+  delete (MemFsHandle*)cookie;
+  return 0;
+}
+
+inline FILE* MemFs::open(const char* path, const char* mode) {
+  auto it = files.find(path);
+  bool exists = it != files.end();
+  if (mode[0] == 'r' && !exists) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if (!exists) {
+    if (usedBlocks() + 1 > totalBlocks) {
+      errno = ENOSPC;
+      return NULL;
+    }
+    it = files.emplace(path, std::make_shared<std::vector<uint8_t>>()).first;
+  } else if (mode[0] == 'w') {
+    it->second->clear();
+  }
+
+  MemFsHandle* h = new MemFsHandle();
+  h->data = it->second;
+  h->append = mode[0] == 'a';
+  stats.opens++;
+
+  cookie_io_functions_t io = { memFsRead, memFsWrite, memFsSeek, memFsClose };
+  return fopencookie(h, mode, io);
+}
+
+inline FILE* memfs_fopen(const char* path, const char* mode) {
+  return memFs.owns(path) ? memFs.open(path, mode) : fopen(path, mode);
+}
+
+inline int memfs_remove(const char* path) {
+  if (!memFs.owns(path)) return remove(path);
+  if (memFs.files.erase(path) == 0) {
+    errno = ENOENT;
+    return -1;
+  }
+  memFs.stats.removes++;
+  return 0;
+}
+
+inline int memfs_rename(const char* from, const char* to) {
+  if (!memFs.owns(from)) return rename(from, to);
+  auto it = memFs.files.find(from);
+  if (it == memFs.files.end()) {
+    errno = ENOENT;
+    return -1;
+  }
+  auto data = it->second;
+  memFs.files.erase(it);
+  memFs.files[to] = data;
+  memFs.stats.renames++;
+  return 0;
+}
+
+inline int memfs_statvfs(const char* path, struct statvfs* st) {
+  if (!memFs.owns(path)) return statvfs(path, st);
+  memset(st, 0, sizeof(*st));
+  st->f_bsize = memFs.blockSize;
+  st->f_frsize = memFs.blockSize;
+  st->f_blocks = memFs.totalBlocks;
+  st->f_bfree = memFs.totalBlocks - min(memFs.totalBlocks, memFs.usedBlocks());
+  st->f_bavail = st->f_bfree;
+  return 0;
+}
+
+// Memory streams have no descriptor, a sync is only counted
+inline int memfs_fsync(int) {
+  memFs.stats.syncs++;
+  return 0;
+}
@@ -0,0 +1,4 @@
+// Host build: there is no network, the sketch only sees WL_CONNECTED
+#pragma once
+const char ssid[] = "host";
+const char pass[] = "";
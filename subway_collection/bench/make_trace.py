@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Synthesize an IMU trace of a subway ride for bench/replay_bench.
+
+The columns match segment_decode output, so a recorded ride can be used in
+its place. The ride alternates station stops and runs between stations:
+accelerate, cruise with track vibration and the odd curve, brake. Values
+are in g, degrees per second and degrees C, one row per loop pass (20 Hz).
+
+    python3 bench/make_trace.py --minutes 30 > trace.csv
+"""
+import argparse
+import math
+import random
+
+RATE_HZ = 20
+
+
+def ride(samples, rng):
+    """Yield (accel xyz, gyro xyz) for each sample."""
+    t = 0
+    while t < samples:
+        # Dwell at a station, then a run to the next one
+        phases = [('stop', rng.uniform(20, 40)),
+                  ('accelerate', rng.uniform(12, 18)),
+                  ('cruise', rng.uniform(40, 90)),
+                  ('brake', rng.uniform(10, 15))]
+        for phase, seconds in phases:
+            curve_at = rng.uniform(0.2, 0.7) if phase == 'cruise' and rng.random() < 0.6 else None
+            curve_rate = rng.choice((-1, 1)) * rng.uniform(3, 8)
+            n = int(seconds * RATE_HZ)
+            for i in range(n):
+                if t >= samples:
+                    return
+                moving = phase != 'stop'
+                noise = 0.01 if moving else 0.002
+                ax = {'accelerate': 0.11, 'brake': -0.12}.get(phase, 0.0)
+                # Track vibration beats against the sample rate
+                vib = 0.03 * math.sin(2 * math.pi * 3.1 * t / RATE_HZ) if moving else 0.0
+                gz = 0.0
+                if curve_at is not None and curve_at * n <= i < (curve_at + 0.25) * n:
+                    gz = curve_rate
+                yield ((ax + rng.gauss(0, noise),
+                        vib + rng.gauss(0, noise),
+                        1.0 + 0.5 * vib + rng.gauss(0, noise)),
+                       (rng.gauss(0, 0.3 if moving else 0.05),
+                        rng.gauss(0, 0.3 if moving else 0.05),
+                        gz + rng.gauss(0, 0.3 if moving else 0.05)))
+                t += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Synthesize a subway ride IMU trace')
+    parser.add_argument('--minutes', type=float, default=20)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    samples = int(args.minutes * 60 * RATE_HZ)
+    print('timestamp,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z,temperature')
+    for t, (accel, gyro) in enumerate(ride(samples, rng)):
+        print(f'{t * 1000 // RATE_HZ},{accel[0]:.4f},{accel[1]:.4f},{accel[2]:.4f},'
+              f'{gyro[0]:.3f},{gyro[1]:.3f},{gyro[2]:.3f},{24.0 + t / samples:.1f}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,322 @@
+// Host-side replay benchmark for the capture and storage path.
+//
+// Build:  g++ -O2 -std=gnu++17 -Ibench/host -o replay_bench bench/replay_bench.cpp
+//         (or pio run -e native_bench, the binary is .pio/build/native_bench/program)
+// Usage:  replay_bench [-n samples] [-f partition_kb] [-s rotate|periodic|append]
+//                      [-e] [-p poll_loops] [-v] trace.csv
+//
+// Builds the sketch as it is, sensor.h, the storage layer and the web
+// serializers included, against the stand-ins in bench/host. The IMU replays
+// a recorded trace, one row per loop() pass, and flash is an in-memory
+// filesystem. delay() only advances the clock, so the loop runs as fast as
+// the host allows while stored timestamps advance as they would on the board.
+//
+// Traces are CSV with accel_x .. temperature columns as written by
+// segment_decode, so a recorded ride replays directly. bench/make_trace.py
+// synthesizes one. A trace shorter than -n samples is replayed from the start.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../src/main.cpp"
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+LSM6DS3Class IMU;
+unsigned long long hostDelayUs = 0;
+
+// Sync interval used with -s, the storage default
+const unsigned long SYNC_INTERVAL_MS = 10000;
+
+// Big enough that retention never runs unless -f asks for a real partition
+MemFs memFs(MBED_LITTLEFS_FILE_PREFIX, 4UL << 20);
+
+static const char* const TRACE_COLUMNS[7] = {
+  "accel_x", "accel_y", "accel_z", "gyro_x", "gyro_y", "gyro_z", "temperature"
+};
+
+static bool loadTrace(const char* path, std::vector<ImuReading>& trace) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+
+  // Map the named columns, anything else in the file is ignored
+  char line[1024];
+  int columnFor[7];
+  if (!fgets(line, sizeof(line), in)) {
+    fprintf(stderr, "%s: empty trace\n", path);
+    fclose(in);
+    return false;
+  }
+  line[strcspn(line, "\r\n")] = '\0';
+  for (int i = 0; i < 7; i++) columnFor[i] = -1;
+  int column = 0;
+  for (char* name = strtok(line, ","); name; name = strtok(NULL, ","), column++) {
+    for (int i = 0; i < 7; i++) {
+      if (strcmp(name, TRACE_COLUMNS[i]) == 0) columnFor[i] = column;
+    }
+  }
+  for (int i = 0; i < 7; i++) {
+    if (columnFor[i] < 0) {
+      fprintf(stderr, "%s: no %s column\n", path, TRACE_COLUMNS[i]);
+      fclose(in);
+      return false;
+    }
+  }
+
+  while (fgets(line, sizeof(line), in)) {
+    float values[32];
+    int count = 0;
+    for (char* field = line; count < 32; count++) {
+      values[count] = strtof(field, NULL);
+      field = strchr(field, ',');
+      if (!field) {
+        count++;
+        break;
+      }
+      field++;
+    }
+
+    ImuReading reading;
+    float* fields[7] = {
+      &reading.accel[0], &reading.accel[1], &reading.accel[2],
+      &reading.gyro[0], &reading.gyro[1], &reading.gyro[2], &reading.temperature
+    };
+    bool complete = true;
+    for (int i = 0; i < 7; i++) {
+      if (columnFor[i] >= count) complete = false;
+      else *fields[i] = values[columnFor[i]];
+    }
+    if (complete) trace.push_back(reading);
+  }
+  fclose(in);
+
+  if (trace.empty()) {
+    fprintf(stderr, "%s: no samples\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Run one request through the sketch's handler and return the response
+static std::string request(const std::string& path, bool gzip) {
+  WiFiClient client;
+  client.open = true;
+  client.request = "GET " + path + " HTTP/1.1\r\nHost: bench\r\n";
+  if (gzip) client.request += "Accept-Encoding: gzip\r\n";
+  client.request += "\r\n";
+  handleClient(client);
+  return client.response;
+}
+
+static unsigned long percentile(std::vector<unsigned long>& values, int p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[(p * (values.size() - 1) + 50) / 100];
+}
+
+struct FlashContents {
+  unsigned long segments = 0;
+  unsigned long long samples = 0;        // Samples in sample segments
+  unsigned long long sampleBytes = 0;    // Size of those segment files
+  unsigned long long summarized = 0;     // Samples folded into summaries by retention
+};
+
+static void scanSegments(FlashContents* contents) {
+  for (uint32_t index = flashStorage.firstSegment(); index < flashStorage.nextSegment(); index++) {
+    char path[128];
+    flashStorage.segmentPath(index, path);
+    FILE* file = fopen(path, "r");
+    if (!file) continue;
+
+    SegmentHeader header;
+    if (flashStorage.readSegmentHeader(file, &header)) {
+      contents->segments++;
+      if (header.kind == SEGMENT_SUMMARY && header.recordSize == sizeof(SummaryRecord)) {
+        SummaryRecord record;
+        while (fread(&record, sizeof(record), 1, file) == 1) {
+          contents->summarized += record.samples;
+        }
+      } else if (header.kind != SEGMENT_SPECTRUM && header.recordSize == sizeof(SensorDataPoint)) {
+        contents->samples += header.count;
+        fseek(file, 0, SEEK_END);
+        contents->sampleBytes += ftell(file);
+      }
+    }
+    fclose(file);
+  }
+}
+
+static void timeResponse(const char* path) {
+  unsigned long start = micros();
+  std::string plain = request(path, false);
+  unsigned long plainUs = micros() - start;
+
+  start = micros();
+  std::string gzip = request(path, true);
+  unsigned long gzipUs = micros() - start;
+
+  printf("  %-32s %7zu B in %6lu us, gzip %6zu B in %6lu us\n", path,
+         plain.size(), plainUs, gzip.size(), gzipUs);
+}
+
+int main(int argc, char** argv) {
+  const char* tracePath = NULL;
+  unsigned long samples = 0;
+  unsigned long partitionKb = 0;
+  int syncPolicy = -1;
+  bool eventMode = false;
+  unsigned long pollLoops = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      samples = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      partitionKb = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      const char* name = argv[++i];
+      for (int p = 0; p <= SYNC_EVERY_APPEND; p++) {
+        if (strcmp(name, SYNC_POLICY_NAMES[p]) == 0) syncPolicy = p;
+      }
+      if (syncPolicy < 0) {
+        fprintf(stderr, "Unknown sync policy %s\n", name);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "-e") == 0) {
+      eventMode = true;
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      pollLoops = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      Serial.echo = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: %s [-n samples] [-f partition_kb] [-s rotate|periodic|append] "
+                      "[-e] [-p poll_loops] [-v] trace.csv\n", argv[0]);
+      return 2;
+    } else {
+      tracePath = argv[i];
+    }
+  }
+  if (!tracePath) {
+    fprintf(stderr, "No trace given, see bench/make_trace.py\n");
+    return 2;
+  }
+
+  std::vector<ImuReading> trace;
+  if (!loadTrace(tracePath, trace)) return 1;
+  if (samples == 0) samples = trace.size();
+  if (partitionKb > 0) memFs.totalBlocks = partitionKb * 1024 / memFs.blockSize;
+
+  setup();
+  if (syncPolicy >= 0) flashStorage.setSyncPolicy((SyncPolicy)syncPolicy, SYNC_INTERVAL_MS);
+  request(eventMode ? "/capture/event" : "/capture/continuous", false);
+  MemFsStats setupStats = memFs.stats;
+
+  // Replay, timing the flush phase of every pass that reached the filesystem
+  std::vector<unsigned long> flushUs;
+  std::vector<unsigned long> loopUs;
+  flushUs.reserve(samples / 8);
+  loopUs.reserve(samples);
+  unsigned long long polledBytes = 0;
+
+  unsigned long long startUs = hostMicros();
+  unsigned long startMs = millis();
+  for (unsigned long i = 0; i < samples; i++) {
+    IMU.reading = trace[i % trace.size()];
+
+    unsigned long long flushBefore = sampleProfiler.phaseStats(PHASE_FLUSH).totalUs;
+    unsigned long long writtenBefore = memFs.stats.bytesWritten;
+    unsigned long long loopStart = hostMicros();
+
+    loop();
+    // The dashboard polls the ring while recording
+    if (pollLoops > 0 && i % pollLoops == pollLoops - 1) {
+      polledBytes += request("/imu_history", true).size();
+    }
+
+    loopUs.push_back(hostMicros() - loopStart);
+    if (memFs.stats.bytesWritten != writtenBefore) {
+      flushUs.push_back(sampleProfiler.phaseStats(PHASE_FLUSH).totalUs - flushBefore);
+    }
+  }
+  unsigned long long elapsedUs = hostMicros() - startUs;
+  unsigned long replayedMs = millis() - startMs;
+
+  // Samples still in the ring are not lost, they would go out on the next flush
+  unsigned long pending = eventMode ? 0 : (bufferIndex - flushedIndex + BUFFER_SIZE) % BUFFER_SIZE;
+  unsigned long long closeStart = hostMicros();
+  flashStorage.closeSegment();
+  unsigned long closeUs = hostMicros() - closeStart;
+
+  FlashContents flash;
+  scanSegments(&flash);
+  unsigned long long written = memFs.stats.bytesWritten - setupStats.bytesWritten;
+
+  unsigned long long loopTotalUs = 0;
+  for (unsigned long us : loopUs) loopTotalUs += us;
+
+  printf("Replayed %lu samples from %s (%zu in trace)\n", samples, tracePath, trace.size());
+  printf("  mode %s, sync %s, partition %lu KB\n", eventMode ? "event" : "continuous",
+         SYNC_POLICY_NAMES[syncPolicy >= 0 ? syncPolicy : SYNC_PERIODIC],
+         (unsigned long)(memFs.totalBlocks * memFs.blockSize / 1024));
+  printf("Sustained rate      %.0f samples/s on this host\n",
+         elapsedUs > 0 ? samples * 1e6 / elapsedUs : 0.0);
+  printf("Loop pass           mean %.1f us, p99 %lu us, max %lu us\n",
+         (double)loopTotalUs / samples, percentile(loopUs, 99), percentile(loopUs, 100));
+  printf("Flush latency       p50 %lu us, p99 %lu us, max %lu us over %zu flushes, close %lu us\n",
+         percentile(flushUs, 50), percentile(flushUs, 99), percentile(flushUs, 100),
+         flushUs.size(), closeUs);
+  // Stored is the size of the sample segments per sample in them, written
+  // everything the filesystem was handed per replayed sample
+  printf("Flash per sample    %.1f B stored, %.1f B written\n",
+         flash.samples > 0 ? (double)flash.sampleBytes / flash.samples : 0.0,
+         (double)written / samples);
+  printf("Flash traffic       %llu B in %lu writes, %llu B of it tail copies, %lu syncs, %lu segments, %lu full\n",
+         written, memFs.stats.writes - setupStats.writes,
+         memFs.stats.tailCopyBytes - setupStats.tailCopyBytes, memFs.stats.syncs - setupStats.syncs,
+         flash.segments, memFs.stats.fullErrors);
+
+  // Periodic sync has to commit at least once per interval, however soon
+  // the staging buffer fills. Allow for the interval restarting at rotation.
+  bool failed = false;
+  unsigned long syncs = memFs.stats.syncs - setupStats.syncs;
+  unsigned long expectedSyncs = replayedMs / (2 * SYNC_INTERVAL_MS);
+  if (!eventMode && (syncPolicy < 0 || syncPolicy == SYNC_PERIODIC) && syncs < expectedSyncs) {
+    printf("FAIL: %lu syncs in %lu ms of periodic sync, expected at least %lu\n",
+           syncs, replayedMs, expectedSyncs);
+    failed = true;
+  }
+
+  if (eventMode) {
+    printf("Stored samples      %llu in event windows\n", flash.samples);
+  } else {
+    long long missing = (long long)samples - pending - flash.samples - flash.summarized;
+    printf("Stored samples      %llu full rate, %llu summarized\n", flash.samples, flash.summarized);
+    printf("Dropped samples     %lld\n", missing);
+    if (flashStorage.firstSegment() > 0) {
+      printf("  retention evicted segments below %lu, their samples count as dropped\n",
+             (unsigned long)flashStorage.firstSegment());
+    }
+  }
+  printf("Late samples        %lu past the %lu ms sampling deadline\n",
+         sampleProfiler.lateSamples(), SAMPLE_DEADLINE_US / 1000);
+  if (pollLoops > 0) {
+    printf("Dashboard polls     %lu, %llu B sent\n", samples / pollLoops, polledBytes);
+  }
+
+  printf("Responses\n");
+  timeResponse("/imu_history");
+  timeResponse("/storage/list");
+  if (flashStorage.nextSegment() > 0) {
+    char path[64];
+    snprintf(path, sizeof(path), "/storage/data/sensor_data_%lu.dat",
+             (unsigned long)flashStorage.nextSegment() - 1);
+    timeResponse(path);
+  }
+  return failed ? 1 : 0;
+}
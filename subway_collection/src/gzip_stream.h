@@ -0,0 +1,248 @@
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+#include <Arduino.h>
+
+// Streaming gzip encoder for dynamic responses. Everything printed to it is
+// compressed with LZ77 over a small sliding window and written as a single
+// deflate block with the fixed Huffman codes, so no code tables have to be
+// built or buffered. JSON from the serializers repeats the same keys every
+// record and typically shrinks to a quarter or less.
+//
+// RAM is fixed: the window buffer, the hash heads and a small output
+// buffer, about 5 KB. There is one shared instance because the server only
+// handles one client at a time.
+
+#define GZIP_WINDOW_SIZE 2048          // Longest match distance
+#define GZIP_BUFFER_SIZE (2 * GZIP_WINDOW_SIZE)
+#define GZIP_HASH_BITS 9
+#define GZIP_HASH_SIZE (1 << GZIP_HASH_BITS)
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+#define GZIP_OUT_SIZE 256
+
+// Deflate length codes 257..285: base length and extra bits
+static const uint16_t GZIP_LENGTH_BASE[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t GZIP_LENGTH_EXTRA[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+// Distance codes 0..29, only those reaching GZIP_WINDOW_SIZE are used
+static const uint16_t GZIP_DIST_BASE[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t GZIP_DIST_EXTRA[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// CRC-32 (gzip trailer) a nibble at a time
+static const uint32_t GZIP_CRC_NIBBLE[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+class GzipStream : public Print {
+private:
+  Print* out = NULL;
+  uint8_t buffer[GZIP_BUFFER_SIZE];    // Window history followed by input not yet encoded
+  uint16_t head[GZIP_HASH_SIZE];       // Latest buffer position + 1 for each 3 byte hash
+  size_t length = 0;                   // Bytes in buffer
+  size_t position = 0;                 // Next byte to encode
+
+  uint8_t outBuffer[GZIP_OUT_SIZE];
+  size_t outLength = 0;
+  uint32_t bitBuffer = 0;
+  int bitCount = 0;
+
+  uint32_t crc = 0;
+  uint32_t inputSize = 0;
+  unsigned long compressedSize = 0;
+  bool failed = false;
+
+  void flushOutput() {
+    if (outLength > 0 && !failed) {
+      if (out->write(outBuffer, outLength) != outLength) failed = true;
+      compressedSize += outLength;
+    }
+    outLength = 0;
+  }
+
+  void putByte(uint8_t b) {
+    outBuffer[outLength++] = b;
+    if (outLength == GZIP_OUT_SIZE) flushOutput();
+  }
+
+  // Deflate packs bits starting from the least significant
+  void putBits(uint32_t value, int count) {
+    bitBuffer |= value << bitCount;
+    bitCount += count;
+    while (bitCount >= 8) {
+      putByte(bitBuffer & 0xFF);
+      bitBuffer >>= 8;
+      bitCount -= 8;
+    }
+  }
+
+  // Huffman codes go out most significant bit first
+  void putCode(uint32_t code, int count) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < count; i++) {
+      reversed = (reversed << 1) | (code & 1);
+      code >>= 1;
+    }
+    putBits(reversed, count);
+  }
+
+  // Fixed Huffman code for a literal/length symbol (RFC 1951 3.2.6)
+  void putSymbol(int symbol) {
+    if (symbol < 144) {
+      putCode(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+      putCode(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+      putCode(symbol - 256, 7);
+    } else {
+      putCode(0xC0 + symbol - 280, 8);
+    }
+  }
+
+  void putMatch(int matchLength, int distance) {
+    int code = 28;
+    while (GZIP_LENGTH_BASE[code] > matchLength) code--;
+    putSymbol(257 + code);
+    putBits(matchLength - GZIP_LENGTH_BASE[code], GZIP_LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (GZIP_DIST_BASE[code] > distance) code--;
+    putCode(code, 5);
+    putBits(distance - GZIP_DIST_BASE[code], GZIP_DIST_EXTRA[code]);
+  }
+
+  static uint16_t hashAt(const uint8_t* p) {
+    uint32_t h = ((uint32_t)p[0] << 10) ^ ((uint32_t)p[1] << 5) ^ p[2];
+    return (uint32_t)(h * 2654435761UL) >> (32 - GZIP_HASH_BITS);
+  }
+
+  void insertHash(size_t pos) {
+    if (pos + GZIP_MIN_MATCH <= length) {
+      head[hashAt(buffer + pos)] = pos + 1;
+    }
+  }
+
+  // Encode buffered input. Unless final, enough is held back for the
+  // longest possible match to be found.
+  void encode(bool final) {
+    size_t limit = final ? length : (length > GZIP_MAX_MATCH ? length - GZIP_MAX_MATCH : 0);
+
+    while (position < limit) {
+      int bestLength = 0;
+      size_t candidate = 0;
+
+      if (position + GZIP_MIN_MATCH <= length) {
+        uint16_t h = hashAt(buffer + position);
+        candidate = head[h];
+        head[h] = position + 1;
+
+        // Single candidate per hash, cheap and good enough for repeated keys
+        if (candidate > 0 && position - (candidate - 1) <= GZIP_WINDOW_SIZE) {
+          candidate--;
+          size_t maxLength = min((size_t)GZIP_MAX_MATCH, length - position);
+          while (bestLength < (int)maxLength && buffer[candidate + bestLength] == buffer[position + bestLength]) {
+            bestLength++;
+          }
+        }
+      }
+
+      if (bestLength >= GZIP_MIN_MATCH) {
+        putMatch(bestLength, position - candidate);
+        for (int i = 1; i < bestLength; i++) {
+          insertHash(position + i);
+        }
+        position += bestLength;
+      } else {
+        putSymbol(buffer[position]);
+        position++;
+      }
+    }
+  }
+
+  // Drop the oldest window's worth of history to make room for input
+  void slide() {
+    memmove(buffer, buffer + GZIP_WINDOW_SIZE, length - GZIP_WINDOW_SIZE);
+    length -= GZIP_WINDOW_SIZE;
+    position -= GZIP_WINDOW_SIZE;
+    for (int i = 0; i < GZIP_HASH_SIZE; i++) {
+      head[i] = head[i] > GZIP_WINDOW_SIZE ? head[i] - GZIP_WINDOW_SIZE : 0;
+    }
+  }
+
+public:
+  // Start a new gzip member on out
+  void begin(Print& output) {
+    out = &output;
+    length = 0;
+    position = 0;
+    outLength = 0;
+    bitBuffer = 0;
+    bitCount = 0;
+    crc = 0xFFFFFFFF;
+    inputSize = 0;
+    compressedSize = 0;
+    failed = false;
+    memset(head, 0, sizeof(head));
+
+    // gzip header: deflate, no flags, no mtime, unknown OS
+    static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    for (int i = 0; i < 10; i++) putByte(header[i]);
+
+    // One final block with fixed Huffman codes
+    putBits(1, 1);
+    putBits(1, 2);
+  }
+
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    for (size_t i = 0; i < size; i++) {
+      uint8_t c = data[i];
+      crc = GZIP_CRC_NIBBLE[(crc ^ c) & 0x0F] ^ (crc >> 4);
+      crc = GZIP_CRC_NIBBLE[(crc ^ (c >> 4)) & 0x0F] ^ (crc >> 4);
+
+      buffer[length++] = c;
+      if (length == GZIP_BUFFER_SIZE) {
+        encode(false);
+        slide();
+      }
+    }
+    inputSize += size;
+    return failed ? 0 : size;
+  }
+
+  // Encode what is left, close the block and write the gzip trailer
+  bool finish() {
+    encode(true);
+    putSymbol(256);
+    if (bitCount > 0) putBits(0, 8 - bitCount);
+
+    uint32_t finalCrc = crc ^ 0xFFFFFFFF;
+    for (int i = 0; i < 4; i++) putByte(finalCrc >> (8 * i));
+    for (int i = 0; i < 4; i++) putByte(inputSize >> (8 * i));
+    flushOutput();
+    return !failed;
+  }
+
+  unsigned long bytesIn() { return inputSize; }
+  unsigned long bytesOut() { return compressedSize; }
+};
+
+GzipStream responseGzip;
+
+#endif // GZIP_STREAM_H
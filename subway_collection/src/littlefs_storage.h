@@ -14,6 +14,11 @@
 
 // We need to include stdio.h for FILE operations
 #include <stdio.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "segment_format.h"
+#include "sample_profiler.h"
 
 // Stub timestamp function - will be updated later with real time source
 // Currently just returns millis() but could be replaced with RTC or NTP time
@@ -27,18 +32,67 @@ unsigned long timestamp() {
   return millis();
 }
 
-// Configuration for our data storage
-struct SensorDataPoint {
-  float accelX;
-  float accelY;
-  float accelZ;
-  float gyroX;
-  float gyroY;
-  float gyroZ;
-  float temperature;
-  unsigned long timestamp;
+// Persistent record of which segment files exist. Segments are numbered
+// in write order; everything in [firstSegment, nextSegment) may exist.
+#define CATALOG_MAGIC 0x43415431  // 'CAT1'
+
+struct SegmentCatalog {
+  uint32_t magic;
+  uint32_t firstSegment;     // Oldest segment that may still exist
+  uint32_t nextSegment;      // Index the next segment will be written to
+  uint32_t ackedSegment;     // Segments below this were acknowledged by the collector, or evicted
+  uint32_t rewrites;         // Segments rewritten in place by retention, ever
 };
 
+// When records staged in RAM are committed to flash. Until a sync, LittleFS
+// keeps written data out of the file, so a power loss drops it.
+enum SyncPolicy {
+  SYNC_ON_ROTATE = 0,        // Sync only when a segment is closed
+  SYNC_PERIODIC,             // Also sync once the oldest unsynced record is syncIntervalMs old
+  SYNC_EVERY_APPEND          // Sync after every append, slowest but loses nothing
+};
+
+const char* const SYNC_POLICY_NAMES[] = { "rotate", "periodic", "append" };
+
+// Continuous segments are closed and numbered once they reach either limit.
+// Segments are the unit retention frees, so they are kept to a small share
+// of the partition (16 KB of the 64 KB).
+const int SEGMENT_MAX_RECORDS = 512;
+const unsigned long SEGMENT_MAX_AGE_MS = 600000;  // 10 minutes
+
+// A segment file being appended to through a RAM staging buffer
+struct OpenSegment {
+  FILE* file;
+  SegmentHeader header;      // Final header, written when the segment closes
+  uint8_t* buffer;
+  size_t bufferSize;
+  size_t buffered;           // Bytes staged but not yet written
+  unsigned long written;     // Bytes already handed to the filesystem
+  unsigned long unsynced;    // Of those, bytes written since the last sync
+  unsigned long openedMs;
+  unsigned long dirtyMs;     // When the oldest byte not yet synced was added
+};
+
+// Fold the timing of one flush into the summary of the segment it went to
+void mergeTimingSummary(SampleTimingSummary* into, const SampleTimingSummary* from) {
+  if (from->samples == 0) return;
+  
+  uint32_t intervals = into->samples + from->samples;
+  into->meanIntervalUs = ((uint64_t)into->meanIntervalUs * into->samples +
+                          (uint64_t)from->meanIntervalUs * from->samples) / intervals;
+  if (into->samples == 0 || (from->minIntervalUs > 0 && from->minIntervalUs < into->minIntervalUs)) {
+    into->minIntervalUs = from->minIntervalUs;
+  }
+  if (from->maxGapUs > into->maxGapUs) into->maxGapUs = from->maxGapUs;
+  into->samples += from->samples;
+  into->lateSamples += from->lateSamples;
+  into->staleSamples += from->staleSamples;
+  for (int i = 0; i < INTERVAL_BUCKET_COUNT; i++) {
+    uint32_t count = (uint32_t)into->histogram[i] + from->histogram[i];
+    into->histogram[i] = count > 0xFFFF ? 0xFFFF : count;
+  }
+}
+
 class LittleFSStorage {
 private:
   LittleFS_MBED *myFS;
@@ -46,11 +100,303 @@ private:
   unsigned long lastFlushTime = 0;
   const unsigned long FLUSH_INTERVAL = 60000; // Flush every minute by default
   const char* dataPath = MBED_LITTLEFS_FILE_PREFIX "/sensor_data_";
+  const char* catalogPath = MBED_LITTLEFS_FILE_PREFIX "/catalog.bin";
+  // Continuous samples go here and are renamed to the next segment on rotation
+  const char* activePath = MBED_LITTLEFS_FILE_PREFIX "/active.dat";
   int fileCounter = 0;
+  SegmentCatalog catalog;
+
+  // Staging buffers. Writes go out a whole buffer at a time, which keeps
+  // file offsets aligned to the 4 KB filesystem block. An event window or a
+  // spectrum segment fits the window buffer whole and is written once.
+  static const size_t WRITE_BUFFER_SIZE = 4096;
+  static const size_t WINDOW_BUFFER_SIZE = 4096;
+  uint8_t writeBuffer[WRITE_BUFFER_SIZE];
+  uint8_t windowBuffer[WINDOW_BUFFER_SIZE];
+  OpenSegment active;                 // Continuous segment, kept open between flushes
+  SyncPolicy syncPolicy = SYNC_PERIODIC;
+  unsigned long syncIntervalMs = 10000;
+
+  // Write-path statistics, latencies are kept for the most recent flushes
+  static const int LATENCY_HISTORY = 32;
+  unsigned long flushLatencyUs[LATENCY_HISTORY];
+  unsigned long flushCount = 0;
+  unsigned long flushFailures = 0;
+  unsigned long long totalBytesWritten = 0;   // Bytes that reached the filesystem
+  unsigned long recordsWritten = 0;
+  unsigned long segmentsWritten = 0;
+  unsigned long lastSegmentRecords = 0;
+  unsigned long statsStartTime = 0;
+  unsigned long syncCount = 0;
+
+  void recordFlush(unsigned long startUs, size_t written) {
+    flushLatencyUs[flushCount % LATENCY_HISTORY] = micros() - startUs;
+    flushCount++;
+    totalBytesWritten += written;
+  }
+
+  // Latency percentile (0-100) over the retained flush history
+  unsigned long flushLatencyPercentile(int percentile) {
+    int samples = min(flushCount, (unsigned long)LATENCY_HISTORY);
+    if (samples == 0) return 0;
+    
+    unsigned long sorted[LATENCY_HISTORY];
+    memcpy(sorted, flushLatencyUs, samples * sizeof(unsigned long));
+    
+    // Insertion sort, the history is tiny
+    for (int i = 1; i < samples; i++) {
+      unsigned long value = sorted[i];
+      int j = i - 1;
+      while (j >= 0 && sorted[j] > value) {
+        sorted[j + 1] = sorted[j];
+        j--;
+      }
+      sorted[j + 1] = value;
+    }
+    
+    int index = (percentile * (samples - 1) + 50) / 100;
+    return sorted[index];
+  }
+
+  // Load the catalog, or rebuild it from the files already on flash
+  void loadCatalog() {
+    memset(&catalog, 0, sizeof(catalog));
+    
+    FILE* file = fopen(catalogPath, "r");
+    if (file) {
+      size_t read = fread(&catalog, sizeof(catalog), 1, file);
+      fclose(file);
+      if (read == 1 && catalog.magic == CATALOG_MAGIC) {
+        fileCounter = catalog.nextSegment;
+        return;
+      }
+      memset(&catalog, 0, sizeof(catalog));
+    }
+    
+    // Older firmware restarted at 0 on every boot, count what is there
+    catalog.magic = CATALOG_MAGIC;
+    char filePath[128];
+    while (true) {
+      segmentPath(catalog.nextSegment, filePath);
+      FILE* existing = fopen(filePath, "r");
+      if (!existing) break;
+      fclose(existing);
+      catalog.nextSegment++;
+    }
+    fileCounter = catalog.nextSegment;
+    saveCatalog();
+  }
+
+  bool saveCatalog() {
+    FILE* file = fopen(catalogPath, "w");
+    if (!file) {
+      Serial.println("Failed to write segment catalog");
+      return false;
+    }
+    size_t written = fwrite(&catalog, sizeof(catalog), 1, file);
+    fclose(file);
+    return written == 1;
+  }
+
+  // A segment file was completed, move on to the next index
+  void segmentCommitted(int records) {
+    fileCounter++;
+    catalog.nextSegment = fileCounter;
+    saveCatalog();
+    
+    segmentsWritten++;
+    lastSegmentRecords = records;
+  }
+
+  bool openSegment(OpenSegment& seg, const char* path, uint16_t kind, uint32_t recordSize) {
+    seg.file = fopen(path, "w");
+    if (!seg.file) {
+      Serial.println("Failed to open data file for writing");
+      flushFailures++;
+      return false;
+    }
+    
+    // Records are staged in our own buffer, stdio's would only add a copy
+    setvbuf(seg.file, NULL, _IONBF, 0);
+    
+    memset(&seg.header, 0, sizeof(seg.header));
+    seg.header.magic = SEGMENT_MAGIC;
+    seg.header.version = SEGMENT_VERSION;
+    seg.header.headerSize = sizeof(SegmentHeader);
+    seg.header.recordSize = recordSize;
+    seg.header.kind = kind;
+    seg.buffered = 0;
+    seg.written = 0;
+    seg.unsynced = 0;
+    seg.openedMs = millis();
+    
+    // Placeholder, the final header is written when the segment closes
+    SegmentHeader placeholder = seg.header;
+    placeholder.count = SEGMENT_COUNT_IN_TRAILER;
+    return stageBytes(seg, &placeholder, sizeof(placeholder));
+  }
+
+  // Hand staged bytes to the filesystem, and commit them to flash if sync is set
+  bool writeStaged(OpenSegment& seg, bool sync) {
+    unsigned long startUs = micros();
+    size_t length = seg.buffered;
+    
+    if (length > 0 && fwrite(seg.buffer, 1, length, seg.file) != length) {
+      Serial.println("Failed to write data file");
+      flushFailures++;
+      return false;
+    }
+    seg.unsynced += length;
+    if (sync) {
+      fflush(seg.file);
+      fsync(fileno(seg.file));
+      syncCount++;
+      seg.unsynced = 0;
+    }
+    
+    seg.written += length;
+    seg.buffered = 0;
+    if (length > 0) {
+      recordFlush(startUs, length);
+    }
+    return true;
+  }
+
+  // Copy bytes into the staging buffer, writing it out each time it fills.
+  // After a partial write the buffer only fills up to the next block
+  // boundary, so later writes are block aligned again.
+  bool stageBytes(OpenSegment& seg, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (length > 0) {
+      size_t limit = seg.bufferSize - seg.written % seg.bufferSize;
+      if (seg.buffered == 0 && seg.unsynced == 0) seg.dirtyMs = millis();
+      
+      size_t chunk = min(length, limit - seg.buffered);
+      memcpy(seg.buffer + seg.buffered, bytes, chunk);
+      seg.buffered += chunk;
+      bytes += chunk;
+      length -= chunk;
+      
+      if (seg.buffered == limit && !writeStaged(seg, false)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool appendRecord(OpenSegment& seg, const void* record, uint32_t recordTime) {
+    if (!stageBytes(seg, record, seg.header.recordSize)) {
+      return false;
+    }
+    // Unused ring slots have a zero timestamp
+    if (recordTime != 0) {
+      if (seg.header.startTime == 0 || recordTime < seg.header.startTime) seg.header.startTime = recordTime;
+      if (recordTime > seg.header.endTime) seg.header.endTime = recordTime;
+    }
+    seg.header.count++;
+    recordsWritten++;
+    return true;
+  }
+
+  // Write out what is still staged with the final header and close. Going
+  // back to the front would make LittleFS copy the whole file again, so a
+  // segment that already reached flash gets its header as a trailer.
+  bool closeSegmentFile(OpenSegment& seg) {
+    bool ok;
+    if (seg.written == 0) {
+      // Everything is still in RAM, fix the header in place and write once
+      memcpy(seg.buffer, &seg.header, sizeof(seg.header));
+      ok = writeStaged(seg, false);
+    } else {
+      ok = stageBytes(seg, &seg.header, sizeof(seg.header)) &&
+           writeStaged(seg, false);
+    }
+    if (fclose(seg.file) != 0) {
+      ok = false;
+    }
+    seg.file = NULL;
+    
+    if (!ok) {
+      Serial.println("Failed to finish data file");
+      flushFailures++;
+    }
+    return ok;
+  }
+
+  // Give up on a segment after a write error
+  void abandonSegment(OpenSegment& seg) {
+    fclose(seg.file);
+    seg.file = NULL;
+    seg.buffered = 0;
+  }
+
+  // A continuous segment that was still open when power was lost is
+  // committed with the records that reached flash
+  void recoverActiveSegment() {
+    FILE* file = fopen(activePath, "r+");
+    if (!file) return;
+    
+    // Closed but not yet renamed, the trailer is already there
+    SegmentHeader header;
+    if (readSegmentHeader(file, &header) && header.count > 0) {
+      fclose(file);
+      commitRecoveredSegment(header.count);
+      return;
+    }
+    
+    fseek(file, 0, SEEK_SET);
+    bool ok = readLeadingHeader(file, &header) &&
+              header.magic == SEGMENT_MAGIC &&
+              header.headerSize == sizeof(SegmentHeader) &&
+              header.recordSize == sizeof(SensorDataPoint);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    long records = ok && size > header.headerSize ? (size - header.headerSize) / header.recordSize : 0;
+    
+    if (records > 0) {
+      // Only the placeholder is on flash, take the times from the records
+      SensorDataPoint point;
+      fseek(file, header.headerSize, SEEK_SET);
+      if (fread(&point, sizeof(point), 1, file) == 1) header.startTime = point.timestamp;
+      fseek(file, header.headerSize + (records - 1) * header.recordSize, SEEK_SET);
+      if (fread(&point, sizeof(point), 1, file) == 1) header.endTime = point.timestamp;
+      header.count = records;
+      
+      // Any partial record stays in front of the trailer, readers go by count
+      fseek(file, 0, SEEK_END);
+      ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    fclose(file);
+    
+    if (records > 0 && ok) {
+      commitRecoveredSegment(records);
+    } else {
+      remove(activePath);
+    }
+  }
+
+  // Give the recovered continuous segment the next segment index
+  void commitRecoveredSegment(long records) {
+    char filePath[128];
+    segmentPath(fileCounter, filePath);
+    if (rename(activePath, filePath) == 0) {
+      segmentCommitted(records);
+      Serial.print("Recovered ");
+      Serial.print(records);
+      Serial.print(" records from an interrupted segment into ");
+      Serial.println(filePath);
+    } else {
+      remove(activePath);
+    }
+  }
 
 public:
   LittleFSStorage() {
     myFS = new LittleFS_MBED();
+    
+    memset(&active, 0, sizeof(active));
+    active.buffer = writeBuffer;
+    active.bufferSize = WRITE_BUFFER_SIZE;
   }
 
   ~LittleFSStorage() {
@@ -60,6 +406,8 @@ public:
   }
 
   bool begin() {
+    statsStartTime = millis();
+    
     // Initialize the LittleFS filesystem
     if (!myFS->init()) {
       Serial.println("LITTLEFS Mount Failed");
@@ -71,13 +419,74 @@ public:
     Serial.println(BOARD_NAME);
     Serial.println(LFS_MBED_RP2040_VERSION);
     
+    initialized = true;
+    loadCatalog();
+    recoverActiveSegment();
+    
     // Print filesystem info
     printFSInfo();
     
-    initialized = true;
     return true;
   }
 
+  // Range of segment indices that may exist on flash
+  uint32_t firstSegment() { return catalog.firstSegment; }
+  uint32_t nextSegment() { return catalog.nextSegment; }
+  uint32_t ackedSegment() { return catalog.ackedSegment; }
+  uint32_t rewrites() { return catalog.rewrites; }
+
+  // A stored segment was replaced by a different version of itself, so
+  // exports made before no longer match
+  bool segmentRewritten() {
+    catalog.rewrites++;
+    return saveCatalog();
+  }
+
+  // Record that the collector holds every segment below endSegment
+  bool markSegmentsAcked(uint32_t endSegment) {
+    if (endSegment > catalog.nextSegment) endSegment = catalog.nextSegment;
+    if (endSegment <= catalog.ackedSegment) return true;
+    catalog.ackedSegment = endSegment;
+    return saveCatalog();
+  }
+
+  // Delete the oldest segment and move the catalog past it
+  bool dropOldestSegment() {
+    if (catalog.firstSegment >= catalog.nextSegment) return false;
+    
+    char filePath[128];
+    segmentPath(catalog.firstSegment, filePath);
+    remove(filePath);
+    
+    catalog.firstSegment++;
+    if (catalog.ackedSegment < catalog.firstSegment) {
+      catalog.ackedSegment = catalog.firstSegment;
+    }
+    return saveCatalog();
+  }
+
+  // Size of a segment file in bytes, -1 if it does not exist
+  long segmentFileSize(uint32_t index) {
+    char filePath[128];
+    segmentPath(index, filePath);
+    
+    FILE* file = fopen(filePath, "r");
+    if (!file) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+  }
+
+  // Full path and bare file name of a segment
+  void segmentPath(uint32_t index, char* out) {
+    sprintf(out, "%s%lu.dat", dataPath, (unsigned long)index);
+  }
+  
+  void segmentName(uint32_t index, char* out) {
+    sprintf(out, "sensor_data_%lu.dat", (unsigned long)index);
+  }
+
   // List files in the filesystem using manual file manipulation
   // instead of directory iteration
   void printFSInfo() {
@@ -88,13 +497,11 @@ public:
     
     Serial.println("\nFiles in filesystem:");
     
-    // Use a simpler approach for RP2040 - just try to list some known files
-    // and report their sizes if they exist
-    char knownPrefix[] = MBED_LITTLEFS_FILE_PREFIX "/sensor_data_";
-    
-    for (int i = 0; i < 10; i++) {  // Try the first 10 possible data files
+    // Use a simpler approach for RP2040 - walk the segment catalog
+    // and report sizes of the files that exist
+    for (uint32_t i = catalog.firstSegment; i < catalog.nextSegment; i++) {
       char filename[64];
-      sprintf(filename, "%s%d.dat", knownPrefix, i);
+      segmentPath(i, filename);
       
       FILE* file = fopen(filename, "r");
       if (file) {
@@ -115,72 +522,289 @@ public:
     Serial.print("Filesystem size: ");
     Serial.print(RP2040_FS_SIZE_KB);
     Serial.println(" KB");
+    
+    unsigned long blockSize, totalBlocks, freeBlocks;
+    if (getBlockUsage(&blockSize, &totalBlocks, &freeBlocks)) {
+      Serial.print("Blocks used: ");
+      Serial.print(totalBlocks - freeBlocks);
+      Serial.print(" / ");
+      Serial.print(totalBlocks);
+      Serial.print(" (");
+      Serial.print(blockSize);
+      Serial.println(" bytes each)");
+    }
   }
 
-  bool saveDataPoint(const SensorDataPoint& dataPoint) {
+  // Query block usage from the mounted filesystem
+  bool getBlockUsage(unsigned long* blockSize, unsigned long* totalBlocks, unsigned long* freeBlocks) {
     if (!initialized) return false;
     
-    char filePath[128];
-    sprintf(filePath, "%s%d.dat", dataPath, fileCounter);
+    struct statvfs fsStats;
+    if (statvfs(MBED_LITTLEFS_FILE_PREFIX, &fsStats) != 0) {
+      return false;
+    }
     
-    FILE* file = fopen(filePath, "a");
-    if (!file) {
-      Serial.println("Failed to open data file for writing");
+    *blockSize = fsStats.f_bsize;
+    *totalBlocks = fsStats.f_blocks;
+    *freeBlocks = fsStats.f_bfree;
+    return true;
+  }
+
+  // Write the write-path statistics as a JSON object
+  void printStatsJson(Print& out) {
+    unsigned long elapsedMs = millis() - statsStartTime;
+    
+    out.print("{\"flushes\":");
+    out.print(flushCount);
+    out.print(",\"flushFailures\":");
+    out.print(flushFailures);
+    out.print(",\"flushLatencyUs\":{\"p50\":");
+    out.print(flushLatencyPercentile(50));
+    out.print(",\"p90\":");
+    out.print(flushLatencyPercentile(90));
+    out.print(",\"p99\":");
+    out.print(flushLatencyPercentile(99));
+    out.print(",\"max\":");
+    out.print(flushLatencyPercentile(100));
+    out.print("}");
+    
+    out.print(",\"bytesWritten\":");
+    out.print((unsigned long)totalBytesWritten);
+    out.print(",\"recordsWritten\":");
+    out.print(recordsWritten);
+    out.print(",\"segments\":");
+    out.print(segmentsWritten);
+    out.print(",\"recordsPerSegment\":{\"last\":");
+    out.print(lastSegmentRecords);
+    out.print(",\"mean\":");
+    out.print(segmentsWritten > 0 ? recordsWritten / segmentsWritten : 0UL);
+    out.print("}");
+    
+    // Continuous segment still being appended to
+    out.print(",\"syncPolicy\":\"");
+    out.print(SYNC_POLICY_NAMES[syncPolicy]);
+    out.print("\",\"syncs\":");
+    out.print(syncCount);
+    out.print(",\"activeRecords\":");
+    out.print(active.file ? (long)active.header.count : 0L);
+    out.print(",\"stagedBytes\":");
+    out.print((unsigned long)(active.file ? active.buffered : 0));
+    
+    double bytesPerSecond = elapsedMs > 0 ? (double)totalBytesWritten * 1000.0 / elapsedMs : 0.0;
+    out.print(",\"bytesPerSecond\":");
+    out.print(bytesPerSecond, 1);
+    
+    unsigned long blockSize, totalBlocks, freeBlocks;
+    if (getBlockUsage(&blockSize, &totalBlocks, &freeBlocks)) {
+      double freeBytes = (double)freeBlocks * blockSize;
+      
+      out.print(",\"blockSize\":");
+      out.print(blockSize);
+      out.print(",\"usedBlocks\":");
+      out.print(totalBlocks - freeBlocks);
+      out.print(",\"freeBlocks\":");
+      out.print(freeBlocks);
+      out.print(",\"freeBytes\":");
+      out.print((unsigned long)freeBytes);
+      
+      // Remaining recording time if we keep writing at the current rate
+      out.print(",\"remainingSeconds\":");
+      if (bytesPerSecond > 0) {
+        out.print((unsigned long)(freeBytes / bytesPerSecond));
+      } else {
+        out.print("null");
+      }
+    }
+    
+    out.println("}");
+  }
+
+  // Choose when staged records are committed to flash
+  void setSyncPolicy(SyncPolicy policy, unsigned long intervalMs) {
+    syncPolicy = policy;
+    syncIntervalMs = intervalMs;
+  }
+
+  // Call from loop(). Under SYNC_PERIODIC commits whatever was appended
+  // since the last sync, whether it is still staged or the full staging
+  // buffer already went to the filesystem. Closes the continuous segment
+  // once it gets too old.
+  void update() {
+    if (!active.file) return;
+    
+    if (millis() - active.openedMs >= SEGMENT_MAX_AGE_MS) {
+      closeSegment();
+    } else if (syncPolicy == SYNC_PERIODIC && (active.buffered > 0 || active.unsynced > 0) &&
+               millis() - active.dirtyMs >= syncIntervalMs) {
+      if (!writeStaged(active, true)) abandonSegment(active);
+    }
+  }
+
+  // Close the continuous segment and give it the next segment index
+  bool closeSegment() {
+    if (!active.file) return true;
+    
+    int records = active.header.count;
+    if (!closeSegmentFile(active) || records == 0) {
+      remove(activePath);
+      return records == 0;
+    }
+    
+    char filePath[128];
+    segmentPath(fileCounter, filePath);
+    if (rename(activePath, filePath) != 0) {
+      Serial.println("Failed to commit data file");
+      flushFailures++;
       return false;
     }
+    segmentCommitted(records);
     
-    size_t bytesWritten = fwrite(&dataPoint, sizeof(SensorDataPoint), 1, file);
-    fclose(file);
+    Serial.print("Saved ");
+    Serial.print(records);
+    Serial.print(" data points to file: ");
+    Serial.println(filePath);
+    
+    return true;
+  }
+
+  // Append one point to the continuous segment
+  bool saveDataPoint(const SensorDataPoint& dataPoint) {
+    if (!initialized) return false;
     
-    if (bytesWritten != 1) {
+    if (active.file && active.header.count >= SEGMENT_MAX_RECORDS) {
+      closeSegment();
+    }
+    if (!active.file && !openSegment(active, activePath, SEGMENT_CONTINUOUS, sizeof(SensorDataPoint))) {
+      return false;
+    }
+    
+    if (!appendRecord(active, &dataPoint, dataPoint.timestamp)) {
       Serial.println("Failed to write data point");
+      abandonSegment(active);
+      return false;
+    }
+    
+    if (syncPolicy == SYNC_EVERY_APPEND && !writeStaged(active, true)) {
+      abandonSegment(active);
       return false;
     }
     
     return true;
   }
 
+  // Timing summary is optional, segments flushed without one get zeroes
   bool saveSensorBuffers(float accelX[], float accelY[], float accelZ[],
                         float gyroX[], float gyroY[], float gyroZ[],
                         float temperature[], unsigned long timestamps[],
-                        int count) {
+                        int count, const SampleTimingSummary* timing = NULL) {
+    return saveSensorWindow(accelX, accelY, accelZ, gyroX, gyroY, gyroZ,
+                            temperature, timestamps, count, 0, count, timing, NULL);
+  }
+
+  // Save count records from a ring of ringSize entries, oldest first,
+  // starting at startIndex. Without event metadata the records are appended
+  // to the continuous segment, an event window gets a segment of its own.
+  bool saveSensorWindow(float accelX[], float accelY[], float accelZ[],
+                        float gyroX[], float gyroY[], float gyroZ[],
+                        float temperature[], unsigned long timestamps[],
+                        int ringSize, int startIndex, int count,
+                        const SampleTimingSummary* timing,
+                        const SegmentEventInfo* event) {
     if (!initialized) return false;
     
-    char filePath[128];
-    sprintf(filePath, "%s%d.dat", dataPath, fileCounter);
+    OpenSegment window;
+    OpenSegment* seg = &active;
     
-    FILE* file = fopen(filePath, "w");
-    if (!file) {
-      Serial.println("Failed to open data file for writing");
-      return false;
+    if (event) {
+      // Event windows are written in one go straight to their segment
+      char filePath[128];
+      segmentPath(fileCounter, filePath);
+      window.buffer = windowBuffer;
+      window.bufferSize = WINDOW_BUFFER_SIZE;
+      if (!openSegment(window, filePath, SEGMENT_EVENT, sizeof(SensorDataPoint))) {
+        return false;
+      }
+      window.header.event = *event;
+      seg = &window;
+    } else {
+      // Rotate before the window would overflow the continuous segment
+      if (active.file && active.header.count + count > SEGMENT_MAX_RECORDS) {
+        closeSegment();
+      }
+      if (!active.file && !openSegment(active, activePath, SEGMENT_CONTINUOUS, sizeof(SensorDataPoint))) {
+        return false;
+      }
     }
     
-    // Write header with count
-    fwrite(&count, sizeof(count), 1, file);
-    
-    // Write the buffer data
     for (int i = 0; i < count; i++) {
+      int idx = (startIndex + i) % ringSize;
       SensorDataPoint dataPoint;
-      dataPoint.accelX = accelX[i];
-      dataPoint.accelY = accelY[i];
-      dataPoint.accelZ = accelZ[i];
-      dataPoint.gyroX = gyroX[i];
-      dataPoint.gyroY = gyroY[i];
-      dataPoint.gyroZ = gyroZ[i];
-      dataPoint.temperature = temperature[i];
-      dataPoint.timestamp = timestamps[i];
+      dataPoint.accelX = accelX[idx];
+      dataPoint.accelY = accelY[idx];
+      dataPoint.accelZ = accelZ[idx];
+      dataPoint.gyroX = gyroX[idx];
+      dataPoint.gyroY = gyroY[idx];
+      dataPoint.gyroZ = gyroZ[idx];
+      dataPoint.temperature = temperature[idx];
+      dataPoint.timestamp = timestamps[idx];
       
-      fwrite(&dataPoint, sizeof(SensorDataPoint), 1, file);
+      if (!appendRecord(*seg, &dataPoint, dataPoint.timestamp)) {
+        abandonSegment(*seg);
+        return false;
+      }
     }
     
-    fclose(file);
+    if (timing) {
+      mergeTimingSummary(&seg->header.timing, timing);
+    }
     
-    // Increment file counter for next time
-    fileCounter++;
+    if (event) {
+      if (!closeSegmentFile(window)) {
+        return false;
+      }
+      segmentCommitted(count);
+      
+      Serial.print("Saved ");
+      Serial.print(count);
+      Serial.print(" event data points to segment ");
+      Serial.println(fileCounter - 1);
+    } else if (syncPolicy == SYNC_EVERY_APPEND && !writeStaged(active, true)) {
+      abandonSegment(active);
+      return false;
+    }
+    
+    return true;
+  }
+
+  // Save spectrum summaries as a SEGMENT_SPECTRUM segment
+  bool saveSpectrumSegment(const SpectrumRecord* records, int count) {
+    if (!initialized || count <= 0) return false;
+    
+    char filePath[128];
+    segmentPath(fileCounter, filePath);
+    
+    OpenSegment seg;
+    seg.buffer = windowBuffer;
+    seg.bufferSize = WINDOW_BUFFER_SIZE;
+    if (!openSegment(seg, filePath, SEGMENT_SPECTRUM, sizeof(SpectrumRecord))) {
+      return false;
+    }
+    
+    for (int i = 0; i < count; i++) {
+      if (!appendRecord(seg, &records[i], records[i].timestamp)) {
+        abandonSegment(seg);
+        return false;
+      }
+    }
+    
+    if (!closeSegmentFile(seg)) {
+      return false;
+    }
+    segmentCommitted(count);
     
     Serial.print("Saved ");
     Serial.print(count);
-    Serial.print(" data points to file: ");
+    Serial.print(" spectrum summaries to file: ");
     Serial.println(filePath);
     
     return true;
@@ -204,6 +828,79 @@ public:
     }
   }
 
+  // Read a segment header from the start of an open file, leaving the file
+  // positioned at the first record. Files written before segment headers
+  // existed start with a bare record count and are reported with no timing.
+  // A placeholder header is replaced by the trailer after the records.
+  bool readSegmentHeader(FILE* file, SegmentHeader* header) {
+    if (!readLeadingHeader(file, header)) {
+      return false;
+    }
+    if (header->count != SEGMENT_COUNT_IN_TRAILER) {
+      return true;
+    }
+    
+    uint16_t headerSize = header->headerSize;
+    size_t known = min((size_t)headerSize, sizeof(SegmentHeader));
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    
+    memset(header, 0, sizeof(SegmentHeader));
+    if (size < 2L * headerSize ||
+        fseek(file, size - headerSize, SEEK_SET) != 0 ||
+        fread(header, known, 1, file) != 1 ||
+        header->magic != SEGMENT_MAGIC ||
+        header->headerSize != headerSize ||
+        header->count < 0 ||
+        2L * headerSize + (long)header->count * header->recordSize > size) {
+      // Never closed, only recoverActiveSegment() deals with these
+      return false;
+    }
+    
+    fseek(file, headerSize, SEEK_SET);
+    return true;
+  }
+
+  // Read the header at the start of a segment file as it is
+  bool readLeadingHeader(FILE* file, SegmentHeader* header) {
+    memset(header, 0, sizeof(SegmentHeader));
+    
+    uint32_t firstWord = 0;
+    if (fread(&firstWord, sizeof(firstWord), 1, file) != 1) {
+      return false;
+    }
+    
+    if (firstWord != SEGMENT_MAGIC) {
+      // Legacy layout: int count followed by records
+      header->headerSize = sizeof(int32_t);
+      header->count = (int32_t)firstWord;
+      header->recordSize = sizeof(SensorDataPoint);
+      return true;
+    }
+    
+    header->magic = firstWord;
+    if (fread(&header->version, sizeof(header->version), 1, file) != 1 ||
+        fread(&header->headerSize, sizeof(header->headerSize), 1, file) != 1) {
+      return false;
+    }
+    
+    // Headers only ever grow by appending fields. Read the part both sides
+    // know about, older headers leave the newer fields zeroed.
+    size_t known = min((size_t)header->headerSize, sizeof(SegmentHeader));
+    size_t prefix = offsetof(SegmentHeader, count);
+    if (known < prefix) {
+      return false;
+    }
+    if (known > prefix && fread((uint8_t*)header + prefix, known - prefix, 1, file) != 1) {
+      return false;
+    }
+    
+    // Skip any fields written by newer firmware
+    fseek(file, header->headerSize, SEEK_SET);
+    
+    return true;
+  }
+
   // Delete a file
   bool deleteFile(const char* filename) {
     if (!initialized) return false;
@@ -222,38 +919,69 @@ public:
     }
   }
   
-  // Read sensor data from a specified file
-  bool readSensorData(const char* filename, SensorDataPoint* dataBuffer, int maxPoints, int* pointsRead) {
+  // Read the header of a segment file
+  bool getSegmentHeader(const char* filename, SegmentHeader* header) {
     if (!initialized) return false;
     
     char filePath[128];
     sprintf(filePath, "%s/%s", MBED_LITTLEFS_FILE_PREFIX, filename);
     
+    FILE* file = fopen(filePath, "r");
+    if (!file) return false;
+    
+    bool ok = readSegmentHeader(file, header);
+    fclose(file);
+    return ok;
+  }
+  
+  // Open a segment file positioned at its first record. Fails if the
+  // segment holds records of a different size. The caller closes the file.
+  FILE* openSegmentRecords(const char* filename, size_t recordSize, SegmentHeader* header) {
+    if (!initialized) return NULL;
+    
+    char filePath[128];
+    sprintf(filePath, "%s/%s", MBED_LITTLEFS_FILE_PREFIX, filename);
+    
     FILE* file = fopen(filePath, "r");
     if (!file) {
       Serial.print("Failed to open data file for reading: ");
       Serial.println(filePath);
-      return false;
+      return NULL;
     }
     
-    // Read the count header
-    int count = 0;
-    size_t bytesRead = fread(&count, sizeof(count), 1, file);
-    if (bytesRead != 1) {
-      Serial.println("Failed to read count header");
+    // Read the segment header, this leaves the file at the first record
+    if (!readSegmentHeader(file, header)) {
+      Serial.println("Failed to read segment header");
       fclose(file);
-      return false;
+      return NULL;
     }
     
-    // Limit to maxPoints
-    int pointsToRead = min(count, maxPoints);
-    *pointsRead = pointsToRead;
+    if (header->recordSize != recordSize) {
+      Serial.print("Unexpected record size in ");
+      Serial.println(filePath);
+      fclose(file);
+      return NULL;
+    }
     
-    // Read the data points
-    for (int i = 0; i < pointsToRead; i++) {
-      bytesRead = fread(&dataBuffer[i], sizeof(SensorDataPoint), 1, file);
-      if (bytesRead != 1) {
-        Serial.print("Error reading data point ");
+    return file;
+  }
+  
+  // Read up to maxRecords records of recordSize bytes from a segment file.
+  // Fails if the segment holds records of a different size.
+  bool readSegmentRecords(const char* filename, void* records, size_t recordSize,
+                          int maxRecords, int* recordsRead) {
+    SegmentHeader header;
+    FILE* file = openSegmentRecords(filename, recordSize, &header);
+    if (!file) return false;
+    
+    // Limit to maxRecords
+    int toRead = min((int)header.count, maxRecords);
+    *recordsRead = toRead;
+    
+    // Read the records
+    for (int i = 0; i < toRead; i++) {
+      if (fread((uint8_t*)records + i * recordSize, recordSize, 1, file) != 1) {
+        Serial.print("Error reading record ");
         Serial.println(i);
         fclose(file);
         return false;
@@ -263,13 +991,28 @@ public:
     fclose(file);
     
     Serial.print("Read ");
-    Serial.print(pointsToRead);
-    Serial.print(" data points from file: ");
-    Serial.println(filePath);
+    Serial.print(toRead);
+    Serial.print(" records from file: ");
+    Serial.println(filename);
     
     return true;
   }
   
+  // Read sensor data from a specified file
+  bool readSensorData(const char* filename, SensorDataPoint* dataBuffer, int maxPoints, int* pointsRead) {
+    return readSegmentRecords(filename, dataBuffer, sizeof(SensorDataPoint), maxPoints, pointsRead);
+  }
+  
+  // Read spectrum summaries from a SEGMENT_SPECTRUM file
+  bool readSpectrumData(const char* filename, SpectrumRecord* dataBuffer, int maxRecords, int* recordsRead) {
+    return readSegmentRecords(filename, dataBuffer, sizeof(SpectrumRecord), maxRecords, recordsRead);
+  }
+  
+  // Read downsampled records from a SEGMENT_SUMMARY file
+  bool readSummaryData(const char* filename, SummaryRecord* dataBuffer, int maxRecords, int* recordsRead) {
+    return readSegmentRecords(filename, dataBuffer, sizeof(SummaryRecord), maxRecords, recordsRead);
+  }
+  
   // List all data files and their sizes - simplified method without directory listing
   void listDataFiles() {
     if (!initialized) {
@@ -279,12 +1022,10 @@ public:
     
     Serial.println("\nData Files:");
     
-    // Use a simpler approach - just try to open each potential file
-    char knownPrefix[] = MBED_LITTLEFS_FILE_PREFIX "/sensor_data_";
-    
-    for (int i = 0; i < 10; i++) {  // Try the first 10 possible data files
+    // Use a simpler approach - just try to open each cataloged file
+    for (uint32_t i = catalog.firstSegment; i < catalog.nextSegment; i++) {
       char filename[64];
-      sprintf(filename, "%s%d.dat", knownPrefix, i);
+      segmentPath(i, filename);
       
       FILE* file = fopen(filename, "r");
       if (file) {
@@ -292,10 +1033,10 @@ public:
         fseek(file, 0, SEEK_END);
         long size = ftell(file);
         
-        // Try to read the count header to determine number of records
+        // Read the segment header to determine number of records
         fseek(file, 0, SEEK_SET);
-        int count = 0;
-        fread(&count, sizeof(count), 1, file);
+        SegmentHeader header;
+        bool haveHeader = readSegmentHeader(file, &header);
         
         fclose(file);
         
@@ -304,8 +1045,16 @@ public:
         Serial.print("  (");
         Serial.print(size);
         Serial.print(" bytes, ~");
-        Serial.print(count);
-        Serial.println(" records)");
+        Serial.print(haveHeader ? (int)header.count : 0);
+        Serial.print(" records");
+        if (haveHeader && header.timing.samples > 0) {
+          Serial.print(", max gap ");
+          Serial.print((unsigned long)header.timing.maxGapUs / 1000);
+          Serial.print(" ms, ");
+          Serial.print((unsigned long)header.timing.lateSamples);
+          Serial.print(" late");
+        }
+        Serial.println(")");
       }
     }
   }
@@ -5,13 +5,26 @@
 #include "secrets.h"
 #include "web_files.h"
 #include "littlefs_storage.h"
+#include "segment_uploader.h"
+#include "segment_retention.h"
+
+// Collector for background segment uploads. Define COLLECTOR_HOST in
+// secrets.h to enable them, or set it later through /upload.
+#ifndef COLLECTOR_HOST
+#define COLLECTOR_HOST ""
+#endif
+#ifndef COLLECTOR_PORT
+#define COLLECTOR_PORT 8080
+#endif
 
 WiFiServer server(80);
 LittleFSStorage flashStorage;
+SegmentUploader segmentUploader(flashStorage);
+SegmentRetention segmentRetention(flashStorage);
 
-// Define the data flush interval (in milliseconds)
-const unsigned long DATA_FLUSH_INTERVAL = 60000; // 1 minute
-unsigned long lastFlushTime = 0;
+// Continuous mode appends new samples once this much of the ring has filled,
+// well before the sampler comes round to overwrite them
+const int DATA_FLUSH_SAMPLES = BUFFER_SIZE / 2;
 
 void printFileInfo(const char* name, const uint8_t* content, size_t length) {
     Serial.print("\nFile info for ");
@@ -40,7 +53,8 @@ void setup() {
 
   Serial.println("\n=== IMU Data Collection Starting ===");
   
-  // Initialize flash storage
+  // Initialize flash storage. Staged samples are synced at least every 10 s.
+  flashStorage.setSyncPolicy(SYNC_PERIODIC, 10000);
   if (!flashStorage.begin()) {
     Serial.println("Failed to initialize flash storage! Check your configuration.");
     // Proceed even if storage fails - we can still collect and transmit data
@@ -71,6 +85,7 @@ void setup() {
     Serial.println("Failed to setup sensor! Check wiring.");
     while(1); // Stop if sensor setup fails
   }
+  setupSpectrum();
 
   // Connect to WiFi
   while (WiFi.status() != WL_CONNECTED) {
@@ -86,32 +101,67 @@ void setup() {
 
   server.begin();
   Serial.println("Server started");
+
+  segmentUploader.begin(COLLECTOR_HOST, COLLECTOR_PORT);
 }
 
 void loop() {
   // Update IMU sensor readings
+  sampleProfiler.beginPhase(PHASE_SENSOR);
   updateSensor();
+  sampleProfiler.endPhase(PHASE_SENSOR);
+
+  // Vibration spectrum once per window of new samples
+  sampleProfiler.beginPhase(PHASE_SPECTRUM);
+  updateSpectrum(flashStorage);
+  sampleProfiler.endPhase(PHASE_SPECTRUM);
 
   // Handle any incoming client connections
+  sampleProfiler.beginPhase(PHASE_HTTP);
   WiFiClient client = server.available();
   if (client) {
     handleClient(client);
   }
+  sampleProfiler.endPhase(PHASE_HTTP);
   
-  // Check if it's time to flush data to flash storage
-  unsigned long currentTime = millis();
-  if (currentTime - lastFlushTime >= DATA_FLUSH_INTERVAL) {
-    // Flush sensor data to flash storage
-    flashStorage.saveSensorBuffers(
+  // In event mode only completed event windows are stored. They must be
+  // committed before the next sample overwrites the oldest part of them.
+  if (captureMode == CAPTURE_EVENT && eventWindowReady) {
+    sampleProfiler.beginPhase(PHASE_FLUSH);
+    commitEventWindow(flashStorage);
+    sampleProfiler.endPhase(PHASE_FLUSH);
+  }
+  
+  // Append the samples taken since the last flush to the open segment, then
+  // sync staged samples and rotate the segment when due
+  sampleProfiler.beginPhase(PHASE_FLUSH);
+  int newSamples = (bufferIndex - flushedIndex + BUFFER_SIZE) % BUFFER_SIZE;
+  if (captureMode == CAPTURE_CONTINUOUS && newSamples >= DATA_FLUSH_SAMPLES) {
+    // Summarize sampling regularity for the segment header
+    SampleTimingSummary timing;
+    sampleProfiler.takeSegmentSummary(newSamples, &timing);
+    
+    flashStorage.saveSensorWindow(
       accelX_buffer, accelY_buffer, accelZ_buffer,
       gyroX_buffer, gyroY_buffer, gyroZ_buffer,
       temperature_buffer, timestamp_buffer,
-      BUFFER_SIZE
+      BUFFER_SIZE, flushedIndex, newSamples,
+      &timing, NULL
     );
     
-    lastFlushTime = currentTime;
+    flushedIndex = bufferIndex;
   }
+  flashStorage.update();
+  segmentRetention.update();
+  sampleProfiler.endPhase(PHASE_FLUSH);
+  
+  // Push completed segments to the collector, a slice per loop
+  sampleProfiler.beginPhase(PHASE_UPLOAD);
+  segmentUploader.update();
+  sampleProfiler.endPhase(PHASE_UPLOAD);
   
   // Add a small delay to prevent overwhelming the IMU
+  sampleProfiler.beginPhase(PHASE_IDLE);
   delay(50);
+  sampleProfiler.endPhase(PHASE_IDLE);
 }
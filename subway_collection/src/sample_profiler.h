@@ -0,0 +1,211 @@
+#ifndef SAMPLE_PROFILER_H
+#define SAMPLE_PROFILER_H
+
+#include <Arduino.h>
+#include "segment_format.h"
+
+// Phases of the main loop that are timed separately
+enum LoopPhase {
+  PHASE_SENSOR = 0,
+  PHASE_HTTP,
+  PHASE_FLUSH,
+  PHASE_SPECTRUM,
+  PHASE_UPLOAD,
+  PHASE_IDLE,
+  PHASE_COUNT
+};
+
+const char* const LOOP_PHASE_NAMES[PHASE_COUNT] = {
+  "sensor", "http", "flush", "spectrum", "upload", "idle"
+};
+
+// The loop samples about every 50 ms. A sample taken later than this after
+// the one before missed its slot, the loop overran the sampling period.
+const unsigned long SAMPLE_DEADLINE_US = 100000;
+
+// Newest samples whose timing is kept, at least the sample ring
+#define SAMPLE_HISTORY 128
+
+struct SampleTiming {
+  uint32_t intervalUs;       // Since the sample before, 0 for the first one
+  bool stale;                // No fresh accelerometer reading
+};
+
+struct PhaseStats {
+  unsigned long calls;
+  unsigned long lastUs;
+  unsigned long maxUs;
+  unsigned long long totalUs;
+};
+
+// Tracks how regularly updateSensor() actually runs. Sample times are taken
+// with micros() before the IMU is read so flush and HTTP stalls show up as
+// gaps instead of being hidden behind the reads. The timing of the newest
+// samples is kept, so a segment summary covers exactly the samples stored.
+class SampleProfiler {
+private:
+  // Lifetime counters
+  unsigned long totalSamples = 0;
+  unsigned long totalLate = 0;
+  unsigned long totalStale = 0;
+  unsigned long lifetimeMaxGapUs = 0;
+  unsigned long lifetimeHistogram[INTERVAL_BUCKET_COUNT];
+
+  // Newest samples, and how many were taken since the last segment summary
+  SampleTiming history[SAMPLE_HISTORY];
+  unsigned long historyHead = 0;
+  unsigned long historyCount = 0;
+  unsigned long sinceSummary = 0;
+
+  unsigned long lastSampleUs = 0;
+  bool haveLastSample = false;
+
+  PhaseStats phases[PHASE_COUNT];
+  unsigned long phaseStartUs[PHASE_COUNT];
+
+  static int bucketFor(unsigned long intervalUs) {
+    unsigned long intervalMs = intervalUs / 1000;
+    for (int i = 0; i < INTERVAL_BUCKET_COUNT - 1; i++) {
+      if (intervalMs < INTERVAL_BUCKET_MS[i]) return i;
+    }
+    return INTERVAL_BUCKET_COUNT - 1;
+  }
+
+  // Timing of the newest count samples, at most SAMPLE_HISTORY
+  void summarizeNewest(unsigned long count, SampleTimingSummary* summary) {
+    memset(summary, 0, sizeof(SampleTimingSummary));
+    count = min(count, historyCount);
+    
+    unsigned long long intervalSumUs = 0;
+    unsigned long intervals = 0;
+    for (unsigned long i = 0; i < count; i++) {
+      const SampleTiming& sample = history[(historyHead + SAMPLE_HISTORY - 1 - i) % SAMPLE_HISTORY];
+      summary->samples++;
+      if (sample.stale) summary->staleSamples++;
+      if (sample.intervalUs == 0) continue;
+      
+      int bucket = bucketFor(sample.intervalUs);
+      if (summary->histogram[bucket] < 0xFFFF) summary->histogram[bucket]++;
+      if (sample.intervalUs > SAMPLE_DEADLINE_US) summary->lateSamples++;
+      if (sample.intervalUs > summary->maxGapUs) summary->maxGapUs = sample.intervalUs;
+      if (intervals == 0 || sample.intervalUs < summary->minIntervalUs) summary->minIntervalUs = sample.intervalUs;
+      intervalSumUs += sample.intervalUs;
+      intervals++;
+    }
+    if (intervals > 0) summary->meanIntervalUs = intervalSumUs / intervals;
+  }
+
+public:
+  SampleProfiler() {
+    memset(lifetimeHistogram, 0, sizeof(lifetimeHistogram));
+    memset(phases, 0, sizeof(phases));
+    memset(phaseStartUs, 0, sizeof(phaseStartUs));
+  }
+
+  // Record one sample taken at sampleUs (micros() before the reads)
+  void recordSample(unsigned long sampleUs, bool freshAccel) {
+    totalSamples++;
+    sinceSummary++;
+    if (!freshAccel) totalStale++;
+
+    SampleTiming& sample = history[historyHead];
+    sample.intervalUs = 0;
+    sample.stale = !freshAccel;
+    if (haveLastSample) {
+      unsigned long interval = sampleUs - lastSampleUs;
+      lifetimeHistogram[bucketFor(interval)]++;
+      if (interval > lifetimeMaxGapUs) lifetimeMaxGapUs = interval;
+      if (interval > SAMPLE_DEADLINE_US) totalLate++;
+      sample.intervalUs = max(interval, 1UL);
+    }
+    historyHead = (historyHead + 1) % SAMPLE_HISTORY;
+    if (historyCount < SAMPLE_HISTORY) historyCount++;
+
+    lastSampleUs = sampleUs;
+    haveLastSample = true;
+  }
+
+  // Summarize the newest savedSamples samples, the ones a flush or an event
+  // window is about to store
+  void takeSegmentSummary(unsigned long savedSamples, SampleTimingSummary* summary) {
+    summarizeNewest(savedSamples, summary);
+    sinceSummary = 0;
+  }
+
+  unsigned long samples() { return totalSamples; }
+  unsigned long lateSamples() { return totalLate; }
+  const PhaseStats& phaseStats(LoopPhase phase) { return phases[phase]; }
+
+  void beginPhase(LoopPhase phase) {
+    phaseStartUs[phase] = micros();
+  }
+
+  void endPhase(LoopPhase phase) {
+    unsigned long elapsed = micros() - phaseStartUs[phase];
+    PhaseStats& stats = phases[phase];
+    stats.calls++;
+    stats.lastUs = elapsed;
+    stats.totalUs += elapsed;
+    if (elapsed > stats.maxUs) stats.maxUs = elapsed;
+  }
+
+  // Write the profile as a JSON object
+  void printJson(Print& out) {
+    out.print("{\"samples\":");
+    out.print(totalSamples);
+    out.print(",\"lateSamples\":");
+    out.print(totalLate);
+    out.print(",\"staleSamples\":");
+    out.print(totalStale);
+    out.print(",\"maxGapUs\":");
+    out.print(lifetimeMaxGapUs);
+
+    // Stats for the segment that is still being collected, as far as the
+    // history reaches
+    SampleTimingSummary window;
+    summarizeNewest(sinceSummary, &window);
+    out.print(",\"window\":{\"samples\":");
+    out.print(sinceSummary);
+    out.print(",\"maxGapUs\":");
+    out.print((unsigned long)window.maxGapUs);
+    out.print(",\"meanIntervalUs\":");
+    out.print((unsigned long)window.meanIntervalUs);
+    out.print("}");
+
+    out.print(",\"histogram\":[");
+    for (int i = 0; i < INTERVAL_BUCKET_COUNT; i++) {
+      if (i > 0) out.print(",");
+      out.print("{\"ltMs\":");
+      if (i < INTERVAL_BUCKET_COUNT - 1) {
+        out.print((unsigned int)INTERVAL_BUCKET_MS[i]);
+      } else {
+        out.print("null");
+      }
+      out.print(",\"count\":");
+      out.print(lifetimeHistogram[i]);
+      out.print("}");
+    }
+    out.print("]");
+
+    out.print(",\"phases\":{");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+      if (i > 0) out.print(",");
+      out.print("\"");
+      out.print(LOOP_PHASE_NAMES[i]);
+      out.print("\":{\"calls\":");
+      out.print(phases[i].calls);
+      out.print(",\"lastUs\":");
+      out.print(phases[i].lastUs);
+      out.print(",\"maxUs\":");
+      out.print(phases[i].maxUs);
+      out.print(",\"totalMs\":");
+      out.print((unsigned long)(phases[i].totalUs / 1000));
+      out.print("}");
+    }
+    out.println("}}");
+  }
+};
+
+SampleProfiler sampleProfiler;
+
+#endif // SAMPLE_PROFILER_H
@@ -0,0 +1,243 @@
+#ifndef SEGMENT_EXPORT_H
+#define SEGMENT_EXPORT_H
+
+#include <WiFiNINA.h>
+#include "littlefs_storage.h"
+#include "segment_format.h"
+
+// Which segments an export covers. Pinning first/last keeps the archive
+// byte-identical between an interrupted download and its resume.
+struct ExportSelection {
+  uint32_t firstSegment;
+  uint32_t lastSegment;      // Inclusive
+  uint32_t fromTime;         // Keep segments overlapping [fromTime, toTime]
+  uint32_t toTime;
+};
+
+// Size of a segment file if it belongs in the export, 0 otherwise
+long exportedSegmentSize(LittleFSStorage &storage, uint32_t index, const ExportSelection &selection) {
+  char filePath[128];
+  storage.segmentPath(index, filePath);
+  
+  FILE* file = fopen(filePath, "r");
+  if (!file) return 0;
+  
+  SegmentHeader header;
+  bool haveHeader = storage.readSegmentHeader(file, &header);
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  
+  if (!haveHeader) return 0;
+  
+  // Legacy segments carry no times, keep them unless a time range was asked for
+  bool timed = header.endTime != 0;
+  if (timed && (header.endTime < selection.fromTime || header.startTime > selection.toTime)) {
+    return 0;
+  }
+  if (!timed && (selection.fromTime != 0 || selection.toTime != 0xFFFFFFFF)) {
+    return 0;
+  }
+  
+  return size;
+}
+
+// Streams the byte range [rangeStart, rangeEnd] of a virtual archive
+// while the archive is generated front to back
+class ExportStream {
+private:
+  WiFiClient &client;
+  unsigned long offset = 0;      // Archive position of the next byte generated
+  unsigned long rangeStart;
+  unsigned long rangeEnd;
+  bool failed = false;
+
+public:
+  ExportStream(WiFiClient &c, unsigned long start, unsigned long end)
+    : client(c), rangeStart(start), rangeEnd(end) {}
+
+  bool done() { return failed || offset > rangeEnd; }
+
+  // Send the part of a generated block that falls in the range
+  void emit(const uint8_t* data, size_t length) {
+    unsigned long blockEnd = offset + length;
+    if (blockEnd > rangeStart && offset <= rangeEnd && !failed) {
+      size_t skip = offset < rangeStart ? rangeStart - offset : 0;
+      size_t send = min((unsigned long)(length - skip), rangeEnd + 1 - (offset + skip));
+      if (client.write(data + skip, send) != send) {
+        failed = true;
+      }
+    }
+    offset = blockEnd;
+  }
+
+  // Send a segment file, only reading the parts that fall in the range
+  void emitFile(const char* filePath, unsigned long length) {
+    unsigned long fileEnd = offset + length;
+    if (fileEnd <= rangeStart || offset > rangeEnd || failed) {
+      offset = fileEnd;
+      return;
+    }
+    
+    FILE* file = fopen(filePath, "r");
+    if (!file) {
+      failed = true;
+      return;
+    }
+    
+    unsigned long position = offset < rangeStart ? rangeStart - offset : 0;
+    fseek(file, position, SEEK_SET);
+    offset += position;
+    
+    static uint8_t chunk[512];
+    while (position < length && !done()) {
+      size_t toRead = min((unsigned long)sizeof(chunk), length - position);
+      size_t got = fread(chunk, 1, toRead, file);
+      if (got == 0) {
+        failed = true;
+        break;
+      }
+      emit(chunk, got);
+      position += got;
+    }
+    fclose(file);
+    
+    offset = fileEnd;
+  }
+};
+
+// Strong validator for an export. The archive only changes when its first
+// segment is evicted, a segment is closed inside an open-ended selection,
+// or retention rewrites a segment, so those make up the tag.
+void exportETag(char* tag, size_t size, uint32_t firstSegment, uint32_t endSegment, uint32_t rewrites) {
+  snprintf(tag, size, "\"%lu-%lu-%lu\"", (unsigned long)firstSegment,
+           (unsigned long)endSegment, (unsigned long)rewrites);
+}
+
+// Parse "bytes=start-end", "bytes=start-" or "bytes=-suffix". Returns false
+// if the header is absent or unusable, in which case the whole archive is sent.
+bool parseByteRange(const String &range, unsigned long total, unsigned long* start, unsigned long* end) {
+  if (!range.startsWith("bytes=") || total == 0) return false;
+  
+  String spec = range.substring(6);
+  int dash = spec.indexOf('-');
+  if (dash < 0 || spec.indexOf(',') >= 0) return false;  // Multiple ranges not supported
+  
+  String first = spec.substring(0, dash);
+  String last = spec.substring(dash + 1);
+  
+  if (first.length() == 0) {
+    unsigned long suffix = strtoul(last.c_str(), NULL, 10);
+    if (suffix == 0) return false;
+    *start = suffix >= total ? 0 : total - suffix;
+    *end = total - 1;
+    return true;
+  }
+  
+  *start = strtoul(first.c_str(), NULL, 10);
+  *end = last.length() > 0 ? strtoul(last.c_str(), NULL, 10) : total - 1;
+  if (*end >= total) *end = total - 1;
+  return true;
+}
+
+// Serve the archive, or the Range of it asked for. A Range is only honoured
+// if If-Range is absent or still matches the ETag, otherwise the archive
+// changed since the download started and it is sent in full.
+void serveStorageExport(WiFiClient &client, LittleFSStorage &storage,
+                        const ExportSelection &selection, const String &range,
+                        const String &ifRange) {
+  // Segments the archive covers, [firstSegment, endSegment)
+  uint32_t firstSegment = max(selection.firstSegment, storage.firstSegment());
+  uint32_t endSegment = selection.lastSegment < storage.nextSegment() ? selection.lastSegment + 1
+                                                                      : storage.nextSegment();
+  char etag[40];
+  exportETag(etag, sizeof(etag), firstSegment, endSegment, storage.rewrites());
+  
+  // First pass: size of the archive
+  unsigned long total = sizeof(ArchiveHeader);
+  uint32_t segments = 0;
+  for (uint32_t i = firstSegment; i < endSegment; i++) {
+    long size = exportedSegmentSize(storage, i, selection);
+    if (size > 0) {
+      total += sizeof(ArchiveEntryHeader) + size;
+      segments++;
+    }
+  }
+  
+  unsigned long start = 0;
+  unsigned long end = total - 1;
+  bool partial = (ifRange.length() == 0 || ifRange == etag) &&
+                 parseByteRange(range, total, &start, &end);
+  
+  if (partial && start > end) {
+    client.println("HTTP/1.1 416 Range Not Satisfiable");
+    client.print("Content-Range: bytes */");
+    client.println(total);
+    client.print("ETag: ");
+    client.println(etag);
+    client.println("Access-Control-Allow-Origin: *");
+    client.println();
+    return;
+  }
+  
+  client.println(partial ? "HTTP/1.1 206 Partial Content" : "HTTP/1.1 200 OK");
+  client.println("Content-Type: application/octet-stream");
+  client.println("Content-Disposition: attachment; filename=\"segments.sar\"");
+  client.println("Accept-Ranges: bytes");
+  client.print("Content-Length: ");
+  client.println(end - start + 1);
+  if (partial) {
+    client.print("Content-Range: bytes ");
+    client.print(start);
+    client.print("-");
+    client.print(end);
+    client.print("/");
+    client.println(total);
+  }
+  client.print("ETag: ");
+  client.println(etag);
+  // Segment range to pin when resuming, none while nothing was closed
+  if (endSegment > firstSegment) {
+    client.print("X-Segment-Range: ");
+    client.print((unsigned long)firstSegment);
+    client.print("-");
+    client.println((unsigned long)(endSegment - 1));
+  }
+  client.println("Access-Control-Allow-Origin: *");
+  client.println();
+  
+  Serial.print("Exporting ");
+  Serial.print(segments);
+  Serial.print(" segments, bytes ");
+  Serial.print(start);
+  Serial.print("-");
+  Serial.println(end);
+  
+  // Second pass: generate the archive and send the requested bytes
+  ExportStream stream(client, start, end);
+  
+  ArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = ARCHIVE_MAGIC;
+  header.version = ARCHIVE_VERSION;
+  header.headerSize = sizeof(ArchiveHeader);
+  WiFi.macAddress(header.deviceMac);
+  stream.emit((const uint8_t*)&header, sizeof(header));
+  
+  for (uint32_t i = firstSegment; i < endSegment && !stream.done(); i++) {
+    long size = exportedSegmentSize(storage, i, selection);
+    if (size <= 0) continue;
+    
+    ArchiveEntryHeader entry;
+    entry.magic = ARCHIVE_ENTRY_MAGIC;
+    entry.segmentIndex = i;
+    entry.length = size;
+    stream.emit((const uint8_t*)&entry, sizeof(entry));
+    
+    char filePath[128];
+    storage.segmentPath(i, filePath);
+    stream.emitFile(filePath, size);
+  }
+}
+
+#endif // SEGMENT_EXPORT_H
@@ -0,0 +1,159 @@
+#ifndef SEGMENT_FORMAT_H
+#define SEGMENT_FORMAT_H
+
+// On-flash layout of stored sensor data segments.
+// Only fixed-width types are used here so the same definitions can be
+// shared with host-side tools that read the files back.
+
+#include <stdint.h>
+
+// Magic number at the start of every segment file (ASCII 'SEG1')
+#define SEGMENT_MAGIC 0x53454731
+#define SEGMENT_VERSION 2
+
+// Placeholder count, the final header follows the records as a trailer
+#define SEGMENT_COUNT_IN_TRAILER -1
+
+// One IMU sample as stored in SEGMENT_CONTINUOUS and SEGMENT_EVENT segments
+struct SensorDataPoint {
+  float accelX;
+  float accelY;
+  float accelZ;
+  float gyroX;
+  float gyroY;
+  float gyroZ;
+  float temperature;
+  uint32_t timestamp;
+};
+
+// Inter-sample interval histogram bucket upper bounds in milliseconds.
+// Anything slower than the last bound lands in the final overflow bucket.
+#define INTERVAL_BUCKET_COUNT 8
+static const uint16_t INTERVAL_BUCKET_MS[INTERVAL_BUCKET_COUNT - 1] = {
+  25, 50, 75, 100, 250, 500, 1000
+};
+
+// Summary of how regularly the sensor was sampled while a segment's
+// data was being collected
+struct SampleTimingSummary {
+  uint32_t samples;          // Samples taken during the segment window
+  uint32_t lateSamples;      // Samples taken past SAMPLE_DEADLINE_US after the one before
+  uint32_t staleSamples;     // Samples taken without a fresh accelerometer reading
+  uint32_t minIntervalUs;    // Shortest gap between two samples
+  uint32_t meanIntervalUs;   // Average gap between two samples
+  uint32_t maxGapUs;         // Longest gap between two samples
+  uint16_t histogram[INTERVAL_BUCKET_COUNT]; // Interval counts per bucket
+};
+
+// What produced the records in a segment
+enum SegmentKind {
+  SEGMENT_CONTINUOUS = 0,    // Periodic flush of the sample ring
+  SEGMENT_EVENT = 1,         // Window around a detected ride event
+  SEGMENT_SPECTRUM = 2,      // Vibration spectrum summaries instead of samples
+  SEGMENT_SUMMARY = 3        // Sample segment downsampled by retention to free flash
+};
+
+// Ride events detected by the capture trigger
+enum CaptureEventType {
+  EVENT_NONE = 0,
+  EVENT_ACCEL = 1,           // Braking or accelerating along the track
+  EVENT_CURVE = 2,           // Sustained rotation, usually a curve
+  EVENT_STOP = 3             // Motion settled, usually a station stop
+};
+
+// Set when an event outlasted one window and this segment carries on from the previous one
+#define EVENT_FLAG_CONTINUED 0x0001
+
+// Metadata for SEGMENT_EVENT segments
+struct SegmentEventInfo {
+  uint16_t type;             // CaptureEventType
+  uint16_t flags;            // EVENT_FLAG_*
+  uint32_t triggerTime;      // Timestamp of the sample that fired the trigger
+  uint16_t preTriggerSamples; // Records stored from before the trigger
+  uint16_t reserved;
+  float peakAccel;           // Peak dynamic acceleration in the window (g)
+  float peakGyro;            // Peak rotation rate in the window (deg/s)
+  float accelThreshold;      // Acceleration threshold in effect at the trigger (g)
+};
+
+// Layout of SEGMENT_SPECTRUM records
+#define SPECTRUM_AXES 3            // Accelerometer X, Y, Z
+#define SPECTRUM_BANDS 8           // Equal-width bands between DC and Nyquist
+#define SPECTRUM_PEAKS 3           // Strongest bins kept per axis
+
+// Spectrum summary of one window of accelerometer samples. Values are in
+// FFT output counts; countsPerG converts them back to acceleration.
+struct SpectrumRecord {
+  uint32_t timestamp;              // Timestamp of the newest sample in the window
+  uint16_t sampleRateCentiHz;      // Measured sample rate in 0.01 Hz
+  uint16_t windowSize;             // FFT length in samples
+  uint16_t countsPerG;             // Input scaling used for the FFT
+  uint16_t reserved;
+  uint32_t bandPower[SPECTRUM_AXES][SPECTRUM_BANDS];  // Sum of |X[k]|^2 per band
+  uint16_t peakMagnitude[SPECTRUM_AXES][SPECTRUM_PEAKS];
+  uint8_t peakBin[SPECTRUM_AXES][SPECTRUM_PEAKS];     // Frequency is bin * rate / windowSize
+  uint8_t padding;
+};
+
+// Samples folded into one SEGMENT_SUMMARY record, about a second of data
+#define SUMMARY_FACTOR 20
+
+// One SEGMENT_SUMMARY record. The segment keeps the header of the sample
+// segment it replaced apart from kind, count and recordSize.
+struct SummaryRecord {
+  uint32_t startTime;        // Timestamp of the first sample summarized
+  uint32_t endTime;          // Timestamp of the last sample summarized
+  uint16_t samples;          // Samples folded into this record
+  uint16_t reserved;
+  float accelMean[3];        // g
+  float accelMin[3];
+  float accelMax[3];
+  float gyroMean[3];         // deg/s
+  float gyroPeak[3];         // Largest absolute rotation rate per axis
+  float temperature;         // Mean
+};
+
+// Header written at the start of every segment file. Older firmware only
+// wrote a 4 byte record count, readers must handle both.
+//
+// A segment too large to finish in RAM starts with a placeholder whose count
+// is SEGMENT_COUNT_IN_TRAILER. The final header is appended after the
+// records when the segment closes, so the file is written front to back.
+struct SegmentHeader {
+  uint32_t magic;            // SEGMENT_MAGIC
+  uint16_t version;          // SEGMENT_VERSION at the time of writing
+  uint16_t headerSize;       // Size of this header on flash, records start after it
+  int32_t count;             // Number of records following the header
+  uint32_t recordSize;       // Size of one record in bytes
+  uint32_t startTime;        // Timestamp of the oldest record
+  uint32_t endTime;          // Timestamp of the newest record
+  SampleTimingSummary timing;
+  // Version 2
+  uint16_t kind;             // SegmentKind
+  uint16_t reserved;
+  SegmentEventInfo event;    // Zeroed unless kind is SEGMENT_EVENT
+};
+
+// Bulk export archive served by /storage/export. An ArchiveHeader is
+// followed by entries until the end of the stream, each an
+// ArchiveEntryHeader and then the segment file exactly as stored on flash.
+// Entries only ever append, so a byte offset stays valid across resumes.
+#define ARCHIVE_MAGIC 0x53415231        // 'SAR1'
+#define ARCHIVE_ENTRY_MAGIC 0x53454745  // 'SEGE'
+#define ARCHIVE_VERSION 1
+
+struct ArchiveHeader {
+  uint32_t magic;            // ARCHIVE_MAGIC
+  uint16_t version;          // ARCHIVE_VERSION
+  uint16_t headerSize;       // Entries start after this many bytes
+  uint8_t deviceMac[6];      // Which unit the data came from
+  uint16_t reserved;
+};
+
+struct ArchiveEntryHeader {
+  uint32_t magic;            // ARCHIVE_ENTRY_MAGIC
+  uint32_t segmentIndex;     // Position in the device's segment sequence
+  uint32_t length;           // Bytes of segment file that follow
+};
+
+#endif // SEGMENT_FORMAT_H
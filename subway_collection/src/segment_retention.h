@@ -0,0 +1,347 @@
+#ifndef SEGMENT_RETENTION_H
+#define SEGMENT_RETENTION_H
+
+#include <Arduino.h>
+#include "littlefs_storage.h"
+#include "segment_format.h"
+
+// Which segments retention may delete when flash runs short
+enum EvictionPolicy {
+  EVICT_OLDEST = 0,          // Oldest first, uploaded or not, so recording never stops
+  EVICT_UPLOADED_ONLY        // Only segments the collector acknowledged, unsent data is kept
+};
+
+const char* const EVICTION_POLICY_NAMES[] = { "oldest", "uploaded" };
+
+// Free space kept for the open segment, event windows and filesystem metadata
+const unsigned long RETENTION_RESERVE_BYTES = 20480;
+const unsigned long RETENTION_CHECK_MS = 5000;
+
+// Fold count samples into one summary record
+void summarizeSamples(const SensorDataPoint* points, int count, SummaryRecord* summary) {
+  memset(summary, 0, sizeof(SummaryRecord));
+  summary->startTime = points[0].timestamp;
+  summary->endTime = points[count - 1].timestamp;
+  summary->samples = count;
+
+  for (int axis = 0; axis < 3; axis++) {
+    summary->accelMin[axis] = 1e9;
+    summary->accelMax[axis] = -1e9;
+  }
+
+  for (int i = 0; i < count; i++) {
+    const float accel[3] = { points[i].accelX, points[i].accelY, points[i].accelZ };
+    const float gyro[3] = { points[i].gyroX, points[i].gyroY, points[i].gyroZ };
+    for (int axis = 0; axis < 3; axis++) {
+      summary->accelMean[axis] += accel[axis];
+      summary->accelMin[axis] = min(summary->accelMin[axis], accel[axis]);
+      summary->accelMax[axis] = max(summary->accelMax[axis], accel[axis]);
+      summary->gyroMean[axis] += gyro[axis];
+      summary->gyroPeak[axis] = max(summary->gyroPeak[axis], (float)fabs(gyro[axis]));
+    }
+    summary->temperature += points[i].temperature;
+  }
+
+  for (int axis = 0; axis < 3; axis++) {
+    summary->accelMean[axis] /= count;
+    summary->gyroMean[axis] /= count;
+  }
+  summary->temperature /= count;
+}
+
+// Keeps stored segments within a byte budget so a unit left running keeps
+// recording. Acknowledged segments are deleted first. Unsent sample segments
+// are downsampled into SEGMENT_SUMMARY segments before anything unsent is
+// deleted. Eviction always takes the oldest segment, so flash is rewritten
+// front to back like a ring and LittleFS spreads the erases over the
+// whole partition.
+class SegmentRetention {
+private:
+  LittleFSStorage &storage;
+  EvictionPolicy policy = EVICT_OLDEST;
+  bool downsample = true;
+  unsigned long budgetBytes = 0;        // 0 means the whole partition less the reserve
+  const char* tempPath = MBED_LITTLEFS_FILE_PREFIX "/downsample.tmp";
+
+  bool scanned = false;
+  uint32_t countedSegment = 0;          // Segments below this are included in storedBytes
+  unsigned long storedBytes = 0;
+  uint32_t downsampleCursor = 0;        // Segments below this have nothing left to downsample
+  unsigned long lastCheck = 0;
+  bool pending = false;                 // Still over budget after the last action
+  bool blocked = false;                 // Over budget with nothing the policy allows to free
+
+  // Statistics
+  unsigned long segmentsEvicted = 0;
+  unsigned long segmentsDownsampled = 0;
+  unsigned long long bytesReclaimed = 0;
+
+  // Account for segments committed since the last check
+  void countNewSegments() {
+    if (!scanned) {
+      countedSegment = storage.firstSegment();
+      downsampleCursor = storage.firstSegment();
+      storedBytes = 0;
+      scanned = true;
+    }
+    while (countedSegment < storage.nextSegment()) {
+      long size = storage.segmentFileSize(countedSegment);
+      if (size > 0) storedBytes += size;
+      countedSegment++;
+    }
+  }
+
+  unsigned long effectiveBudget(unsigned long totalBytes) {
+    if (budgetBytes > 0) return budgetBytes;
+    return totalBytes > RETENTION_RESERVE_BYTES ? totalBytes - RETENTION_RESERVE_BYTES : 0;
+  }
+
+  // Bytes that have to be freed to get back within budget and reserve
+  unsigned long excessBytes() {
+    unsigned long blockSize, totalBlocks, freeBlocks;
+    unsigned long excess = 0;
+    if (storage.getBlockUsage(&blockSize, &totalBlocks, &freeBlocks)) {
+      unsigned long long freeBytes = (unsigned long long)freeBlocks * blockSize;
+      if (freeBytes < RETENTION_RESERVE_BYTES) excess = RETENTION_RESERVE_BYTES - freeBytes;
+      unsigned long budget = effectiveBudget(totalBlocks * blockSize);
+      if (storedBytes > budget) excess = max(excess, storedBytes - budget);
+    } else if (budgetBytes > 0 && storedBytes > budgetBytes) {
+      excess = storedBytes - budgetBytes;
+    }
+    return excess;
+  }
+
+  static bool isSampleSegment(const SegmentHeader& header) {
+    return header.recordSize == sizeof(SensorDataPoint) &&
+           (header.kind == SEGMENT_CONTINUOUS || header.kind == SEGMENT_EVENT) &&
+           header.count > 0;
+  }
+
+  // Bytes downsampling a segment would free, 0 if it holds no samples
+  unsigned long downsampleSavings(uint32_t index) {
+    char filePath[128];
+    storage.segmentPath(index, filePath);
+    FILE* file = fopen(filePath, "r");
+    if (!file) return 0;
+
+    SegmentHeader header;
+    bool ok = storage.readSegmentHeader(file, &header);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    if (!ok || !isSampleSegment(header)) return 0;
+
+    long summarySize = sizeof(SegmentHeader) +
+                       (header.count + SUMMARY_FACTOR - 1) / SUMMARY_FACTOR * sizeof(SummaryRecord);
+    return size > summarySize ? size - summarySize : 0;
+  }
+
+  // Whether downsampling segments below limit frees the excess and room for
+  // one more full segment. Otherwise the oldest summary is the next thing
+  // evicted and downsampling it was wasted writes.
+  bool downsampleKeepsUp(uint32_t limit) {
+    unsigned long needed = excessBytes() + SEGMENT_MAX_RECORDS * sizeof(SensorDataPoint);
+    unsigned long savings = 0;
+    for (uint32_t index = downsampleCursor; index < limit && savings < needed; index++) {
+      savings += downsampleSavings(index);
+    }
+    return savings >= needed;
+  }
+
+  bool evictOldest() {
+    uint32_t index = storage.firstSegment();
+    long size = storage.segmentFileSize(index);
+    if (!storage.dropOldestSegment()) return false;
+
+    if (size > 0) {
+      storedBytes -= min((unsigned long)size, storedBytes);
+      bytesReclaimed += size;
+    }
+    segmentsEvicted++;
+    if (downsampleCursor < storage.firstSegment()) {
+      downsampleCursor = storage.firstSegment();
+    }
+
+    Serial.print("Retention evicted segment ");
+    Serial.println((unsigned long)index);
+    return true;
+  }
+
+  // Replace a sample segment with one summary record per SUMMARY_FACTOR samples.
+  // Returns false if the segment holds no samples to downsample.
+  bool downsampleSegment(uint32_t index) {
+    char filePath[128];
+    storage.segmentPath(index, filePath);
+
+    FILE* in = fopen(filePath, "r");
+    if (!in) return false;
+
+    SegmentHeader header;
+    if (!storage.readSegmentHeader(in, &header) || !isSampleSegment(header)) {
+      fclose(in);
+      return false;
+    }
+    long startOffset = ftell(in);
+    fseek(in, 0, SEEK_END);
+    long oldSize = ftell(in);
+    fseek(in, startOffset, SEEK_SET);
+
+    FILE* out = fopen(tempPath, "w");
+    if (!out) {
+      fclose(in);
+      Serial.println("Failed to open downsample file");
+      return false;
+    }
+
+    // The summary keeps the original header, legacy segments get a proper
+    // one. The record count is known up front, so the file is written front
+    // to back.
+    SegmentHeader summaryHeader = header;
+    summaryHeader.magic = SEGMENT_MAGIC;
+    summaryHeader.version = SEGMENT_VERSION;
+    summaryHeader.headerSize = sizeof(SegmentHeader);
+    summaryHeader.recordSize = sizeof(SummaryRecord);
+    summaryHeader.kind = SEGMENT_SUMMARY;
+    summaryHeader.count = (header.count + SUMMARY_FACTOR - 1) / SUMMARY_FACTOR;
+    bool ok = fwrite(&summaryHeader, sizeof(summaryHeader), 1, out) == 1;
+
+    SensorDataPoint points[SUMMARY_FACTOR];
+    int remaining = header.count;
+    while (ok && remaining > 0) {
+      int want = min(remaining, SUMMARY_FACTOR);
+      if ((int)fread(points, sizeof(SensorDataPoint), want, in) != want) {
+        ok = false;
+        break;
+      }
+      remaining -= want;
+
+      SummaryRecord summary;
+      summarizeSamples(points, want, &summary);
+      ok = fwrite(&summary, sizeof(summary), 1, out) == 1;
+    }
+    fclose(in);
+
+    if (fclose(out) != 0) ok = false;
+
+    // Replacing the file in one rename means a power loss leaves either version
+    if (!ok || rename(tempPath, filePath) != 0) {
+      remove(tempPath);
+      Serial.print("Failed to downsample segment ");
+      Serial.println((unsigned long)index);
+      return false;
+    }
+
+    storage.segmentRewritten();
+    long newSize = storage.segmentFileSize(index);
+    if (newSize > 0 && newSize < oldSize) {
+      storedBytes -= min((unsigned long)(oldSize - newSize), storedBytes);
+      bytesReclaimed += oldSize - newSize;
+    }
+    segmentsDownsampled++;
+
+    Serial.print("Retention downsampled segment ");
+    Serial.print((unsigned long)index);
+    Serial.print(" from ");
+    Serial.print(oldSize);
+    Serial.print(" to ");
+    Serial.print(newSize);
+    Serial.println(" bytes");
+    return true;
+  }
+
+  // Free some space. Returns false if the policy allows nothing more.
+  bool reclaimOne() {
+    uint32_t first = storage.firstSegment();
+    uint32_t next = storage.nextSegment();
+    if (first >= next) return false;
+
+    if (first < storage.ackedSegment()) {
+      return evictOldest();
+    }
+
+    // Unsent data is shrunk before any of it is deleted. When recording
+    // must go on, the newer half stays at full resolution and old
+    // summaries are deleted instead, and nothing is downsampled that
+    // eviction would take right after.
+    if (downsample) {
+      uint32_t limit = policy == EVICT_OLDEST ? first + (next - first) / 2 : next;
+      if (downsampleCursor < first) downsampleCursor = first;
+      if (policy == EVICT_OLDEST && !downsampleKeepsUp(limit)) {
+        return evictOldest();
+      }
+      while (downsampleCursor < limit) {
+        uint32_t index = downsampleCursor++;
+        if (downsampleSegment(index)) return true;
+      }
+    }
+
+    if (policy == EVICT_UPLOADED_ONLY) return false;
+    return evictOldest();
+  }
+
+public:
+  SegmentRetention(LittleFSStorage &s) : storage(s) {}
+
+  void configure(EvictionPolicy evictionPolicy, bool allowDownsample, unsigned long budget) {
+    policy = evictionPolicy;
+    downsample = allowDownsample;
+    budgetBytes = budget;
+    blocked = false;
+    pending = true;
+  }
+
+  // Call from loop(). Checks after every new segment and every few seconds,
+  // and frees at most one segment per call.
+  void update() {
+    if (!pending && countedSegment == storage.nextSegment() &&
+        millis() - lastCheck < RETENTION_CHECK_MS) {
+      return;
+    }
+    lastCheck = millis();
+    countNewSegments();
+
+    pending = excessBytes() > 0;
+    if (!pending) {
+      blocked = false;
+      return;
+    }
+
+    if (!reclaimOne()) {
+      if (!blocked) {
+        Serial.println("Retention: flash is full and nothing may be evicted");
+      }
+      blocked = true;
+      pending = false;
+    }
+  }
+
+  // Write the retention state as a JSON object
+  void printStatusJson(Print& out) {
+    unsigned long blockSize, totalBlocks, freeBlocks;
+    bool haveUsage = storage.getBlockUsage(&blockSize, &totalBlocks, &freeBlocks);
+
+    out.print("{\"policy\":\"");
+    out.print(EVICTION_POLICY_NAMES[policy]);
+    out.print("\",\"downsample\":");
+    out.print(downsample ? "true" : "false");
+    out.print(",\"budgetBytes\":");
+    out.print(haveUsage ? effectiveBudget(totalBlocks * blockSize) : budgetBytes);
+    out.print(",\"storedBytes\":");
+    out.print(storedBytes);
+    out.print(",\"reserveBytes\":");
+    out.print(RETENTION_RESERVE_BYTES);
+    out.print(",\"blocked\":");
+    out.print(blocked ? "true" : "false");
+    out.print(",\"firstSegment\":");
+    out.print((unsigned long)storage.firstSegment());
+    out.print(",\"segmentsEvicted\":");
+    out.print(segmentsEvicted);
+    out.print(",\"segmentsDownsampled\":");
+    out.print(segmentsDownsampled);
+    out.print(",\"bytesReclaimed\":");
+    out.print((unsigned long)bytesReclaimed);
+    out.println("}");
+  }
+};
+
+#endif // SEGMENT_RETENTION_H
@@ -0,0 +1,412 @@
+#ifndef SEGMENT_UPLOADER_H
+#define SEGMENT_UPLOADER_H
+
+#include <WiFiNINA.h>
+#include "littlefs_storage.h"
+#include "segment_format.h"
+
+// Completed segments are pushed to the collector as export archives (see
+// segment_format.h), several segments per POST on one keep-alive connection.
+// A 2xx response acknowledges every segment in its request, and the
+// acknowledged high-water mark is kept in the segment catalog so a reboot
+// picks up where the last acknowledged batch ended.
+const unsigned long UPLOAD_BATCH_BYTES = 32768;         // Target body size of one POST
+const int UPLOAD_PIPELINE_DEPTH = 2;                    // POSTs sent ahead of their responses
+const size_t UPLOAD_SLICE_BYTES = 2048;                 // Most body bytes written per update()
+const unsigned long UPLOAD_RESPONSE_TIMEOUT_MS = 15000;
+const unsigned long UPLOAD_RETRY_MIN_MS = 10000;
+const unsigned long UPLOAD_RETRY_MAX_MS = 300000;
+
+struct UploadBatch {
+  uint32_t firstSegment;
+  uint32_t endSegment;       // Exclusive
+  unsigned long length;      // Body bytes announced in Content-Length
+};
+
+class SegmentUploader {
+private:
+  LittleFSStorage &storage;
+  WiFiClient client;
+  char host[64];
+  uint16_t port = 0;
+  bool enabled = false;
+
+  // Requests sent, or still being sent, that have no response yet. Oldest first,
+  // responses arrive in the same order.
+  UploadBatch batches[UPLOAD_PIPELINE_DEPTH];
+  int batchCount = 0;
+  uint32_t queuedSegment = 0;      // First segment not yet part of a request
+
+  // Progress through the body of the newest request
+  bool sending = false;
+  uint32_t sendSegment = 0;
+  FILE* sendFile = NULL;
+  long sendRemaining = 0;          // Bytes of sendFile still to write
+  unsigned long bodySent = 0;
+
+  // Response parser
+  String responseLine;
+  int responseStatus = 0;          // 0 while waiting for a status line
+  long contentLength = 0;
+  long bodyRemaining = 0;
+  unsigned long lastActivity = 0;
+
+  bool waitingRetry = false;
+  unsigned long retryStart = 0;
+  unsigned long retryDelay = UPLOAD_RETRY_MIN_MS;
+
+  // Statistics
+  unsigned long batchesAcked = 0;
+  unsigned long segmentsAcked = 0;
+  unsigned long long bytesSent = 0;
+  unsigned long failures = 0;
+  const char* lastError = "";
+
+  // Drop the connection and everything in flight, the next attempt starts
+  // again from the acknowledged high-water mark
+  void resetConnection() {
+    if (sendFile) {
+      fclose(sendFile);
+      sendFile = NULL;
+    }
+    client.stop();
+    sending = false;
+    batchCount = 0;
+    queuedSegment = max(storage.ackedSegment(), storage.firstSegment());
+    responseLine = "";
+    responseStatus = 0;
+    bodyRemaining = 0;
+  }
+
+  void fail(const char* reason) {
+    Serial.print("Upload failed: ");
+    Serial.println(reason);
+
+    lastError = reason;
+    failures++;
+    resetConnection();
+
+    waitingRetry = true;
+    retryStart = millis();
+    retryDelay = min(retryDelay * 2, UPLOAD_RETRY_MAX_MS);
+  }
+
+  // Group the next segments into one request and send its headers
+  bool startBatch() {
+    UploadBatch batch;
+    batch.firstSegment = queuedSegment;
+    batch.endSegment = queuedSegment;
+    batch.length = sizeof(ArchiveHeader);
+    int entries = 0;
+
+    while (batch.endSegment < storage.nextSegment() && batch.length < UPLOAD_BATCH_BYTES) {
+      long size = storage.segmentFileSize(batch.endSegment);
+      if (size > 0) {
+        batch.length += sizeof(ArchiveEntryHeader) + size;
+        entries++;
+      }
+      batch.endSegment++;
+    }
+
+    // Only deleted segments in this range, nothing to send. Acknowledging
+    // them has to wait until the requests ahead of them are acknowledged.
+    if (entries == 0) {
+      if (batchCount > 0) return false;
+      storage.markSegmentsAcked(batch.endSegment);
+      queuedSegment = batch.endSegment;
+      return false;
+    }
+
+    if (!client.connected()) {
+      client.stop();
+      if (!client.connect(host, port)) {
+        fail("Cannot connect to collector");
+        return false;
+      }
+    }
+
+    client.print("POST /segments HTTP/1.1\r\nHost: ");
+    client.print(host);
+    client.print("\r\nContent-Type: application/octet-stream\r\nContent-Length: ");
+    client.print(batch.length);
+    client.print("\r\nX-Segment-Range: ");
+    client.print((unsigned long)batch.firstSegment);
+    client.print("-");
+    client.print((unsigned long)batch.endSegment - 1);
+    client.print("\r\n\r\n");
+
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.headerSize = sizeof(ArchiveHeader);
+    WiFi.macAddress(header.deviceMac);
+    if (client.write((const uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+      fail("Write to collector failed");
+      return false;
+    }
+
+    batches[batchCount++] = batch;
+    queuedSegment = batch.endSegment;
+    sending = true;
+    sendSegment = batch.firstSegment;
+    sendRemaining = 0;
+    bodySent = sizeof(header);
+    bytesSent += sizeof(header);
+    lastActivity = millis();
+    return true;
+  }
+
+  // Write up to UPLOAD_SLICE_BYTES of the current request body
+  void sendSlice() {
+    const UploadBatch &batch = batches[batchCount - 1];
+    static uint8_t chunk[512];
+    size_t budget = UPLOAD_SLICE_BYTES;
+    lastActivity = millis();
+
+    while (budget > 0) {
+      if (!sendFile) {
+        // Open the next segment in the batch that still exists
+        while (sendSegment < batch.endSegment && storage.segmentFileSize(sendSegment) <= 0) {
+          sendSegment++;
+        }
+
+        if (sendSegment >= batch.endSegment) {
+          if (bodySent != batch.length) {
+            fail("Segment changed during upload");
+            return;
+          }
+          sending = false;
+          return;
+        }
+
+        char filePath[128];
+        storage.segmentPath(sendSegment, filePath);
+        sendFile = fopen(filePath, "r");
+        if (!sendFile) {
+          fail("Failed to open segment for upload");
+          return;
+        }
+        fseek(sendFile, 0, SEEK_END);
+        sendRemaining = ftell(sendFile);
+        fseek(sendFile, 0, SEEK_SET);
+
+        ArchiveEntryHeader entry;
+        entry.magic = ARCHIVE_ENTRY_MAGIC;
+        entry.segmentIndex = sendSegment;
+        entry.length = sendRemaining;
+        if (client.write((const uint8_t*)&entry, sizeof(entry)) != sizeof(entry)) {
+          fail("Write to collector failed");
+          return;
+        }
+        bodySent += sizeof(entry);
+        bytesSent += sizeof(entry);
+        budget -= min(budget, sizeof(entry));
+        continue;
+      }
+
+      size_t toRead = min(min(sizeof(chunk), budget), (size_t)sendRemaining);
+      size_t got = toRead > 0 ? fread(chunk, 1, toRead, sendFile) : 0;
+      if (toRead > 0 && got == 0) {
+        fail("Failed to read segment for upload");
+        return;
+      }
+      if (got > 0 && client.write(chunk, got) != got) {
+        fail("Write to collector failed");
+        return;
+      }
+
+      sendRemaining -= got;
+      bodySent += got;
+      bytesSent += got;
+      budget -= got;
+
+      if (sendRemaining == 0) {
+        fclose(sendFile);
+        sendFile = NULL;
+        sendSegment++;
+      }
+    }
+  }
+
+  // The response to the oldest request is complete
+  bool finishResponse() {
+    int status = responseStatus;
+    responseStatus = 0;
+
+    if (batchCount == 0) {
+      fail("Unexpected response from collector");
+      return false;
+    }
+    if (status < 200 || status >= 300) {
+      fail("Collector rejected segments");
+      return false;
+    }
+
+    UploadBatch batch = batches[0];
+    for (int i = 1; i < batchCount; i++) {
+      batches[i - 1] = batches[i];
+    }
+    batchCount--;
+
+    storage.markSegmentsAcked(batch.endSegment);
+    batchesAcked++;
+    segmentsAcked += batch.endSegment - batch.firstSegment;
+    retryDelay = UPLOAD_RETRY_MIN_MS;
+
+    Serial.print("Collector acknowledged segments ");
+    Serial.print((unsigned long)batch.firstSegment);
+    Serial.print("-");
+    Serial.println((unsigned long)batch.endSegment - 1);
+    return true;
+  }
+
+  // Consume whatever part of the responses has arrived
+  bool readResponses() {
+    int budget = 512;
+    while (client.available() && budget-- > 0) {
+      char c = client.read();
+      lastActivity = millis();
+
+      if (bodyRemaining > 0) {
+        // Response bodies are informational only
+        if (--bodyRemaining == 0 && !finishResponse()) return false;
+        continue;
+      }
+
+      if (c == '\r') continue;
+      if (c != '\n') {
+        if (responseLine.length() < 128) responseLine += c;
+        continue;
+      }
+
+      if (responseStatus == 0) {
+        // Status line, e.g. "HTTP/1.1 200 OK"
+        if (!responseLine.startsWith("HTTP/")) {
+          fail("Malformed response from collector");
+          return false;
+        }
+        responseStatus = responseLine.substring(responseLine.indexOf(' ') + 1).toInt();
+        contentLength = 0;
+      } else if (responseLine.length() == 0) {
+        // End of headers
+        bodyRemaining = contentLength;
+        if (bodyRemaining == 0 && !finishResponse()) return false;
+      } else {
+        int colon = responseLine.indexOf(':');
+        if (colon > 0 && responseLine.substring(0, colon).equalsIgnoreCase("Content-Length")) {
+          contentLength = responseLine.substring(colon + 1).toInt();
+        }
+      }
+      responseLine = "";
+    }
+    return true;
+  }
+
+public:
+  SegmentUploader(LittleFSStorage &s) : storage(s) {
+    host[0] = '\0';
+  }
+
+  // An empty host leaves uploads disabled
+  void begin(const char* collectorHost, uint16_t collectorPort) {
+    configure(collectorHost, collectorPort);
+    queuedSegment = max(storage.ackedSegment(), storage.firstSegment());
+  }
+
+  void configure(const char* collectorHost, uint16_t collectorPort) {
+    resetConnection();
+    strncpy(host, collectorHost, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    port = collectorPort;
+    enabled = host[0] != '\0';
+    waitingRetry = false;
+    retryDelay = UPLOAD_RETRY_MIN_MS;
+  }
+
+  void setEnabled(bool enable) {
+    if (!enable) resetConnection();
+    enabled = enable && host[0] != '\0';
+  }
+
+  // Call from loop(). Does a bounded amount of work so sampling keeps going
+  // while a backlog is uploaded.
+  void update() {
+    if (!enabled) return;
+
+    if (waitingRetry) {
+      if (millis() - retryStart < retryDelay) return;
+      waitingRetry = false;
+    }
+
+    if (WiFi.status() != WL_CONNECTED) {
+      if (batchCount > 0) fail("WiFi disconnected");
+      return;
+    }
+
+    if (batchCount > 0) {
+      if (!readResponses()) return;
+      if (batchCount > 0 && !client.connected()) {
+        fail("Collector closed the connection");
+        return;
+      }
+      if (!sending && batchCount > 0 && millis() - lastActivity > UPLOAD_RESPONSE_TIMEOUT_MS) {
+        fail("Collector did not respond");
+        return;
+      }
+    }
+
+    // Keep the pipeline full while segments are waiting
+    if (!sending && batchCount < UPLOAD_PIPELINE_DEPTH && queuedSegment < storage.nextSegment()) {
+      if (!startBatch()) return;
+    }
+
+    if (sending) {
+      sendSlice();
+    }
+
+    // Give the socket back once everything is acknowledged, WiFiNINA only has a few
+    if (batchCount == 0 && client.connected()) {
+      client.stop();
+    }
+  }
+
+  // Write the upload status as a JSON object
+  void printStatusJson(Print& out) {
+    out.print("{\"enabled\":");
+    out.print(enabled ? "true" : "false");
+    out.print(",\"collector\":\"");
+    out.print(host);
+    out.print(":");
+    out.print(port);
+    out.print("\",\"state\":\"");
+    if (!enabled) {
+      out.print("disabled");
+    } else if (waitingRetry) {
+      out.print("retrying");
+    } else if (batchCount > 0) {
+      out.print("uploading");
+    } else {
+      out.print("idle");
+    }
+    out.print("\",\"ackedSegment\":");
+    out.print((unsigned long)storage.ackedSegment());
+    out.print(",\"pendingSegments\":");
+    out.print((unsigned long)(storage.nextSegment() - max(storage.ackedSegment(), storage.firstSegment())));
+    out.print(",\"inFlight\":");
+    out.print(batchCount);
+    out.print(",\"batchesAcked\":");
+    out.print(batchesAcked);
+    out.print(",\"segmentsAcked\":");
+    out.print(segmentsAcked);
+    out.print(",\"bytesSent\":");
+    out.print((unsigned long)bytesSent);
+    out.print(",\"failures\":");
+    out.print(failures);
+    out.print(",\"lastError\":\"");
+    out.print(lastError);
+    out.println("\"}");
+  }
+};
+
+#endif // SEGMENT_UPLOADER_H
@@ -3,6 +3,7 @@
 
 #include <Arduino_LSM6DS3.h>
 #include "littlefs_storage.h" // Include for timestamp function
+#include "sample_profiler.h"
 
 const int SENSOR_PIN = A0;
 const int BUFFER_SIZE = 100;
@@ -20,12 +21,90 @@ unsigned long timestamp_buffer[BUFFER_SIZE];
 // Current buffer index
 int bufferIndex = 0;
 
+// Ring position up to which continuous mode has stored samples
+int flushedIndex = 0;
+
 // Last read values
 float accelX, accelY, accelZ;
 float gyroX, gyroY, gyroZ;
 int temperature;
 unsigned long lastReadTime;
 
+// Capture modes
+enum CaptureMode {
+  CAPTURE_CONTINUOUS = 0,  // Append every DATA_FLUSH_SAMPLES new samples
+  CAPTURE_EVENT            // Only store windows around detected ride events
+};
+CaptureMode captureMode = CAPTURE_EVENT;
+
+// Event trigger configuration. The loop samples roughly every 50 ms.
+const float ACCEL_TRIGGER_G = 0.08;      // Dynamic acceleration that always triggers
+const float ACCEL_TRIGGER_SIGMA = 4.0;   // Or this many noise deviations above the baseline
+const float GYRO_TRIGGER_DPS = 4.0;      // Rotation rate that counts as a curve
+const float QUIET_ACCEL_G = 0.02;        // Below both quiet limits the car is standing still
+const float QUIET_GYRO_DPS = 1.0;
+const int STOP_QUIET_SAMPLES = 60;       // Quiet samples after motion that make a stop (~3 s)
+const float BASELINE_ALPHA = 1.0 / 64;   // Rolling baseline and noise smoothing factor
+const int PRE_TRIGGER_SAMPLES = 30;      // Samples kept from before the trigger
+const int POST_TRIGGER_SAMPLES = BUFFER_SIZE - PRE_TRIGGER_SAMPLES;
+
+// Event detector state
+bool baselineReady = false;
+float baseX, baseY, baseZ;               // Rolling gravity/steady-state acceleration
+float accelNoiseVar = 0;                 // Rolling variance of the dynamic acceleration
+int samplesSeen = 0;                     // Capped at BUFFER_SIZE, limits the pre-trigger window
+int quietSamples = 0;
+bool stopArmed = false;                  // Only report a stop after the car has moved
+SegmentEventInfo openEvent;              // Window currently being collected
+int openRemaining = 0;                   // Samples still to collect for it
+int openCount = 0;                       // Samples in it so far
+
+// Completed window waiting to be committed to storage
+bool eventWindowReady = false;
+SegmentEventInfo readyEvent;
+int readyStartIndex = 0;
+int readyCount = 0;
+
+unsigned long eventCounts[4] = {0, 0, 0, 0};
+
+void updateEventDetector(int sampleIndex);
+
+// Store the completed event window, if there is one. Call in the same loop
+// pass that completed it: the window ends with the newest sample, so the
+// profiler summary of the newest readyCount samples covers just the window.
+void commitEventWindow(LittleFSStorage& storage) {
+  if (!eventWindowReady) return;
+  
+  SampleTimingSummary timing;
+  sampleProfiler.takeSegmentSummary(readyCount, &timing);
+  
+  storage.saveSensorWindow(
+    accelX_buffer, accelY_buffer, accelZ_buffer,
+    gyroX_buffer, gyroY_buffer, gyroZ_buffer,
+    temperature_buffer, timestamp_buffer,
+    BUFFER_SIZE, readyStartIndex, readyCount,
+    &timing, &readyEvent
+  );
+  eventWindowReady = false;
+}
+
+// Switch capture mode. A window that was just completed is stored first.
+// The detector starts over, a window left open in event mode would
+// otherwise resume over ring slots that were overwritten in between.
+void setCaptureMode(CaptureMode mode, LittleFSStorage& storage) {
+  commitEventWindow(storage);
+  captureMode = mode;
+  baselineReady = false;
+  accelNoiseVar = 0;
+  samplesSeen = 0;
+  quietSamples = 0;
+  stopArmed = false;
+  openRemaining = 0;
+  openCount = 0;
+  eventWindowReady = false;
+  flushedIndex = bufferIndex;
+}
+
 bool setupSensor() {
   // Initialize the IMU
   if (!IMU.begin()) {
@@ -57,8 +136,13 @@ bool setupSensor() {
 }
 
 void updateSensor() {
+  // Note when this sample started, before any reads can delay it
+  unsigned long sampleStartUs = micros();
+  bool freshAccel = false;
+
   // Read accelerometer data if available
   if (IMU.accelerationAvailable()) {
+    freshAccel = true;
     IMU.readAcceleration(accelX, accelY, accelZ);
     
     // Store in buffer
@@ -91,8 +175,100 @@ void updateSensor() {
   lastReadTime = timestamp();
   timestamp_buffer[bufferIndex] = lastReadTime;
   
+  sampleProfiler.recordSample(sampleStartUs, freshAccel);
+  
+  if (captureMode == CAPTURE_EVENT) {
+    updateEventDetector(bufferIndex);
+  }
+  
   // Increment buffer index (circular buffer)
   bufferIndex = (bufferIndex + 1) % BUFFER_SIZE;
 }
 
+// Start collecting an event window. preSamples of the ring are already in it.
+void openEventWindow(int type, uint16_t flags, uint32_t triggerTime, float accelThreshold, int preSamples) {
+  memset(&openEvent, 0, sizeof(openEvent));
+  openEvent.type = type;
+  openEvent.flags = flags;
+  openEvent.triggerTime = triggerTime;
+  openEvent.preTriggerSamples = preSamples;
+  openEvent.accelThreshold = accelThreshold;
+  
+  openCount = preSamples;
+  openRemaining = (flags & EVENT_FLAG_CONTINUED) ? BUFFER_SIZE : POST_TRIGGER_SAMPLES;
+}
+
+// Watch the latest sample against the trigger thresholds and track the
+// open event window. When a window is complete eventWindowReady is set and
+// the window must be committed before the next sample overwrites it.
+void updateEventDetector(int sampleIndex) {
+  if (!baselineReady) {
+    baseX = accelX;
+    baseY = accelY;
+    baseZ = accelZ;
+    baselineReady = true;
+  }
+  
+  float dx = accelX - baseX;
+  float dy = accelY - baseY;
+  float dz = accelZ - baseZ;
+  float dynamicAccel = sqrt(dx * dx + dy * dy + dz * dz);
+  float rotation = sqrt(gyroX * gyroX + gyroY * gyroY + gyroZ * gyroZ);
+  float accelThreshold = max(ACCEL_TRIGGER_G, ACCEL_TRIGGER_SIGMA * (float)sqrt(accelNoiseVar));
+  
+  if (samplesSeen < BUFFER_SIZE) samplesSeen++;
+  
+  // Classify this sample
+  int trigger = EVENT_NONE;
+  if (rotation > GYRO_TRIGGER_DPS) {
+    trigger = EVENT_CURVE;
+  } else if (dynamicAccel > accelThreshold) {
+    trigger = EVENT_ACCEL;
+  }
+  
+  if (dynamicAccel < QUIET_ACCEL_G && rotation < QUIET_GYRO_DPS) {
+    quietSamples++;
+    if (quietSamples >= STOP_QUIET_SAMPLES && stopArmed) {
+      trigger = EVENT_STOP;
+    }
+  } else {
+    quietSamples = 0;
+  }
+  
+  if (openRemaining == 0 && trigger != EVENT_NONE) {
+    // New event, the window starts with what the ring already holds
+    openEventWindow(trigger, 0, lastReadTime, accelThreshold, min(PRE_TRIGGER_SAMPLES, samplesSeen - 1));
+    eventCounts[trigger]++;
+    stopArmed = (trigger != EVENT_STOP);
+  }
+  
+  if (openRemaining == 0) {
+    // Only learn the baseline and noise floor from samples outside events
+    baseX += BASELINE_ALPHA * dx;
+    baseY += BASELINE_ALPHA * dy;
+    baseZ += BASELINE_ALPHA * dz;
+    accelNoiseVar += BASELINE_ALPHA * (dynamicAccel * dynamicAccel - accelNoiseVar);
+    return;
+  }
+  
+  // Add this sample to the open window
+  openCount++;
+  openRemaining--;
+  if (dynamicAccel > openEvent.peakAccel) openEvent.peakAccel = dynamicAccel;
+  if (rotation > openEvent.peakGyro) openEvent.peakGyro = rotation;
+  
+  if (openRemaining > 0) return;
+  
+  // Window complete, hand it over for committing
+  readyEvent = openEvent;
+  readyCount = openCount;
+  readyStartIndex = (sampleIndex - openCount + 1 + BUFFER_SIZE) % BUFFER_SIZE;
+  eventWindowReady = true;
+  
+  // Motion is still going on, carry on in a follow-on window
+  if (trigger == EVENT_ACCEL || trigger == EVENT_CURVE) {
+    openEventWindow(readyEvent.type, EVENT_FLAG_CONTINUED, readyEvent.triggerTime, accelThreshold, 0);
+  }
+}
+
 #endif
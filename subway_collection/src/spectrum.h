@@ -0,0 +1,271 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <Arduino.h>
+#include "segment_format.h"
+#include "sensor.h"
+#include "littlefs_storage.h"
+
+// Spectrum configuration. The window must be a power of two no larger than
+// the sample ring, and is analysed once every SPECTRUM_WINDOW new samples.
+const int SPECTRUM_WINDOW = 64;
+const int SPECTRUM_HALF = SPECTRUM_WINDOW / 2;
+const int SPECTRUM_COUNTS_PER_G = 16384;   // Q15 input scaling, +-2 g after mean removal
+const int SPECTRUM_RECORDS_PER_SEGMENT = 16;
+bool spectrumEnabled = true;
+
+// Q15 tables, filled once by setupSpectrum()
+int16_t spectrumCos[SPECTRUM_HALF + 1];   // cos(2*pi*k/N)
+int16_t spectrumSin[SPECTRUM_HALF + 1];   // sin(2*pi*k/N)
+int16_t spectrumHann[SPECTRUM_WINDOW];
+
+// Working buffers for the packed N/2 point complex FFT
+int16_t fftRe[SPECTRUM_HALF];
+int16_t fftIm[SPECTRUM_HALF];
+uint32_t binPower[SPECTRUM_HALF + 1];
+
+// Completed summaries waiting to be written as one segment
+SpectrumRecord spectrumRecords[SPECTRUM_RECORDS_PER_SEGMENT];
+int spectrumRecordCount = 0;
+SpectrumRecord latestSpectrum;
+bool haveLatestSpectrum = false;
+int samplesSinceSpectrum = 0;
+
+void setupSpectrum() {
+  for (int k = 0; k <= SPECTRUM_HALF; k++) {
+    float angle = 2.0 * PI * k / SPECTRUM_WINDOW;
+    spectrumCos[k] = (int16_t)round(cos(angle) * 32767.0);
+    spectrumSin[k] = (int16_t)round(sin(angle) * 32767.0);
+  }
+  for (int n = 0; n < SPECTRUM_WINDOW; n++) {
+    spectrumHann[n] = (int16_t)round((0.5 - 0.5 * cos(2.0 * PI * n / (SPECTRUM_WINDOW - 1))) * 32767.0);
+  }
+}
+
+// In-place radix-2 complex FFT of SPECTRUM_HALF points. Every stage halves
+// its output so the result is scaled by 1/SPECTRUM_HALF and cannot overflow.
+void fixedComplexFFT(int16_t* re, int16_t* im) {
+  const int n = SPECTRUM_HALF;
+  
+  // Bit-reversal permutation
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  
+  for (int len = 2; len <= n; len <<= 1) {
+    // Twiddle W_len^k = W_N^(k * N / len), N being the real FFT length
+    int step = SPECTRUM_WINDOW / len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < len / 2; k++) {
+        int32_t wr = spectrumCos[k * step];
+        int32_t ws = spectrumSin[k * step];
+        int a = i + k;
+        int b = a + len / 2;
+        // (wr - j ws) * (re + j im)
+        int32_t tr = (wr * re[b] + ws * im[b]) >> 15;
+        int32_t ti = (wr * im[b] - ws * re[b]) >> 15;
+        int32_t ar = re[a];
+        int32_t ai = im[a];
+        re[a] = (ar + tr) >> 1;
+        im[a] = (ai + ti) >> 1;
+        re[b] = (ar - tr) >> 1;
+        im[b] = (ai - ti) >> 1;
+      }
+    }
+  }
+}
+
+// Power spectrum of SPECTRUM_WINDOW real samples (Q15) into binPower[0..N/2].
+// Uses the packed trick: even/odd samples go in as one complex sequence of
+// half the length, then the two interleaved spectra are separated.
+void fixedRealPowerSpectrum(const int16_t* samples) {
+  for (int i = 0; i < SPECTRUM_HALF; i++) {
+    fftRe[i] = samples[2 * i];
+    fftIm[i] = samples[2 * i + 1];
+  }
+  
+  fixedComplexFFT(fftRe, fftIm);
+  
+  for (int k = 0; k <= SPECTRUM_HALF; k++) {
+    int a = k % SPECTRUM_HALF;
+    int b = (SPECTRUM_HALF - k) % SPECTRUM_HALF;
+    
+    // Even part (Z[k] + conj(Z[M-k])) / 2, odd part (Z[k] - conj(Z[M-k])) / 2j
+    int32_t evenRe = ((int32_t)fftRe[a] + fftRe[b]) >> 1;
+    int32_t evenIm = ((int32_t)fftIm[a] - fftIm[b]) >> 1;
+    int32_t oddRe = ((int32_t)fftIm[a] + fftIm[b]) >> 1;
+    int32_t oddIm = ((int32_t)fftRe[b] - fftRe[a]) >> 1;
+    
+    // X[k] = even + W_N^k * odd, then halve to keep the same scale as the FFT
+    int32_t wr = spectrumCos[k];
+    int32_t ws = spectrumSin[k];
+    int32_t xr = (evenRe + ((wr * oddRe + ws * oddIm) >> 15)) >> 1;
+    int32_t xi = (evenIm + ((wr * oddIm - ws * oddRe) >> 15)) >> 1;
+    
+    binPower[k] = (uint32_t)(xr * xr) + (uint32_t)(xi * xi);
+  }
+}
+
+uint16_t isqrt32(uint32_t value) {
+  uint32_t result = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > value) bit >>= 2;
+  while (bit != 0) {
+    if (value >= result + bit) {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint16_t)result;
+}
+
+// Band powers and strongest peaks of one axis from binPower
+void summarizeAxis(SpectrumRecord* record, int axis) {
+  const int binsPerBand = (SPECTRUM_HALF + SPECTRUM_BANDS - 1) / SPECTRUM_BANDS;
+  
+  for (int band = 0; band < SPECTRUM_BANDS; band++) {
+    uint32_t total = 0;
+    // Skip DC, the mean was removed and what is left there is leakage
+    for (int k = max(1, band * binsPerBand); k < min(SPECTRUM_HALF + 1, (band + 1) * binsPerBand); k++) {
+      total = (total > 0xFFFFFFFFUL - binPower[k]) ? 0xFFFFFFFFUL : total + binPower[k];
+    }
+    record->bandPower[axis][band] = total;
+  }
+  
+  for (int p = 0; p < SPECTRUM_PEAKS; p++) {
+    record->peakBin[axis][p] = 0;
+    record->peakMagnitude[axis][p] = 0;
+  }
+  
+  // Local maxima only, so one wide peak doesn't fill every slot
+  for (int k = 1; k <= SPECTRUM_HALF; k++) {
+    if (binPower[k] < binPower[k - 1]) continue;
+    if (k < SPECTRUM_HALF && binPower[k] < binPower[k + 1]) continue;
+    
+    uint16_t magnitude = isqrt32(binPower[k]);
+    if (magnitude == 0) continue;
+    
+    for (int p = 0; p < SPECTRUM_PEAKS; p++) {
+      if (magnitude > record->peakMagnitude[axis][p]) {
+        for (int q = SPECTRUM_PEAKS - 1; q > p; q--) {
+          record->peakMagnitude[axis][q] = record->peakMagnitude[axis][q - 1];
+          record->peakBin[axis][q] = record->peakBin[axis][q - 1];
+        }
+        record->peakMagnitude[axis][p] = magnitude;
+        record->peakBin[axis][p] = k;
+        break;
+      }
+    }
+  }
+}
+
+// Analyse the newest SPECTRUM_WINDOW samples of the ring into a record
+void computeSpectrum(SpectrumRecord* record) {
+  static int16_t samples[SPECTRUM_WINDOW];
+  float* axes[SPECTRUM_AXES] = { accelX_buffer, accelY_buffer, accelZ_buffer };
+  int first = (bufferIndex - SPECTRUM_WINDOW + BUFFER_SIZE) % BUFFER_SIZE;
+  int last = (bufferIndex - 1 + BUFFER_SIZE) % BUFFER_SIZE;
+  
+  memset(record, 0, sizeof(SpectrumRecord));
+  record->timestamp = timestamp_buffer[last];
+  record->windowSize = SPECTRUM_WINDOW;
+  record->countsPerG = SPECTRUM_COUNTS_PER_G;
+  
+  unsigned long span = timestamp_buffer[last] - timestamp_buffer[first];
+  if (span > 0) {
+    record->sampleRateCentiHz = (uint16_t)min(65535UL, (SPECTRUM_WINDOW - 1) * 100000UL / span);
+  }
+  
+  for (int axis = 0; axis < SPECTRUM_AXES; axis++) {
+    float mean = 0;
+    for (int n = 0; n < SPECTRUM_WINDOW; n++) {
+      mean += axes[axis][(first + n) % BUFFER_SIZE];
+    }
+    mean /= SPECTRUM_WINDOW;
+    
+    for (int n = 0; n < SPECTRUM_WINDOW; n++) {
+      float g = axes[axis][(first + n) % BUFFER_SIZE] - mean;
+      int32_t q = (int32_t)(g * SPECTRUM_COUNTS_PER_G);
+      q = constrain(q, -32768, 32767);
+      samples[n] = (int16_t)((q * spectrumHann[n]) >> 15);
+    }
+    
+    fixedRealPowerSpectrum(samples);
+    summarizeAxis(record, axis);
+  }
+}
+
+// Call after every updateSensor(). Computes a spectrum once per window of
+// new samples and writes a segment once enough summaries have collected.
+void updateSpectrum(LittleFSStorage& storage) {
+  if (!spectrumEnabled) return;
+  if (++samplesSinceSpectrum < SPECTRUM_WINDOW) return;
+  samplesSinceSpectrum = 0;
+  
+  computeSpectrum(&latestSpectrum);
+  haveLatestSpectrum = true;
+  
+  spectrumRecords[spectrumRecordCount++] = latestSpectrum;
+  if (spectrumRecordCount == SPECTRUM_RECORDS_PER_SEGMENT) {
+    storage.saveSpectrumSegment(spectrumRecords, spectrumRecordCount);
+    spectrumRecordCount = 0;
+  }
+}
+
+// Peak amplitude in milli-g of a Hann windowed sinusoid for a bin magnitude
+float spectrumMagnitudeToMg(const SpectrumRecord& record, uint16_t magnitude) {
+  return magnitude * 4000.0 / record.countsPerG;
+}
+
+// Write one spectrum record as JSON with frequencies in Hz
+void printSpectrumJson(Print& out, const SpectrumRecord& record) {
+  const char* axisNames[SPECTRUM_AXES] = { "x", "y", "z" };
+  float rate = record.sampleRateCentiHz / 100.0;
+  float binHz = record.windowSize > 0 ? rate / record.windowSize : 0;
+  // Band power is a sum of squared bin magnitudes, convert with the same factor squared
+  float mgPerCount = 4000.0 / record.countsPerG;
+  
+  out.print("{\"timestamp\":");
+  out.print((unsigned long)record.timestamp);
+  out.print(",\"sampleRateHz\":");
+  out.print(rate);
+  out.print(",\"windowSize\":");
+  out.print(record.windowSize);
+  out.print(",\"bandWidthHz\":");
+  out.print(binHz * ((record.windowSize / 2 + SPECTRUM_BANDS - 1) / SPECTRUM_BANDS));
+  
+  for (int axis = 0; axis < SPECTRUM_AXES; axis++) {
+    out.print(",\"");
+    out.print(axisNames[axis]);
+    out.print("\":{\"bandEnergyMg2\":[");
+    for (int band = 0; band < SPECTRUM_BANDS; band++) {
+      if (band > 0) out.print(",");
+      out.print(record.bandPower[axis][band] * mgPerCount * mgPerCount, 1);
+    }
+    out.print("],\"peaks\":[");
+    bool first = true;
+    for (int p = 0; p < SPECTRUM_PEAKS; p++) {
+      if (record.peakMagnitude[axis][p] == 0) continue;
+      if (!first) out.print(",");
+      first = false;
+      out.print("{\"hz\":");
+      out.print(record.peakBin[axis][p] * binHz);
+      out.print(",\"mg\":");
+      out.print(spectrumMagnitudeToMg(record, record.peakMagnitude[axis][p]), 1);
+      out.print("}");
+    }
+    out.print("]}");
+  }
+  out.print("}");
+}
+
+#endif // SPECTRUM_H
@@ -6,15 +6,26 @@
 #include "led_control.h"
 #include "web_files.h"
 #include "littlefs_storage.h"
+#include "spectrum.h"
+#include "segment_export.h"
+#include "segment_uploader.h"
+#include "segment_retention.h"
+#include "gzip_stream.h"
 
 // Forward declarations
 void serveIMUData(WiFiClient &client);
-void serveIMUHistory(WiFiClient &client);
+void serveIMUHistory(WiFiClient &client, bool gzip);
+void serveProfile(WiFiClient &client);
+void serveCaptureStatus(WiFiClient &client);
+void serveSpectrum(WiFiClient &client);
 void serveCompressedFile(WiFiClient &client, const uint8_t *content, size_t length, const char *mime);
 
 // Forward declarations for new flash storage API endpoints
-void serveStorageList(WiFiClient &client, LittleFSStorage &storage);
-void serveStorageData(WiFiClient &client, LittleFSStorage &storage, String filename);
+void serveStorageList(WiFiClient &client, LittleFSStorage &storage, bool gzip);
+void serveStorageData(WiFiClient &client, LittleFSStorage &storage, String filename, bool gzip);
+void serveStorageStats(WiFiClient &client, LittleFSStorage &storage);
+void serveUploadStatus(WiFiClient &client, SegmentUploader &uploader);
+void serveRetentionStatus(WiFiClient &client, SegmentRetention &retention);
 
 void serveCompressedFile(WiFiClient &client, const uint8_t *content, size_t length, const char *mime) {
     Serial.print("\nServing compressed file with mime type: ");
@@ -34,22 +45,129 @@ void serveCompressedFile(WiFiClient &client, const uint8_t *content, size_t leng
     client.write(content, length);
 }
 
-void handleClient(WiFiClient &client) {
-    String request = "";
+// Start a JSON response. With gzip the body is compressed on the fly, print
+// it to the returned stream and close it with endJsonResponse().
+Print &beginJsonResponse(WiFiClient &client, bool gzip) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/json");
+    if (gzip) {
+        client.println("Content-Encoding: gzip");
+        client.println("Vary: Accept-Encoding");
+    }
+    client.println("Access-Control-Allow-Origin: *");
+    client.println();
+    
+    if (!gzip) {
+        return client;
+    }
+    responseGzip.begin(client);
+    return responseGzip;
+}
+
+void endJsonResponse(bool gzip) {
+    if (gzip) {
+        responseGzip.finish();
+    }
+}
+
+// True if an Accept-Encoding header value allows gzip
+bool acceptsGzip(const String &acceptEncoding) {
+    int start = 0;
+    while (start < (int)acceptEncoding.length()) {
+        int end = acceptEncoding.indexOf(',', start);
+        if (end < 0) end = acceptEncoding.length();
+        String coding = acceptEncoding.substring(start, end);
+        coding.trim();
+        if (coding.startsWith("gzip")) {
+            // "gzip;q=0" explicitly refuses it
+            int q = coding.indexOf("q=");
+            return q < 0 || coding.substring(q + 2).toFloat() > 0;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+// Read one line of the request including its line ending. Gives up if
+// nothing arrives for timeoutMs.
+bool readRequestLine(WiFiClient &client, String &line, unsigned long timeoutMs) {
+    line = "";
+    unsigned long lastData = millis();
     while (client.connected()) {
         if (client.available()) {
             char c = client.read();
-            request += c;
+            line += c;
+            lastData = millis();
             if (c == '\n') {
-                break;
+                return true;
             }
+        } else if (millis() - lastData > timeoutMs) {
+            break;
         }
     }
+    return false;
+}
+
+// Value of name in a "a=1&b=2" query string, empty if absent
+String getQueryParam(const String &query, const char *name) {
+    String key = String(name) + "=";
+    int start = 0;
+    while (start < (int)query.length()) {
+        int end = query.indexOf('&', start);
+        if (end < 0) end = query.length();
+        if (query.substring(start, end).startsWith(key)) {
+            return query.substring(start + key.length(), end);
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+unsigned long getQueryParam(const String &query, const char *name, unsigned long defaultValue) {
+    String value = getQueryParam(query, name);
+    return value.length() > 0 ? strtoul(value.c_str(), NULL, 10) : defaultValue;
+}
+
+void handleClient(WiFiClient &client) {
+    String request = "";
+    readRequestLine(client, request, 1000);
 
     Serial.println("Received request: " + request);
 
+    // Read the headers up to the blank line, keeping the ones we act on
+    String range = "";
+    String ifRange = "";
+    bool gzip = false;
+    String header;
+    while (readRequestLine(client, header, 1000)) {
+        header.trim();
+        if (header.length() == 0) {
+            break;
+        }
+        String name = header.substring(0, header.indexOf(':'));
+        if (name.equalsIgnoreCase("Range")) {
+            range = header.substring(header.indexOf(':') + 1);
+            range.trim();
+        }
+        else if (name.equalsIgnoreCase("If-Range")) {
+            ifRange = header.substring(header.indexOf(':') + 1);
+            ifRange.trim();
+        }
+        else if (name.equalsIgnoreCase("Accept-Encoding")) {
+            gzip = acceptsGzip(header.substring(header.indexOf(':') + 1));
+        }
+    }
+
     String path = request.substring(request.indexOf("GET ") + 4);
     path = path.substring(0, path.indexOf(" "));
+    
+    // Split off the query string
+    String query = "";
+    int queryStart = path.indexOf('?');
+    if (queryStart >= 0) {
+        query = path.substring(queryStart + 1);
+        path = path.substring(0, queryStart);
+    }
 
     if (path == "/" || path == "/index.html") {
         serveCompressedFile(client, index_html, index_html_len, "text/html");
@@ -64,19 +182,85 @@ void handleClient(WiFiClient &client) {
         serveIMUData(client);
     }
     else if (path == "/imu_history") {
-        serveIMUHistory(client);
+        serveIMUHistory(client, gzip);
+    }
+    // Sampling jitter and loop phase timing
+    else if (path == "/profile") {
+        serveProfile(client);
     }
     // New API endpoint for flash storage file list
     else if (path == "/storage/list") {
         // Create an instance of LittleFSStorage
         extern LittleFSStorage flashStorage;
-        serveStorageList(client, flashStorage);
+        serveStorageList(client, flashStorage, gzip);
+    }
+    // Latest vibration spectrum summary
+    else if (path == "/spectrum") {
+        serveSpectrum(client);
+    }
+    // Capture mode selection and trigger status
+    else if (path == "/capture/event") {
+        extern LittleFSStorage flashStorage;
+        setCaptureMode(CAPTURE_EVENT, flashStorage);
+        flashStorage.closeSegment();
+        serveCaptureStatus(client);
+    }
+    else if (path == "/capture/continuous") {
+        extern LittleFSStorage flashStorage;
+        setCaptureMode(CAPTURE_CONTINUOUS, flashStorage);
+        serveCaptureStatus(client);
+    }
+    else if (path == "/capture") {
+        serveCaptureStatus(client);
+    }
+    // Write-path and capacity statistics
+    else if (path == "/storage/stats") {
+        extern LittleFSStorage flashStorage;
+        serveStorageStats(client, flashStorage);
+    }
+    // Retention state, policy/downsample/budget change the settings
+    else if (path == "/storage/retention") {
+        extern SegmentRetention segmentRetention;
+        String policy = getQueryParam(query, "policy");
+        String downsample = getQueryParam(query, "downsample");
+        String budget = getQueryParam(query, "budget");
+        if (policy.length() > 0 || downsample.length() > 0 || budget.length() > 0) {
+            segmentRetention.configure(
+                policy == "uploaded" ? EVICT_UPLOADED_ONLY : EVICT_OLDEST,
+                downsample != "0",
+                getQueryParam(query, "budget", 0UL)
+            );
+        }
+        serveRetentionStatus(client, segmentRetention);
+    }
+    // Bulk export of stored segments as one archive, supports Range resume
+    else if (path == "/storage/export") {
+        extern LittleFSStorage flashStorage;
+        ExportSelection selection;
+        selection.firstSegment = getQueryParam(query, "first", flashStorage.firstSegment());
+        selection.lastSegment = getQueryParam(query, "last", 0xFFFFFFFFUL);
+        selection.fromTime = getQueryParam(query, "from", 0UL);
+        selection.toTime = getQueryParam(query, "to", 0xFFFFFFFFUL);
+        serveStorageExport(client, flashStorage, selection, range, ifRange);
+    }
+    // Background upload status, host/port/enable change the collector settings
+    else if (path == "/upload") {
+        extern SegmentUploader segmentUploader;
+        String host = getQueryParam(query, "host");
+        if (host.length() > 0) {
+            segmentUploader.configure(host.c_str(), getQueryParam(query, "port", 8080UL));
+        }
+        String enable = getQueryParam(query, "enable");
+        if (enable.length() > 0) {
+            segmentUploader.setEnabled(enable != "0");
+        }
+        serveUploadStatus(client, segmentUploader);
     }
     // New API endpoint for retrieving flash storage data
     else if (path.startsWith("/storage/data/")) {
         String filename = path.substring(14); // Strip "/storage/data/"
         extern LittleFSStorage flashStorage;
-        serveStorageData(client, flashStorage, filename);
+        serveStorageData(client, flashStorage, filename, gzip);
     }
     // Handle LED control requests
     else if (path.startsWith("/PWMR") || path.startsWith("/PWMG") || path.startsWith("/PWMB")) {
@@ -128,14 +312,9 @@ void serveIMUData(WiFiClient &client) {
     client.println("}");
 }
 
-void serveIMUHistory(WiFiClient &client) {
-    client.println("HTTP/1.1 200 OK");
-    client.println("Content-Type: application/json");
-    client.println("Access-Control-Allow-Origin: *");
-    client.println();
-    
+void printIMUHistory(Print &out) {
     // Start JSON array
-    client.println("[");
+    out.println("[");
     
     // Current position in the circular buffer
     int currentPos = bufferIndex;
@@ -149,49 +328,97 @@ void serveIMUHistory(WiFiClient &client) {
         // Only output entries with valid timestamps
         if (timestamp_buffer[idx] > 0) {
             // If not the first entry, add a comma
-            if (i > 0) client.println(",");
+            if (i > 0) out.println(",");
             
-            client.print("{\"timestamp\":");
-            client.print(timestamp_buffer[idx]);
-            client.print(",\"accel\":{\"x\":");
-            client.print(accelX_buffer[idx]);
-            client.print(",\"y\":");
-            client.print(accelY_buffer[idx]);
-            client.print(",\"z\":");
-            client.print(accelZ_buffer[idx]);
-            client.print("},\"gyro\":{\"x\":");
-            client.print(gyroX_buffer[idx]);
-            client.print(",\"y\":");
-            client.print(gyroY_buffer[idx]);
-            client.print(",\"z\":");
-            client.print(gyroZ_buffer[idx]);
-            client.print("},\"temperature\":");
-            client.print(temperature_buffer[idx]);
-            client.print("}");
+            out.print("{\"timestamp\":");
+            out.print(timestamp_buffer[idx]);
+            out.print(",\"accel\":{\"x\":");
+            out.print(accelX_buffer[idx]);
+            out.print(",\"y\":");
+            out.print(accelY_buffer[idx]);
+            out.print(",\"z\":");
+            out.print(accelZ_buffer[idx]);
+            out.print("},\"gyro\":{\"x\":");
+            out.print(gyroX_buffer[idx]);
+            out.print(",\"y\":");
+            out.print(gyroY_buffer[idx]);
+            out.print(",\"z\":");
+            out.print(gyroZ_buffer[idx]);
+            out.print("},\"temperature\":");
+            out.print(temperature_buffer[idx]);
+            out.print("}");
         }
     }
     
     // End JSON array
-    client.println("]");
+    out.println("]");
+}
+
+void serveIMUHistory(WiFiClient &client, bool gzip) {
+    Print &out = beginJsonResponse(client, gzip);
+    printIMUHistory(out);
+    endJsonResponse(gzip);
 }
 
-void serveStorageList(WiFiClient &client, LittleFSStorage &storage) {
+void serveProfile(WiFiClient &client) {
     client.println("HTTP/1.1 200 OK");
     client.println("Content-Type: application/json");
     client.println("Access-Control-Allow-Origin: *");
     client.println();
     
-    // Start JSON array for files
-    client.println("[");
+    sampleProfiler.printJson(client);
+}
+
+void serveSpectrum(WiFiClient &client) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/json");
+    client.println("Access-Control-Allow-Origin: *");
+    client.println();
+    
+    if (!haveLatestSpectrum) {
+        client.println("{\"error\":\"No spectrum computed yet\"}");
+        return;
+    }
+    
+    printSpectrumJson(client, latestSpectrum);
+    client.println();
+}
+
+void serveCaptureStatus(WiFiClient &client) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/json");
+    client.println("Access-Control-Allow-Origin: *");
+    client.println();
     
-    // Use a simpler approach - just try to open each potential file
-    char knownPrefix[] = MBED_LITTLEFS_FILE_PREFIX "/sensor_data_";
+    client.print("{\"mode\":\"");
+    client.print(captureMode == CAPTURE_EVENT ? "event" : "continuous");
+    client.print("\",\"accelThresholdG\":");
+    client.print(max(ACCEL_TRIGGER_G, ACCEL_TRIGGER_SIGMA * (float)sqrt(accelNoiseVar)), 3);
+    client.print(",\"accelNoiseG\":");
+    client.print(sqrt(accelNoiseVar), 4);
+    client.print(",\"gyroThresholdDps\":");
+    client.print(GYRO_TRIGGER_DPS);
+    client.print(",\"windowOpen\":");
+    client.print(openRemaining > 0 ? "true" : "false");
+    client.print(",\"events\":{\"accel\":");
+    client.print(eventCounts[EVENT_ACCEL]);
+    client.print(",\"curve\":");
+    client.print(eventCounts[EVENT_CURVE]);
+    client.print(",\"stop\":");
+    client.print(eventCounts[EVENT_STOP]);
+    client.println("}}");
+}
+
+void printStorageList(Print &out, LittleFSStorage &storage) {
+    // Start JSON array for files
+    out.println("[");
     
+    // Use a simpler approach - just try to open each cataloged file
     bool firstFile = true;
     
-    for (int i = 0; i < 10; i++) {  // Try the first 10 possible data files
+    for (uint32_t i = storage.firstSegment(); i < storage.nextSegment(); i++) {
         char filename[64];
-        sprintf(filename, "%s%d.dat", knownPrefix, i);
+        storage.segmentPath(i, filename);
         
         FILE* file = fopen(filename, "r");
         if (file) {
@@ -199,16 +426,18 @@ void serveStorageList(WiFiClient &client, LittleFSStorage &storage) {
             fseek(file, 0, SEEK_END);
             long size = ftell(file);
             
-            // Try to read the count header to determine number of records
+            // Read the segment header to determine number of records
             fseek(file, 0, SEEK_SET);
-            int count = 0;
-            fread(&count, sizeof(count), 1, file);
+            SegmentHeader header;
+            if (!storage.readSegmentHeader(file, &header)) {
+                memset(&header, 0, sizeof(header));
+            }
             
             fclose(file);
             
             // Add comma if not the first entry
             if (!firstFile) {
-                client.println(",");
+                out.println(",");
             }
             firstFile = false;
             
@@ -221,26 +450,73 @@ void serveStorageList(WiFiClient &client, LittleFSStorage &storage) {
             }
             
             // Output file info as JSON
-            client.print("{\"filename\":\"");
-            client.print(shortFilename);
-            client.print("\",\"size\":");
-            client.print(size);
-            client.print(",\"records\":");
-            client.print(count);
-            client.print("}");
+            out.print("{\"filename\":\"");
+            out.print(shortFilename);
+            out.print("\",\"size\":");
+            out.print(size);
+            out.print(",\"records\":");
+            out.print((int)header.count);
+            out.print(",\"maxGapUs\":");
+            out.print((unsigned long)header.timing.maxGapUs);
+            out.print(",\"lateSamples\":");
+            out.print((unsigned long)header.timing.lateSamples);
+            out.print(",\"kind\":");
+            out.print(header.kind);
+            if (header.kind == SEGMENT_EVENT) {
+                out.print(",\"event\":{\"type\":");
+                out.print(header.event.type);
+                out.print(",\"flags\":");
+                out.print(header.event.flags);
+                out.print(",\"triggerTime\":");
+                out.print((unsigned long)header.event.triggerTime);
+                out.print(",\"peakAccel\":");
+                out.print(header.event.peakAccel, 3);
+                out.print(",\"peakGyro\":");
+                out.print(header.event.peakGyro);
+                out.print("}");
+            }
+            out.print("}");
         }
     }
     
     // End JSON array
-    client.println("]");
+    out.println("]");
+}
+
+void serveStorageList(WiFiClient &client, LittleFSStorage &storage, bool gzip) {
+    Print &out = beginJsonResponse(client, gzip);
+    printStorageList(out, storage);
+    endJsonResponse(gzip);
+}
+
+void serveStorageStats(WiFiClient &client, LittleFSStorage &storage) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/json");
+    client.println("Access-Control-Allow-Origin: *");
+    client.println();
+    
+    storage.printStatsJson(client);
 }
 
-void serveStorageData(WiFiClient &client, LittleFSStorage &storage, String filename) {
+void serveRetentionStatus(WiFiClient &client, SegmentRetention &retention) {
     client.println("HTTP/1.1 200 OK");
     client.println("Content-Type: application/json");
     client.println("Access-Control-Allow-Origin: *");
     client.println();
     
+    retention.printStatusJson(client);
+}
+
+void serveUploadStatus(WiFiClient &client, SegmentUploader &uploader) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/json");
+    client.println("Access-Control-Allow-Origin: *");
+    client.println();
+    
+    uploader.printStatusJson(client);
+}
+
+void printStorageData(Print &out, LittleFSStorage &storage, String filename) {
     // Verify filename for security (should only contain alphanumeric and underscore)
     bool validFilename = true;
     for (unsigned int i = 0; i < filename.length(); i++) {
@@ -252,59 +528,159 @@ void serveStorageData(WiFiClient &client, LittleFSStorage &storage, String filen
     }
     
     if (!validFilename) {
-        client.println("{\"error\":\"Invalid filename\"}");
+        out.println("{\"error\":\"Invalid filename\"}");
+        return;
+    }
+    
+    // Spectrum segments hold summaries instead of samples
+    SegmentHeader header;
+    bool haveHeader = storage.getSegmentHeader(filename.c_str(), &header);
+    if (haveHeader && header.kind == SEGMENT_SPECTRUM) {
+        SpectrumRecord records[SPECTRUM_RECORDS_PER_SEGMENT];
+        int recordsRead = 0;
+        if (!storage.readSpectrumData(filename.c_str(), records, SPECTRUM_RECORDS_PER_SEGMENT, &recordsRead)) {
+            out.println("{\"error\":\"Failed to read file\"}");
+            return;
+        }
+        
+        out.print("{\"filename\":\"");
+        out.print(filename);
+        out.print("\",\"spectra\":");
+        out.print(recordsRead);
+        out.println(",\"data\":[");
+        for (int i = 0; i < recordsRead; i++) {
+            if (i > 0) out.println(",");
+            printSpectrumJson(out, records[i]);
+        }
+        out.println("]}");
         return;
     }
     
-    // Allocate buffer for data points
-    const int MAX_POINTS = 100; // Limit to 100 data points to avoid memory issues
-    SensorDataPoint dataBuffer[MAX_POINTS];
-    int pointsRead = 0;
+    // Downsampled segments hold one summary per SUMMARY_FACTOR samples
+    if (haveHeader && header.kind == SEGMENT_SUMMARY) {
+        const int MAX_SUMMARIES = 50;
+        SummaryRecord records[MAX_SUMMARIES];
+        int recordsRead = 0;
+        if (!storage.readSummaryData(filename.c_str(), records, MAX_SUMMARIES, &recordsRead)) {
+            out.println("{\"error\":\"Failed to read file\"}");
+            return;
+        }
+        
+        out.print("{\"filename\":\"");
+        out.print(filename);
+        out.print("\",\"summaries\":");
+        out.print(recordsRead);
+        out.println(",\"data\":[");
+        for (int i = 0; i < recordsRead; i++) {
+            if (i > 0) out.println(",");
+            out.print("{\"start\":");
+            out.print((unsigned long)records[i].startTime);
+            out.print(",\"end\":");
+            out.print((unsigned long)records[i].endTime);
+            out.print(",\"samples\":");
+            out.print(records[i].samples);
+            out.print(",\"accel\":{\"mean\":[");
+            out.print(records[i].accelMean[0]);
+            out.print(",");
+            out.print(records[i].accelMean[1]);
+            out.print(",");
+            out.print(records[i].accelMean[2]);
+            out.print("],\"min\":[");
+            out.print(records[i].accelMin[0]);
+            out.print(",");
+            out.print(records[i].accelMin[1]);
+            out.print(",");
+            out.print(records[i].accelMin[2]);
+            out.print("],\"max\":[");
+            out.print(records[i].accelMax[0]);
+            out.print(",");
+            out.print(records[i].accelMax[1]);
+            out.print(",");
+            out.print(records[i].accelMax[2]);
+            out.print("]},\"gyro\":{\"mean\":[");
+            out.print(records[i].gyroMean[0]);
+            out.print(",");
+            out.print(records[i].gyroMean[1]);
+            out.print(",");
+            out.print(records[i].gyroMean[2]);
+            out.print("],\"peak\":[");
+            out.print(records[i].gyroPeak[0]);
+            out.print(",");
+            out.print(records[i].gyroPeak[1]);
+            out.print(",");
+            out.print(records[i].gyroPeak[2]);
+            out.print("]},\"temperature\":");
+            out.print(records[i].temperature);
+            out.print("}");
+        }
+        out.println("]}");
+        return;
+    }
     
-    // Try to read the file
-    if (!storage.readSensorData(filename.c_str(), dataBuffer, MAX_POINTS, &pointsRead)) {
-        client.println("{\"error\":\"Failed to read file\"}");
+    // Sample segments are streamed a chunk at a time so the whole segment
+    // can be dumped without holding it in RAM
+    FILE* file = storage.openSegmentRecords(filename.c_str(), sizeof(SensorDataPoint), &header);
+    if (!file) {
+        out.println("{\"error\":\"Failed to read file\"}");
         return;
     }
     
     // Start JSON response
-    client.println("{");
-    client.print("\"filename\":\"");
-    client.print(filename);
-    client.println("\",");
-    client.print("\"points\":");
-    client.print(pointsRead);
-    client.println(",");
-    client.println("\"data\":[");
+    out.println("{");
+    out.print("\"filename\":\"");
+    out.print(filename);
+    out.println("\",");
+    out.print("\"points\":");
+    out.print(header.count);
+    out.println(",");
+    out.println("\"data\":[");
     
     // Output each data point
-    for (int i = 0; i < pointsRead; i++) {
-        if (i > 0) {
-            client.println(",");
-        }
+    const int CHUNK_POINTS = 16;
+    SensorDataPoint dataBuffer[CHUNK_POINTS];
+    int remaining = header.count;
+    bool first = true;
+    while (remaining > 0) {
+        int got = fread(dataBuffer, sizeof(SensorDataPoint), min(remaining, CHUNK_POINTS), file);
+        if (got <= 0) break;
+        remaining -= got;
         
-        client.print("{\"timestamp\":");
-        client.print(dataBuffer[i].timestamp);
-        client.print(",\"accel\":{\"x\":");
-        client.print(dataBuffer[i].accelX);
-        client.print(",\"y\":");
-        client.print(dataBuffer[i].accelY);
-        client.print(",\"z\":");
-        client.print(dataBuffer[i].accelZ);
-        client.print("},\"gyro\":{\"x\":");
-        client.print(dataBuffer[i].gyroX);
-        client.print(",\"y\":");
-        client.print(dataBuffer[i].gyroY);
-        client.print(",\"z\":");
-        client.print(dataBuffer[i].gyroZ);
-        client.print("},\"temperature\":");
-        client.print(dataBuffer[i].temperature);
-        client.print("}");
+        for (int i = 0; i < got; i++) {
+            if (!first) {
+                out.println(",");
+            }
+            first = false;
+            
+            out.print("{\"timestamp\":");
+            out.print(dataBuffer[i].timestamp);
+            out.print(",\"accel\":{\"x\":");
+            out.print(dataBuffer[i].accelX);
+            out.print(",\"y\":");
+            out.print(dataBuffer[i].accelY);
+            out.print(",\"z\":");
+            out.print(dataBuffer[i].accelZ);
+            out.print("},\"gyro\":{\"x\":");
+            out.print(dataBuffer[i].gyroX);
+            out.print(",\"y\":");
+            out.print(dataBuffer[i].gyroY);
+            out.print(",\"z\":");
+            out.print(dataBuffer[i].gyroZ);
+            out.print("},\"temperature\":");
+            out.print(dataBuffer[i].temperature);
+            out.print("}");
+        }
     }
+    fclose(file);
     
     // End JSON array and object
-    client.println("]");
-    client.println("}");
+    out.println("]");
+    out.println("}");
+}
+
+void serveStorageData(WiFiClient &client, LittleFSStorage &storage, String filename, bool gzip) {
+    Print &out = beginJsonResponse(client, gzip);
+    printStorageData(out, storage, filename);
+    endJsonResponse(gzip);
 }
 
 #endif
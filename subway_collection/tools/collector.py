@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""Stand-in collector for the background segment uploader.
+
+Accepts POST /segments with an export archive body (see src/segment_format.h)
+and appends every segment it has not seen before to <dir>/<mac>.sar, so the
+result can be fed straight to segment_decode. Segments are keyed by device
+MAC and segment index, a batch that is re-sent after a lost acknowledgement
+is answered normally without storing anything twice.
+
+    python3 tools/collector.py --port 8080 --dir collected
+"""
+import argparse
+import json
+import os
+import struct
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+ARCHIVE_MAGIC = 0x53415231
+ARCHIVE_ENTRY_MAGIC = 0x53454745
+ARCHIVE_VERSION = 1
+
+# magic, version, headerSize, deviceMac[6], reserved
+ARCHIVE_HEADER = struct.Struct('<IHH6sH')
+# magic, segmentIndex, length
+ENTRY_HEADER = struct.Struct('<III')
+
+lock = threading.Lock()
+stored = {}  # mac -> set of segment indices already in its archive
+
+
+def parse_archive(data):
+    """Return (mac, [(index, segment bytes)]) or raise ValueError."""
+    if len(data) < ARCHIVE_HEADER.size:
+        raise ValueError('short archive header')
+    magic, version, header_size, mac, _ = ARCHIVE_HEADER.unpack_from(data)
+    if magic != ARCHIVE_MAGIC or version != ARCHIVE_VERSION:
+        raise ValueError('not a segment archive')
+
+    entries = []
+    offset = header_size
+    while offset < len(data):
+        if offset + ENTRY_HEADER.size > len(data):
+            raise ValueError('truncated entry header')
+        magic, index, length = ENTRY_HEADER.unpack_from(data, offset)
+        offset += ENTRY_HEADER.size
+        if magic != ARCHIVE_ENTRY_MAGIC or offset + length > len(data):
+            raise ValueError(f'bad entry for segment {index}')
+        entries.append((index, data[offset:offset + length]))
+        offset += length
+    return mac.hex(':'), entries
+
+
+def archive_path(directory, mac):
+    return os.path.join(directory, mac.replace(':', '') + '.sar')
+
+
+def known_segments(directory, mac):
+    """Segment indices already stored for a device, read once per run."""
+    if mac not in stored:
+        stored[mac] = set()
+        path = archive_path(directory, mac)
+        if os.path.exists(path):
+            with open(path, 'rb') as f:
+                try:
+                    _, entries = parse_archive(f.read())
+                except ValueError as e:
+                    print(f'Warning: {path}: {e}, keeping what was readable')
+                    entries = []
+            stored[mac].update(index for index, _ in entries)
+    return stored[mac]
+
+
+class CollectorHandler(BaseHTTPRequestHandler):
+    # Keep-alive so the device can pipeline several batches per connection
+    protocol_version = 'HTTP/1.1'
+
+    def do_POST(self):
+        if self.path != '/segments':
+            self.reply(404, {'error': 'unknown path'})
+            return
+
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        try:
+            mac, entries = parse_archive(body)
+        except ValueError as e:
+            self.reply(400, {'error': str(e)})
+            return
+
+        new = 0
+        with lock:
+            known = known_segments(self.server.directory, mac)
+            path = archive_path(self.server.directory, mac)
+            with open(path, 'ab') as f:
+                if f.tell() == 0:
+                    f.write(ARCHIVE_HEADER.pack(ARCHIVE_MAGIC, ARCHIVE_VERSION,
+                                                ARCHIVE_HEADER.size,
+                                                bytes.fromhex(mac.replace(':', '')), 0))
+                for index, segment in entries:
+                    if index in known:
+                        continue
+                    f.write(ENTRY_HEADER.pack(ARCHIVE_ENTRY_MAGIC, index, len(segment)))
+                    f.write(segment)
+                    known.add(index)
+                    new += 1
+
+        print(f'{mac}: {self.headers.get("X-Segment-Range")} '
+              f'{new} stored, {len(entries) - new} duplicate')
+        self.reply(200, {'stored': new, 'duplicates': len(entries) - new})
+
+    def reply(self, status, payload):
+        body = json.dumps(payload).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stand-in collector for uploaded segments')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--dir', default='collected', help='where device archives are kept')
+    args = parser.parse_args()
+
+    os.makedirs(args.dir, exist_ok=True)
+    server = ThreadingHTTPServer(('', args.port), CollectorHandler)
+    server.directory = args.dir
+    print(f'Collecting segments into {args.dir}/ on port {args.port}')
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,240 @@
+// Host-side decoder for archives from /storage/export.
+//
+// Build:  g++ -O2 -o segment_decode tools/segment_decode.cpp
+// Usage:  segment_decode [-s spectra.csv] [-m summaries.csv] [archive.sar] > samples.csv
+//
+// Reads the archive (or stdin) in one go and writes every stored IMU sample
+// as CSV. Spectrum segments are written to a second CSV when -s is given,
+// segments downsampled by retention to a third when -m is given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../src/segment_format.h"
+
+static char outBuffer[1 << 20];
+
+static bool readAll(FILE* in, std::vector<uint8_t>& data) {
+  uint8_t chunk[1 << 16];
+  size_t got;
+  while ((got = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    data.insert(data.end(), chunk, chunk + got);
+  }
+  return !ferror(in);
+}
+
+// Parse a segment header the same way the firmware does, including the
+// legacy layout that starts with a bare record count. length bytes of a
+// segment of total bytes are available. A placeholder header is replaced by
+// the trailer when the segment is complete, otherwise its count stays
+// SEGMENT_COUNT_IN_TRAILER.
+static bool parseSegmentHeader(const uint8_t* data, size_t length, size_t total,
+                               SegmentHeader* header, size_t* headerBytes) {
+  memset(header, 0, sizeof(SegmentHeader));
+  if (length < sizeof(uint32_t)) return false;
+
+  uint32_t firstWord;
+  memcpy(&firstWord, data, sizeof(firstWord));
+  if (firstWord != SEGMENT_MAGIC) {
+    header->count = (int32_t)firstWord;
+    header->recordSize = sizeof(SensorDataPoint);
+    *headerBytes = sizeof(uint32_t);
+    return true;
+  }
+
+  if (length < 8) return false;
+  uint16_t headerSize;
+  memcpy(&headerSize, data + 6, sizeof(headerSize));
+  if (headerSize > length) return false;
+
+  size_t known = headerSize < sizeof(SegmentHeader) ? headerSize : sizeof(SegmentHeader);
+  memcpy(header, data, known);
+  *headerBytes = headerSize;
+
+  if (header->count == SEGMENT_COUNT_IN_TRAILER && length == total && total >= 2u * headerSize) {
+    SegmentHeader trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    memcpy(&trailer, data + total - headerSize, known);
+    if (trailer.magic == SEGMENT_MAGIC && trailer.count >= 0) *header = trailer;
+  }
+  return true;
+}
+
+static void writeSamples(FILE* out, uint32_t segment, const SegmentHeader& header,
+                         const uint8_t* records, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    SensorDataPoint p;
+    memcpy(&p, records + i * sizeof(SensorDataPoint), sizeof(p));
+    fprintf(out, "%u,%u,%u,%u,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f,%.1f\n",
+            segment, header.kind, header.event.type, p.timestamp,
+            p.accelX, p.accelY, p.accelZ, p.gyroX, p.gyroY, p.gyroZ, p.temperature);
+  }
+}
+
+static void writeSpectra(FILE* out, uint32_t segment, const uint8_t* records, size_t count) {
+  static const char axisNames[SPECTRUM_AXES] = { 'x', 'y', 'z' };
+  for (size_t i = 0; i < count; i++) {
+    SpectrumRecord r;
+    memcpy(&r, records + i * sizeof(SpectrumRecord), sizeof(r));
+    double rate = r.sampleRateCentiHz / 100.0;
+    double binHz = r.windowSize ? rate / r.windowSize : 0;
+    double mgPerCount = r.countsPerG ? 4000.0 / r.countsPerG : 0;
+
+    for (int axis = 0; axis < SPECTRUM_AXES; axis++) {
+      fprintf(out, "%u,%u,%.2f,%c", segment, r.timestamp, rate, axisNames[axis]);
+      for (int band = 0; band < SPECTRUM_BANDS; band++) {
+        fprintf(out, ",%.2f", r.bandPower[axis][band] * mgPerCount * mgPerCount);
+      }
+      for (int p = 0; p < SPECTRUM_PEAKS; p++) {
+        fprintf(out, ",%.3f,%.2f", r.peakBin[axis][p] * binHz, r.peakMagnitude[axis][p] * mgPerCount);
+      }
+      fputc('\n', out);
+    }
+  }
+}
+
+static void writeSummaries(FILE* out, uint32_t segment, const SegmentHeader& header,
+                           const uint8_t* records, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    SummaryRecord r;
+    memcpy(&r, records + i * sizeof(SummaryRecord), sizeof(r));
+    fprintf(out, "%u,%u,%u,%u,%u", segment, header.event.type, r.startTime, r.endTime, r.samples);
+    for (int axis = 0; axis < 3; axis++) {
+      fprintf(out, ",%.4f,%.4f,%.4f", r.accelMean[axis], r.accelMin[axis], r.accelMax[axis]);
+    }
+    for (int axis = 0; axis < 3; axis++) {
+      fprintf(out, ",%.3f,%.3f", r.gyroMean[axis], r.gyroPeak[axis]);
+    }
+    fprintf(out, ",%.1f\n", r.temperature);
+  }
+}
+
+int main(int argc, char** argv) {
+  const char* inputPath = NULL;
+  const char* spectrumPath = NULL;
+  const char* summaryPath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      spectrumPath = argv[++i];
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      summaryPath = argv[++i];
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      fprintf(stderr, "usage: %s [-s spectra.csv] [-m summaries.csv] [archive.sar]\n", argv[0]);
+      return 2;
+    } else {
+      inputPath = argv[i];
+    }
+  }
+
+  FILE* in = inputPath ? fopen(inputPath, "rb") : stdin;
+  if (!in) {
+    perror(inputPath);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  if (!readAll(in, data)) {
+    perror("read");
+    return 1;
+  }
+  if (in != stdin) fclose(in);
+
+  FILE* spectra = NULL;
+  if (spectrumPath) {
+    spectra = fopen(spectrumPath, "w");
+    if (!spectra) {
+      perror(spectrumPath);
+      return 1;
+    }
+    fprintf(spectra, "segment,timestamp,rate_hz,axis");
+    for (int band = 0; band < SPECTRUM_BANDS; band++) fprintf(spectra, ",band%d_mg2", band);
+    for (int p = 0; p < SPECTRUM_PEAKS; p++) fprintf(spectra, ",peak%d_hz,peak%d_mg", p, p);
+    fputc('\n', spectra);
+  }
+
+  FILE* summaries = NULL;
+  if (summaryPath) {
+    summaries = fopen(summaryPath, "w");
+    if (!summaries) {
+      perror(summaryPath);
+      return 1;
+    }
+    fprintf(summaries, "segment,event,start,end,samples");
+    for (char axis = 'x'; axis <= 'z'; axis++) {
+      fprintf(summaries, ",accel_%c_mean,accel_%c_min,accel_%c_max", axis, axis, axis);
+    }
+    for (char axis = 'x'; axis <= 'z'; axis++) {
+      fprintf(summaries, ",gyro_%c_mean,gyro_%c_peak", axis, axis);
+    }
+    fprintf(summaries, ",temperature\n");
+  }
+
+  setvbuf(stdout, outBuffer, _IOFBF, sizeof(outBuffer));
+  printf("segment,kind,event,timestamp,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z,temperature\n");
+
+  ArchiveHeader archive;
+  if (data.size() < sizeof(archive)) {
+    fprintf(stderr, "Input too short for an archive header\n");
+    return 1;
+  }
+  memcpy(&archive, data.data(), sizeof(archive));
+  if (archive.magic != ARCHIVE_MAGIC) {
+    fprintf(stderr, "Not a segment archive\n");
+    return 1;
+  }
+
+  size_t pos = archive.headerSize;
+  unsigned segments = 0;
+  unsigned long long samples = 0;
+
+  while (pos + sizeof(ArchiveEntryHeader) <= data.size()) {
+    ArchiveEntryHeader entry;
+    memcpy(&entry, data.data() + pos, sizeof(entry));
+    if (entry.magic != ARCHIVE_ENTRY_MAGIC) {
+      fprintf(stderr, "Bad entry header at offset %zu\n", pos);
+      return 1;
+    }
+    pos += sizeof(entry);
+
+    // A truncated download ends in the middle of an entry, decode what is there
+    size_t available = data.size() - pos < entry.length ? data.size() - pos : entry.length;
+    const uint8_t* segment = data.data() + pos;
+
+    SegmentHeader header;
+    size_t headerBytes;
+    if (parseSegmentHeader(segment, available, entry.length, &header, &headerBytes) && header.recordSize > 0) {
+      size_t count = (available - headerBytes) / header.recordSize;
+      if (header.count >= 0 && count > (size_t)header.count) count = header.count;
+      if (header.count == SEGMENT_COUNT_IN_TRAILER && entry.length >= 2 * headerBytes) {
+        // Cut off before the trailer, keep the records that made it
+        size_t records = (entry.length - 2 * headerBytes) / header.recordSize;
+        if (count > records) count = records;
+      }
+
+      if (header.kind == SEGMENT_SPECTRUM) {
+        if (spectra && header.recordSize == sizeof(SpectrumRecord)) {
+          writeSpectra(spectra, entry.segmentIndex, segment + headerBytes, count);
+        }
+      } else if (header.kind == SEGMENT_SUMMARY) {
+        if (summaries && header.recordSize == sizeof(SummaryRecord)) {
+          writeSummaries(summaries, entry.segmentIndex, header, segment + headerBytes, count);
+        }
+      } else if (header.recordSize == sizeof(SensorDataPoint)) {
+        writeSamples(stdout, entry.segmentIndex, header, segment + headerBytes, count);
+        samples += count;
+      }
+      segments++;
+    }
+
+    pos += available;
+  }
+
+  fflush(stdout);
+  if (spectra) fclose(spectra);
+  if (summaries) fclose(summaries);
+
+  fprintf(stderr, "Decoded %u segments, %llu samples\n", segments, samples);
+  return 0;
+}